@@ -0,0 +1,347 @@
+/* Measures how long common cache operations take on a synthetic cache of a
+ * given size, and prints the results as JSON. The cache is generated through
+ * Cache itself, so it always has the current schema.
+ *
+ * Run `bench/cache-benchmark -h` for the list of options. */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "3rd-party/json.hpp"
+#include "cache.h"
+#include "configcontainer.h"
+#include "rss.h"
+
+using namespace newsboat;
+
+namespace {
+
+struct Parameters {
+	unsigned int feeds = 100;
+	unsigned int items = 100;
+	unsigned int content_size = 2000;
+	double read_ratio = 0.5;
+	bool compress = false;
+	bool generate_only = false;
+	// If empty, a temporary file is used and removed afterwards
+	std::string cachefile;
+};
+
+void print_usage(const char* argv0)
+{
+	std::cerr
+		<< "usage: " << argv0 << " [-f feeds] [-i items] [-s size] "
+		<< "[-r ratio] [-z] [-o cachefile [-g]]\n"
+		<< "\t-f feeds      number of feeds (default: 100)\n"
+		<< "\t-i items      number of articles per feed (default: "
+		   "100)\n"
+		<< "\t-s size       bytes of content per article (default: "
+		   "2000)\n"
+		<< "\t-r ratio      share of articles that are read, 0 to 1 "
+		   "(default: 0.5)\n"
+		<< "\t-z            compress article contents\n"
+		<< "\t-o cachefile  write the cache to this file and keep it\n"
+		<< "\t-g            only generate the cache, don't measure "
+		   "anything\n";
+}
+
+bool parse_args(int argc, char* argv[], Parameters& params)
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "f:i:s:r:zo:gh")) != -1) {
+		switch (opt) {
+		case 'f':
+			params.feeds = std::strtoul(optarg, nullptr, 10);
+			break;
+		case 'i':
+			params.items = std::strtoul(optarg, nullptr, 10);
+			break;
+		case 's':
+			params.content_size =
+				std::strtoul(optarg, nullptr, 10);
+			break;
+		case 'r':
+			params.read_ratio = std::strtod(optarg, nullptr);
+			break;
+		case 'z':
+			params.compress = true;
+			break;
+		case 'o':
+			params.cachefile = optarg;
+			break;
+		case 'g':
+			params.generate_only = true;
+			break;
+		default:
+			return false;
+		}
+	}
+	if (params.generate_only && params.cachefile.empty()) {
+		std::cerr << argv[0] << ": -g requires -o" << std::endl;
+		return false;
+	}
+	return optind == argc;
+}
+
+/* Produces the same articles on every run, so that results of different
+ * builds can be compared. */
+class Generator {
+public:
+	explicit Generator(const Parameters& p)
+		: params(p)
+		, rng(42)
+	{
+		// Syllables make up a vocabulary of pronounceable words, a few
+		// of which are much more frequent than the rest, like in real
+		// text.
+		const std::vector<std::string> syllables = {"ka",
+			"lo",
+			"mi",
+			"nu",
+			"pe",
+			"ra",
+			"si",
+			"to",
+			"vu",
+			"ze"};
+		for (const auto& a : syllables) {
+			for (const auto& b : syllables) {
+				for (const auto& c : syllables) {
+					words.push_back(a + b + c);
+				}
+			}
+		}
+	}
+
+	std::shared_ptr<RssFeed> make_feed(Cache* cache, unsigned int number)
+	{
+		auto feed = std::make_shared<RssFeed>(cache);
+		feed->set_rssurl(feed_url(number));
+		feed->set_title("Feed " + std::to_string(number));
+		feed->set_link("https://example.com/" + std::to_string(number));
+
+		const time_t now = time(nullptr);
+		std::uniform_real_distribution<double> read(0.0, 1.0);
+		for (unsigned int i = 0; i < params.items; ++i) {
+			auto item = std::make_shared<RssItem>(cache);
+			item->set_guid(
+				feed_url(number) + "#" + std::to_string(i));
+			item->set_title(text(40));
+			item->set_link(feed->link() + "/" + std::to_string(i));
+			item->set_author("Author " + std::to_string(i % 7));
+			item->set_description(text(params.content_size));
+			item->set_pubDate(now - i * 3600);
+			item->set_unread_nowrite(
+				read(rng) >= params.read_ratio);
+			feed->add_item(item);
+		}
+		return feed;
+	}
+
+	// Gives a tenth of the feed's articles new content
+	void change_some_items(std::shared_ptr<RssFeed> feed)
+	{
+		for (unsigned int i = 0; i < feed->total_item_count();
+			i += 10) {
+			feed->items()[i]->set_description(
+				text(params.content_size));
+		}
+	}
+
+	static std::string feed_url(unsigned int number)
+	{
+		return "https://example.com/" + std::to_string(number) +
+			"/feed.xml";
+	}
+
+	// A word of medium frequency, so that searches find some articles
+	// but not most of them
+	std::string search_term() const
+	{
+		return words[words.size() / 2];
+	}
+
+private:
+	std::string text(unsigned int size)
+	{
+		// Zipf-ish: low indices are picked far more often
+		std::uniform_real_distribution<double> pick(0.0, 1.0);
+		std::string result;
+		while (result.size() < size) {
+			const double x = pick(rng);
+			const size_t index = static_cast<size_t>(
+					x * x * x * words.size());
+			result += words[index];
+			result += ' ';
+		}
+		result.resize(size);
+		return result;
+	}
+
+	const Parameters& params;
+	std::mt19937 rng;
+	std::vector<std::string> words;
+};
+
+template<typename F>
+double measure(F f)
+{
+	const auto start = std::chrono::steady_clock::now();
+	f();
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+void remove_cache(const std::string& cachefile)
+{
+	for (const auto& suffix : {"", "-wal", "-shm"}) {
+		std::remove((cachefile + suffix).c_str());
+	}
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+	Parameters params;
+	if (!parse_args(argc, argv, params)) {
+		print_usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	const bool keep_cache = !params.cachefile.empty();
+	if (!keep_cache) {
+		char path[] = "/tmp/newsboat-bench.XXXXXX";
+		const int fd = mkstemp(path);
+		if (fd == -1) {
+			std::perror("mkstemp");
+			return EXIT_FAILURE;
+		}
+		close(fd);
+		params.cachefile = path;
+	}
+	remove_cache(params.cachefile);
+
+	ConfigContainer cfg;
+	cfg.set_configvalue("compress-cache", params.compress ? "yes" : "no");
+	cfg.set_configvalue("cache-query-stats", "yes");
+
+	Generator generator(params);
+	std::vector<std::string> urls;
+	for (unsigned int i = 0; i < params.feeds; ++i) {
+		urls.push_back(Generator::feed_url(i));
+	}
+
+	nlohmann::json results;
+	std::unique_ptr<Cache> cache(new Cache(params.cachefile, &cfg));
+
+	std::vector<std::shared_ptr<RssFeed>> feeds;
+	for (unsigned int i = 0; i < params.feeds; ++i) {
+		feeds.push_back(generator.make_feed(cache.get(), i));
+	}
+	results["externalize_rssfeed_new_ms"] = measure([&]() {
+		for (const auto& feed : feeds) {
+			cache->externalize_rssfeed(feed, false);
+		}
+	});
+
+	if (!params.generate_only) {
+		results["externalize_rssfeed_unchanged_ms"] = measure([&]() {
+			for (const auto& feed : feeds) {
+				cache->externalize_rssfeed(feed, false);
+			}
+		});
+
+		for (const auto& feed : feeds) {
+			generator.change_some_items(feed);
+		}
+		results["externalize_rssfeed_changed_ms"] = measure([&]() {
+			for (const auto& feed : feeds) {
+				cache->externalize_rssfeed(feed, false);
+			}
+		});
+	}
+	feeds.clear();
+	cache.reset();
+
+	if (!params.generate_only) {
+		results["startup_ms"] = measure([&]() {
+			cache.reset(new Cache(params.cachefile, &cfg));
+			feeds = cache->internalize_rssfeeds(urls, nullptr);
+		});
+		feeds.clear();
+		cache.reset();
+
+		results["startup_lazy_ms"] = measure([&]() {
+			cache.reset(new Cache(params.cachefile, &cfg));
+			feeds = cache->internalize_rssfeed_counts(
+					urls, nullptr);
+		});
+
+		results["internalize_rssfeed_ms"] = measure([&]() {
+			for (const auto& url : urls) {
+				cache->internalize_rssfeed(url, nullptr);
+			}
+		});
+
+		size_t found = 0;
+		results["search_for_items_ms"] = measure([&]() {
+			found = cache->search_for_items(
+					generator.search_term(), "")
+				.size();
+		});
+		results["search_for_items_found"] = found;
+
+		results["mark_all_read_feed_ms"] = measure([&]() {
+			for (const auto& url : urls) {
+				cache->mark_all_read(url);
+			}
+		});
+		results["mark_all_read_ms"] =
+			measure([&]() { cache->mark_all_read(); });
+
+		results["unread_count"] = cache->get_unread_count();
+
+		const StorageStats storage = cache->get_storage_stats();
+		results["cache_size_bytes"] = storage.pages * storage.page_size;
+
+		nlohmann::json queries = nlohmann::json::array();
+		for (const auto& entry : cache->get_query_stats()) {
+			if (queries.size() == 10) {
+				break;
+			}
+			queries.push_back({{"query", entry.first},
+				{"calls", entry.second.calls},
+				{"total_ms", entry.second.total_time / 1e6}});
+		}
+		results["slowest_queries"] = queries;
+
+		// Keeps only the first half of the feeds. Leaves the cache
+		// locked, so it has to come last.
+		feeds.resize(feeds.size() / 2);
+		results["cleanup_cache_ms"] =
+			measure([&]() { cache->cleanup_cache(feeds); });
+		feeds.clear();
+	}
+	cache.reset();
+
+	nlohmann::json output;
+	output["parameters"] = {{"feeds", params.feeds},
+		{"items", params.items},
+		{"content_size", params.content_size},
+		{"read_ratio", params.read_ratio},
+		{"compress", params.compress}};
+	output["results"] = results;
+	std::cout << output.dump(1, '\t') << std::endl;
+
+	if (!keep_cache) {
+		remove_cache(params.cachefile);
+	}
+	return EXIT_SUCCESS;
+}
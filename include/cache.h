@@ -1,11 +1,21 @@
 #ifndef NEWSBOAT_CACHE_H_
 #define NEWSBOAT_CACHE_H_
 
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <sqlite3.h>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 
 #include "configcontainer.h"
+#include "reloadschedule.h"
 #include "rss.h"
 
 namespace newsboat {
@@ -35,20 +45,74 @@ const SchemaVersion unknown_version = {0, 0};
 
 using schema_patches = std::map<SchemaVersion, std::vector<std::string>>;
 
+struct FeedCounts {
+	unsigned int unread;
+	unsigned int total;
+};
+
+struct RecompressStats {
+	unsigned int articles;
+	uint64_t bytes_before;
+	uint64_t bytes_after;
+	// Average time it takes to read back an article's content, in
+	// microseconds
+	double decode_time;
+};
+
+struct StorageStats {
+	uint64_t page_size;
+	uint64_t pages;
+	// Pages that hold no data and can be given back to the file system
+	uint64_t free_pages;
+};
+
+// Timings of a query, added up over all the times it was run. Times are in
+// nanoseconds.
+struct QueryStats {
+	uint64_t calls = 0;
+	uint64_t total_time = 0;
+	uint64_t max_time = 0;
+	uint64_t rows_returned = 0;
+	uint64_t rows_changed = 0;
+	// One of the queries, as it was run
+	std::string sample;
+};
+
+// A READ_ONLY cache can be opened while another instance is using the same
+// file. It drops queued changes, and its other writes throw DbException.
+enum class CacheMode { READ_WRITE, READ_ONLY };
+
 class Cache {
 public:
-	Cache(const std::string& cachefile, ConfigContainer* c);
+	Cache(const std::string& cachefile,
+		ConfigContainer* c,
+		CacheMode mode = CacheMode::READ_WRITE);
 	~Cache();
 	void externalize_rssfeed(std::shared_ptr<RssFeed> feed,
 		bool reset_unread);
 	std::shared_ptr<RssFeed> internalize_rssfeed(std::string rssurl,
 		RssIgnores* ign);
+	std::vector<std::shared_ptr<RssFeed>> internalize_rssfeeds(
+		const std::vector<std::string>& rssurls,
+		RssIgnores* ign);
+	std::vector<std::shared_ptr<RssFeed>> internalize_rssfeed_counts(
+		const std::vector<std::string>& rssurls,
+		RssIgnores* ign);
+	std::vector<std::shared_ptr<RssItem>> internalize_rssitems(
+		const std::string& rssurl,
+		RssIgnores* ign);
 	void update_rssitem_unread_and_enqueued(std::shared_ptr<RssItem> item,
 		const std::string& feedurl);
 	void update_rssitem_unread_and_enqueued(RssItem* item,
 		const std::string& feedurl);
 	void cleanup_cache(std::vector<std::shared_ptr<RssFeed>>& feeds);
 	void do_vacuum();
+	StorageStats get_storage_stats();
+	unsigned int compact(unsigned int max_pages);
+	unsigned int archive_old_items(unsigned int max_items);
+	/// \brief Returns timings of the queries run so far, slowest first.
+	/// Empty unless `cache-query-stats` was set when the cache was opened.
+	std::vector<std::pair<std::string, QueryStats>> get_query_stats();
 	std::vector<std::shared_ptr<RssItem>> search_for_items(
 		const std::string& querystr,
 		const std::string& feedurl);
@@ -58,39 +122,122 @@ public:
 	void mark_all_read(const std::string& feedurl = "");
 	void mark_all_read(std::shared_ptr<RssFeed> feed);
 	void update_rssitem_flags(RssItem* item);
+	void flush_pending_changes();
 	void fetch_lastmodified(const std::string& uri,
 		time_t& t,
 		std::string& etag);
 	void update_lastmodified(const std::string& uri,
 		time_t t,
 		const std::string& etag);
+	/// \brief Returns how many milliseconds each feed took to fetch on
+	/// its last reload, keyed by feed URL. Feeds that were never timed
+	/// are left out.
+	std::unordered_map<std::string, unsigned int> get_fetch_times();
+	void update_fetch_times(const std::unordered_map<std::string,
+		unsigned int>& fetch_times);
+	std::unordered_map<std::string, time_t> get_next_reload_times();
+	void set_next_reload_time(const std::string& feedurl,
+		time_t next_reload);
+	std::vector<time_t> get_recent_pubdates(const std::string& feedurl,
+		unsigned int limit);
+	/// \brief Hash of a feed document, as stored by set_body_hash().
+	///
+	/// \a settings are mixed in, so that the hash changes when they do.
+	static int64_t hash_body(const std::string& body,
+		const std::string& settings);
+	/// \brief Returns the hash of the document the feed was last parsed
+	/// from, or 0 if it's unknown.
+	int64_t get_body_hash(const std::string& feedurl);
+	void set_body_hash(const std::string& feedurl, int64_t hash);
+	/// \brief Returns the refresh hints stored by set_refresh_hints().
+	RefreshHints get_refresh_hints(const std::string& feedurl);
+	void set_refresh_hints(const std::string& feedurl,
+		const RefreshHints& hints);
 	unsigned int get_unread_count();
+	std::unordered_map<std::string, FeedCounts> get_feed_counts();
+	bool check_feed_counts();
+	void rebuild_feed_counts();
+	RecompressStats recompress_content();
 	void mark_item_deleted(const std::string& guid, bool b);
 	void mark_feed_items_deleted(const std::string& feedurl);
 	void remove_old_deleted_items(const std::string& rssurl,
 		const std::vector<std::string>& guids);
-	void mark_items_read_by_guid(const std::vector<std::string>& guids);
+	unsigned int mark_items_read_by_guid(
+		const std::vector<std::string>& guids);
+	void for_each_read_item_guid(
+		const std::function<void(const std::string&)>& callback);
 	std::vector<std::string> get_read_item_guids();
 	void fetch_descriptions(RssFeed* feed);
 
 private:
 	SchemaVersion get_schema_version();
 	void populate_tables();
+	void create_fts_index();
+	void open_read_only();
+	void open_archive();
 	void set_pragmas();
-	void delete_item(const std::shared_ptr<RssItem>& item);
-	void clean_old_articles();
+	class ItemsRead;
+	void prepare_internalized_feed(std::shared_ptr<RssFeed> feed,
+		RssIgnores* ign,
+		const ItemsRead& read);
+	void delete_expired_items(sqlite3_int64 feed_id);
+	void delete_old_articles();
 	void update_rssitem_unlocked(std::shared_ptr<RssItem> item,
 		const std::string& feedurl,
+		sqlite3_int64 feed_id,
 		bool reset_unread);
 
-	std::string prepare_query(const std::string& format);
-	template<typename... Args>
-	std::string prepare_query(const std::string& format,
-		const std::string& arg,
-		Args... args);
-	template<typename T, typename... Args>
-	std::string
-	prepare_query(const std::string& format, const T& arg, Args... args);
+	// Changes to an article's state that update_rssitem_unread_and_enqueued
+	// and update_rssitem_flags queued up, but haven't written yet.
+	struct PendingChange {
+		bool state_changed = false;
+		bool unread = false;
+		bool enqueued = false;
+		bool flags_changed = false;
+		std::string flags;
+	};
+
+	// Registers a read of articles for as long as it exists, so that
+	// batches which are committed meanwhile are kept for
+	// apply_pending_changes(): the read's snapshot may predate them.
+	class ItemsRead {
+	public:
+		explicit ItemsRead(Cache& cache);
+		~ItemsRead();
+		ItemsRead(const ItemsRead&) = delete;
+		ItemsRead& operator=(const ItemsRead&) = delete;
+
+		// Called by run_read() once the connection is locked, right
+		// before the query takes its snapshot.
+		void start();
+
+		uint64_t generation() const
+		{
+			return read_generation;
+		}
+
+	private:
+		Cache& cache;
+		uint64_t read_generation;
+	};
+
+	void apply_pending_changes(
+		const std::vector<std::shared_ptr<RssItem>>& items,
+		const ItemsRead& read);
+	void write_pending_changes_loop();
+	void stop_changes_writer();
+	void compact_when_idle();
+	void archive_when_idle();
+	unsigned int archive_old_items_unlocked(unsigned int max_items);
+	void restore_archived_items();
+	unsigned int compact_unlocked(unsigned int max_pages);
+	StorageStats get_storage_stats_unlocked();
+
+	static int trace_statement(unsigned int type,
+		void* context,
+		void* p,
+		void* x);
+	void log_query_stats();
 
 	void run_sql(const std::string& query,
 		int (*callback)(void*, int, char**, char**) = nullptr,
@@ -98,14 +245,135 @@ private:
 	void run_sql_nothrow(const std::string& query,
 		int (*callback)(void*, int, char**, char**) = nullptr,
 		void* callback_argument = nullptr);
-	void run_sql_impl(const std::string& query,
+	void run_sql_impl(sqlite3* connection,
+		const std::string& query,
 		int (*callback)(void*, int, char**, char**),
 		void* callback_argument,
 		bool do_throw);
 
+	// Read-only connection to the same database. With WAL journal, it
+	// doesn't have to wait for writes that are in progress.
+	struct ReaderConnection {
+		sqlite3* db;
+		std::mutex mtx;
+		std::unordered_map<std::string, sqlite3_stmt*> statements;
+	};
+
+	void open_readers(const std::string& cachefile);
+	std::unique_lock<std::mutex> acquire_reader(ReaderConnection*& reader);
+
+	// Like run_sql and run_prepared, but for SELECTs that can be served by
+	// a reader connection. Callers must not hold `mtx`.
+	void run_read_sql(const std::string& query,
+		int (*callback)(void*, int, char**, char**),
+		void* callback_argument);
+	template<typename... Args>
+	void run_read(const std::string& query,
+		const std::function<void(sqlite3_stmt*)>& row_reader,
+		const Args&... args);
+	// Like run_read, but for the articles that `read` is registered for.
+	template<typename... Args>
+	void run_read(ItemsRead& read,
+		const std::string& query,
+		const std::function<void(sqlite3_stmt*)>& row_reader,
+		const Args&... args);
+	template<typename... Args>
+	void run_read_impl(ItemsRead* read,
+		const std::string& query,
+		const std::function<void(sqlite3_stmt*)>& row_reader,
+		const Args&... args);
+
+	// Replaces the contents of the connection's temp.key_set table with
+	// `keys`, so that queries can join against a set of GUIDs or URLs
+	// instead of spelling them out. Must be called inside a transaction.
+	template<typename Container>
+	void fill_key_set(sqlite3* connection,
+		std::unordered_map<std::string, sqlite3_stmt*>& cache,
+		const Container& keys);
+	// Like run_read, but fills temp.key_set with `keys` first.
+	template<typename Container, typename... Args>
+	void run_read_with_keys(const Container& keys,
+		const std::string& query,
+		const std::function<void(sqlite3_stmt*)>& row_reader,
+		const Args&... args);
+
+	sqlite3_stmt* get_statement(sqlite3* connection,
+		std::unordered_map<std::string, sqlite3_stmt*>& cache,
+		const std::string& query);
+	template<typename... Args>
+	void run_prepared(const std::string& query,
+		const std::function<void(sqlite3_stmt*)>& row_reader,
+		const Args&... args);
+	template<typename... Args>
+	void run_prepared_nothrow(const std::string& query,
+		const std::function<void(sqlite3_stmt*)>& row_reader,
+		const Args&... args);
+	template<typename... Args>
+	void run_prepared_impl(bool do_throw,
+		sqlite3* connection,
+		std::unordered_map<std::string, sqlite3_stmt*>& cache,
+		const std::string& query,
+		const std::function<void(sqlite3_stmt*)>& row_reader,
+		const Args&... args);
+
 	sqlite3* db;
 	ConfigContainer* cfg;
 	std::mutex mtx;
+
+	// Whether the cache was opened with CacheMode::READ_ONLY
+	bool read_only;
+
+	// Whether rss_item_fts full-text index is available for searches.
+	bool fts_enabled;
+
+	// The archive database attached as "archive", or empty if there's none.
+	// Its rss_item holds read articles that archive_old_items() moved out
+	// of the cache.
+	std::string archive_file;
+
+	// Whether free pages can be released with compact(). Caches created
+	// before it was supported only get it after do_vacuum().
+	bool incremental_vacuum;
+
+	// Compiled statements, keyed by their SQL text. Only accessed with
+	// `mtx` held.
+	std::unordered_map<std::string, sqlite3_stmt*> statements;
+
+	// Empty if the database can't be shared between connections, e.g. when
+	// it's in memory or not in WAL mode; reads then go through `db`.
+	std::vector<std::unique_ptr<ReaderConnection>> readers;
+	std::atomic<unsigned int> next_reader;
+
+	// Queued changes, keyed by GUID, and the ones that are being written.
+	// Both are guarded by `pending_mtx`. `flush_mtx` is held while a batch
+	// is written, so that flush_pending_changes() waits for it.
+	std::unordered_map<std::string, PendingChange> pending_changes;
+	std::unordered_map<std::string, PendingChange> writing_changes;
+	// Batches that were committed while articles were being read, tagged
+	// with the generation they were committed in; `changes_generation`
+	// counts the committed batches, and `active_reads` holds the
+	// generations at which the running reads started. A batch is dropped
+	// once no running read started before it. Guarded by `pending_mtx`.
+	std::deque<std::pair<uint64_t,
+		std::unordered_map<std::string, PendingChange>>>
+		committed_changes;
+	uint64_t changes_generation;
+	std::multiset<uint64_t> active_reads;
+	std::mutex pending_mtx;
+	std::mutex flush_mtx;
+	std::condition_variable pending_cv;
+	bool accept_changes;
+	std::thread changes_writer;
+
+	// Timings of every query shape run on any of the connections, and the
+	// number of rows each statement that is still running returned so far.
+	// Guarded by `stats_mtx`.
+	std::unordered_map<std::string, QueryStats> query_stats;
+	std::unordered_map<sqlite3_stmt*, uint64_t> rows_in_progress;
+	bool query_stats_changed;
+	std::mutex stats_mtx;
+	// Whether trace_statement() is installed; set by `cache-query-stats`
+	const bool collect_query_stats;
 };
 
 } // namespace newsboat
@@ -17,6 +17,7 @@
 #include "remoteapi.h"
 #include "rss.h"
 #include "urlreader.h"
+#include "utils.h"
 
 namespace newsboat {
 
@@ -105,7 +106,11 @@ private:
 	int execute_commands(const std::vector<std::string>& cmds);
 
 	void import_read_information(const std::string& readinfofile);
-	void export_read_information(const std::string& readinfofile);
+	bool export_read_information(const std::string& readinfofile);
+
+	// Every curl handle uses this, so DNS lookups, TLS sessions and
+	// connections are reused across reloads and threads.
+	CurlShare curl_share;
 
 	View* v;
 	UrlReader* urlcfg;
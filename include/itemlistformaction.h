@@ -65,10 +65,7 @@ public:
 
 	void finished_qna(Operation op) override;
 
-	void set_show_searchresult(bool b)
-	{
-		show_searchresult = b;
-	}
+	void set_show_searchresult(bool b);
 	void set_searchphrase(const std::string& s)
 	{
 		searchphrase = s;
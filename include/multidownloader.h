@@ -0,0 +1,85 @@
+#ifndef NEWSBOAT_MULTIDOWNLOADER_H_
+#define NEWSBOAT_MULTIDOWNLOADER_H_
+
+#include <curl/curl.h>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace newsboat {
+
+class CurlHandle;
+
+/// \brief Runs many transfers at once from a single thread, using libcurl's
+/// multi interface.
+class MultiDownloader {
+public:
+	/// \brief Sets up an easy handle for a transfer.
+	typedef std::function<void(CurlHandle&)> Setup;
+
+	/// \brief Called once the transfer is over, with the handle it ran on
+	/// and its outcome.
+	typedef std::function<void(CurlHandle&, CURLcode)> Completion;
+
+	/// \brief Runs at most \a max_transfers transfers at once, no more
+	/// than \a max_per_host of which go to the same host.
+	MultiDownloader(unsigned int max_transfers, unsigned int max_per_host);
+	~MultiDownloader();
+
+	/// \brief Queues a transfer of \a url.
+	///
+	/// \a setup is called right before the transfer starts; if it throws,
+	/// the transfer isn't started and \a done gets CURLE_FAILED_INIT.
+	/// \a done may reuse the handle right away, but mustn't keep it.
+	///
+	/// A failed transfer is queued again, with \a setup called on a fresh
+	/// handle, until it has been tried \a attempts times; \a done is only
+	/// called for the last attempt.
+	void add(const std::string& url,
+		Setup setup,
+		Completion done,
+		unsigned int attempts = 1);
+
+	/// \brief Runs all queued transfers, returning once they're over.
+	///
+	/// Callbacks are called from the thread that runs this method.
+	void run();
+
+private:
+	struct Transfer {
+		std::string host;
+		Setup setup;
+		Completion done;
+		unsigned int attempts;
+		CurlHandle* handle;
+	};
+
+	MultiDownloader(const MultiDownloader&);
+	MultiDownloader& operator=(const MultiDownloader&);
+
+	void start_transfers();
+	void finish_transfer(CURL* easyhandle, CURLcode result);
+	void record_connection_stats(CURL* easyhandle);
+	void log_connection_stats();
+	CurlHandle* idle_handle();
+
+	CURLM* multi;
+	unsigned int max_transfers;
+	unsigned int max_per_host;
+	std::list<Transfer> pending;
+	std::map<CURL*, Transfer> running;
+	std::map<std::string, unsigned int> per_host;
+	std::vector<std::unique_ptr<CurlHandle>> handles;
+	std::vector<CurlHandle*> idle;
+
+	unsigned int new_connections;
+	unsigned int reused_connections;
+	double connection_setup_time;
+};
+
+} // namespace newsboat
+
+#endif /* NEWSBOAT_MULTIDOWNLOADER_H_ */
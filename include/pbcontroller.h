@@ -9,6 +9,7 @@
 #include "download.h"
 #include "fslock.h"
 #include "queueloader.h"
+#include "utils.h"
 
 namespace podboat {
 
@@ -64,6 +65,8 @@ private:
 	void print_usage(const char* argv0);
 	bool setup_dirs_xdg(const char* env_home);
 
+	newsboat::CurlShare curl_share;
+
 	PbView* v;
 	std::string config_file;
 	std::string queue_file;
@@ -1,6 +1,9 @@
 #ifndef NEWSBOAT_RELOADER_H_
 #define NEWSBOAT_RELOADER_H_
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -11,6 +14,8 @@ namespace newsboat {
 class Cache;
 class Controller;
 class CurlHandle;
+class RssFeed;
+class RssParser;
 
 /// \brief Updates feeds (fetches, parses, puts results into Controller).
 class Reloader {
@@ -19,8 +24,47 @@ class Reloader {
 	ConfigContainer* cfg;
 	std::mutex reload_mutex;
 
+	// Number of reloaded feeds that turned out not to have changed.
+	std::atomic<unsigned int> unchanged_feeds;
+
 	std::string prepare_message(unsigned int pos, unsigned int max);
 
+	std::unique_ptr<RssParser> create_parser(std::shared_ptr<RssFeed> feed);
+
+	/// \brief Replaces the feed at position \a pos with the one returned
+	/// by \a parse, reporting errors in the status bar.
+	///
+	/// \a parser is the one \a parse uses; its hints are used to schedule
+	/// the next reload of the feed.
+	void replace_feed(unsigned int pos,
+		unsigned int max,
+		bool unattended,
+		RssParser& parser,
+		const std::function<std::shared_ptr<RssFeed>()>& parse);
+
+	/// \brief Reloads the feeds at given positions in the feeds list with
+	/// reload-threads threads, then refreshes query feeds and re-sorts the
+	/// feed list.
+	void reload_feeds(const std::vector<unsigned int>& positions,
+		bool unattended);
+
+	/// \brief Reloads the feeds at given positions in the feeds list.
+	///
+	/// HTTP downloads are all driven by a single thread through a curl
+	/// multi handle; \a num_threads threads parse what they download and
+	/// reload the other feeds.
+	void reload_concurrently(const std::vector<unsigned int>& positions,
+		unsigned int num_threads,
+		bool unattended);
+
+	/// \brief Seconds between automatic reloads, as set by reload-time.
+	time_t reload_interval();
+
+	/// \brief Stores when the feed at \a url should be reloaded next, if
+	/// adaptive-reload is enabled.
+	void schedule_next_reload(const std::string& url,
+		const RssParser& parser);
+
 public:
 	Reloader(Controller* c, Cache* cc, ConfigContainer* cfg);
 
@@ -58,24 +102,22 @@ public:
 
 	/// \brief Reloads all feeds, spawning threads as necessary.
 	///
-	/// Only updates status bar if \a unattended is false. The number of
-	/// threads spawned is controlled by the user via reload-threads
-	/// setting.
+	/// Only updates status bar if \a unattended is false. Up to
+	/// reload-transfers feeds are downloaded at once, and the downloads
+	/// are parsed by reload-threads threads.
 	void reload_all(bool unattended = false);
 
-	/// \brief Reloads all feeds with given indexes in feedlist.
+	/// \brief Returns indexes of the feeds that adaptive-reload considers
+	/// due for a reload.
 	///
-	/// Only updates status bar if \a unattended is false.
-	void reload_indexes(const std::vector<int>& indexes,
-		bool unattended = false);
+	/// Feeds that fall due before the next automatic reload is halfway
+	/// through are included, as are ones that were never scheduled.
+	std::vector<int> get_due_feeds();
 
-	/// \brief Reloads feeds occupying positions from \a start to \a end in
-	/// feedlist.
+	/// \brief Reloads all feeds with given indexes in feedlist.
 	///
 	/// Only updates status bar if \a unattended is false.
-	void reload_range(unsigned int start,
-		unsigned int end,
-		unsigned int size,
+	void reload_indexes(const std::vector<int>& indexes,
 		bool unattended = false);
 
 	/// \brief Notify in various ways that there are new unread feeds or
@@ -0,0 +1,47 @@
+#ifndef NEWSBOAT_RELOADSCHEDULE_H_
+#define NEWSBOAT_RELOADSCHEDULE_H_
+
+#include <ctime>
+#include <set>
+#include <vector>
+
+namespace newsboat {
+
+/// \brief What a feed and its server said about how often to check it.
+struct RefreshHints {
+	RefreshHints()
+		: min_interval(0)
+	{
+	}
+
+	/// \brief Seconds to wait at least until the next check.
+	///
+	/// Comes from RSS <ttl>, sy:updatePeriod and sy:updateFrequency, and
+	/// Cache-Control max-age or Expires headers.
+	time_t min_interval;
+
+	/// \brief Hours (0 to 23, UTC) during which the feed needn't be
+	/// checked.
+	std::set<unsigned int> skip_hours;
+
+	/// \brief Days of the week (0 is Sunday, UTC) on which the feed needn't
+	/// be checked.
+	std::set<unsigned int> skip_days;
+};
+
+/// \brief Returns when a feed should be reloaded next.
+///
+/// \a pubdates are the publication times of the feed's newest articles. The
+/// feed is checked about twice per the average time between its articles
+/// (counting the time since the newest one), but no more often than
+/// \a min_interval and \a hints allow, and at least every \a max_interval.
+/// The result is moved past the hours and days that \a hints skip.
+time_t next_reload_time(time_t now,
+	const std::vector<time_t>& pubdates,
+	const RefreshHints& hints,
+	time_t min_interval,
+	time_t max_interval);
+
+} // namespace newsboat
+
+#endif /* NEWSBOAT_RELOADSCHEDULE_H_ */
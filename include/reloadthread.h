@@ -15,6 +15,10 @@ public:
 	void operator()();
 
 private:
+	/// \brief Starts reloading all feeds, or only the ones that are due if
+	/// adaptive-reload is enabled.
+	void start_reload();
+
 	Controller* ctrl;
 	time_t oldtime;
 	time_t waittime_sec;
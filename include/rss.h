@@ -1,6 +1,7 @@
 #ifndef NEWSBOAT_RSS_H_
 #define NEWSBOAT_RSS_H_
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <string>
@@ -19,6 +20,7 @@ enum class DlStatus { SUCCESS, TO_BE_DOWNLOADED, DURING_DOWNLOAD, DL_ERROR };
 
 class Cache;
 class RssFeed;
+class RssIgnores;
 
 class RssItem : public Matchable {
 public:
@@ -206,7 +208,7 @@ private:
 	bool override_unread_;
 };
 
-class RssFeed : public Matchable {
+class RssFeed : public Matchable, public std::enable_shared_from_this<RssFeed> {
 public:
 	explicit RssFeed(Cache* c);
 	RssFeed();
@@ -254,6 +256,7 @@ public:
 
 	std::vector<std::shared_ptr<RssItem>>& items()
 	{
+		load_items();
 		return items_;
 	}
 	void add_item(std::shared_ptr<RssItem> item)
@@ -308,9 +311,17 @@ public:
 	unsigned int unread_item_count();
 	unsigned int total_item_count() const
 	{
-		return items_.size();
+		return items_loaded ? items_.size() : lazy_total_count;
 	}
 
+	// Defers reading the items from the cache until they're first
+	// accessed; until then, the feed reports the given counts.
+	void set_lazy_items(RssIgnores* ign,
+		unsigned int unread_count,
+		unsigned int total_count);
+	// Reads the items deferred by set_lazy_items(), if they weren't yet.
+	void load_items();
+
 	void set_tags(const std::vector<std::string>& tags);
 	bool matches_tag(const std::string& tag);
 	std::string get_tags();
@@ -414,6 +425,12 @@ private:
 	unsigned int order;
 	DlStatus status_;
 	std::mutex items_guid_map_mutex;
+
+	std::atomic<bool> items_loaded;
+	std::mutex items_load_mutex;
+	RssIgnores* lazy_ignores;
+	unsigned int lazy_unread_count;
+	unsigned int lazy_total_count;
 };
 
 class RssIgnores : public ConfigActionHandler {
@@ -424,6 +441,9 @@ public:
 		const std::vector<std::string>& params) override;
 	void dump_config(std::vector<std::string>& config_output) override;
 	bool matches(RssItem* item);
+	/// \brief Returns true if any ignore-article rule applies to the
+	/// feed at \a url.
+	bool has_rules_for(const std::string& url);
 	bool matches_lastmodified(const std::string& url);
 	bool matches_resetunread(const std::string& url);
 
@@ -1,8 +1,11 @@
 #ifndef NEWSBOAT_RSSPARSER_H_
 #define NEWSBOAT_RSSPARSER_H_
 
+#include <cstdint>
+#include <memory>
 #include <string>
 
+#include "reloadschedule.h"
 #include "remoteapi.h"
 #include "rss.h"
 #include "rsspp.h"
@@ -28,6 +31,47 @@ public:
 		easyhandle = h;
 	}
 
+	/// \brief Returns true if the feed is fetched by a plain HTTP(S)
+	/// download, which the caller can perform itself.
+	///
+	/// In that case, parse() can be replaced by start_download(), running
+	/// the transfer (e.g. on a curl multi handle), finish_download() and
+	/// parse_download().
+	bool is_http_download() const;
+
+	/// \brief Sets up \a handle to download the feed.
+	void start_download(CurlHandle& handle);
+
+	/// \brief Wraps up the transfer set up by start_download().
+	///
+	/// \a result is the outcome of the transfer. Doesn't throw; errors are
+	/// reported by parse_download(). Resets \a handle, so it can be reused
+	/// right away.
+	void finish_download(CurlHandle& handle, CURLcode result);
+
+	/// \brief Parses the feed downloaded by start_download() and
+	/// finish_download().
+	std::shared_ptr<RssFeed> parse_download();
+
+	/// \brief Returns what the last parsed feed and the server it came
+	/// from said about how often to check the feed.
+	RefreshHints get_refresh_hints() const;
+
+	/// \brief Returns true if the last parse found the feed unchanged:
+	/// the server said so, or it sent the same document as the last time
+	/// the feed was parsed. The parsed feed is empty in that case.
+	bool is_unchanged() const
+	{
+		return unchanged;
+	}
+
+	/// \brief Remembers the document the feed was just parsed from, so
+	/// that the next reload can tell if it's unchanged, and the refresh
+	/// hints the feed declared, so that they still apply while it is.
+	///
+	/// Has to be called only once the parsed feed is stored in the cache.
+	void store_parse_results();
+
 private:
 	void replace_newline_characters(std::string& str);
 	std::string render_xhtml_title(const std::string& title,
@@ -35,7 +79,20 @@ private:
 	time_t parse_date(const std::string& datestr);
 	void set_rtl(std::shared_ptr<RssFeed> feed, const std::string& lang);
 
+	std::shared_ptr<RssFeed> build_feed();
+
 	void retrieve_uri(const std::string& uri);
+	std::unique_ptr<rsspp::Parser> create_http_parser();
+	void fetch_lastmodified(const std::string& uri,
+		time_t& lm,
+		std::string& etag);
+	void store_lastmodified(rsspp::Parser& p,
+		const std::string& uri,
+		time_t lm,
+		const std::string& etag);
+	RefreshHints declared_refresh_hints() const;
+	std::string parse_settings() const;
+	bool is_same_body(const std::string& body);
 	void download_http(const std::string& uri);
 	void get_execplugin(const std::string& plugin);
 	void download_filterplugin(const std::string& filter,
@@ -81,6 +138,16 @@ private:
 	bool is_ocnews;
 
 	CurlHandle* easyhandle;
+
+	std::unique_ptr<rsspp::Parser> http_parser;
+	std::string http_buffer;
+	time_t http_lm;
+	std::string http_etag;
+	std::string http_error;
+	long max_age;
+
+	bool unchanged;
+	int64_t body_hash;
 };
 
 } // namespace newsboat
@@ -22,13 +22,7 @@ private:
 	CurlHandle& operator=(const CurlHandle&);
 
 public:
-	CurlHandle()
-		: h(0)
-	{
-		h = curl_easy_init();
-		if (!h)
-			throw std::runtime_error("Can't obtain curl handle");
-	}
+	CurlHandle();
 	~CurlHandle()
 	{
 		curl_easy_cleanup(h);
@@ -39,6 +33,27 @@ public:
 	}
 };
 
+// DNS cache, TLS sessions and connections that curl handles can have in
+// common; see utils::set_curl_share()
+class CurlShare {
+public:
+	CurlShare();
+	~CurlShare();
+	CURLSH* ptr()
+	{
+		return sh;
+	}
+
+	struct Locks;
+
+private:
+	CurlShare(const CurlShare&);
+	CurlShare& operator=(const CurlShare&);
+
+	CURLSH* sh;
+	Locks* locks;
+};
+
 class ScopeMeasure {
 public:
 	ScopeMeasure(const std::string& func, Level ll = Level::DEBUG);
@@ -124,6 +139,9 @@ namespace utils {
 		const std::string& separator);
 
 	std::string censor_url(const std::string& url);
+	// Host name part of \a url, without user info and port; empty if
+	// there's none.
+	std::string extract_host(const std::string& url);
 
 	std::string quote_for_stfl(std::string str);
 
@@ -139,6 +157,12 @@ namespace utils {
 
 	void set_common_curl_options(CURL* handle, ConfigContainer* cfg);
 
+	// Makes curl handles set up from now on use the caches of \a share
+	// (or none, if it's nullptr). CurlHandle, set_common_curl_options()
+	// and rsspp::Parser call apply_curl_share() to do that.
+	void set_curl_share(CurlShare* share);
+	void apply_curl_share(CURL* handle);
+
 	curl_proxytype get_proxy_type(const std::string& type);
 	unsigned long get_auth_method(const std::string& type);
 
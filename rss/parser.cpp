@@ -1,6 +1,8 @@
 #include "rsspp.h"
 
+#include <algorithm>
 #include <cstring>
+#include <ctime>
 #include <curl/curl.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -24,6 +26,20 @@ my_write_data(void* buffer, size_t size, size_t nmemb, void* userp)
 
 namespace rsspp {
 
+struct HeaderValues {
+	time_t lastmodified;
+	std::string etag;
+	long max_age;
+	time_t expires;
+
+	HeaderValues()
+		: lastmodified(0)
+		, max_age(-1)
+		, expires(-1)
+	{
+	}
+};
+
 Parser::Parser(unsigned int timeout,
 	const std::string& user_agent,
 	const std::string& proxy,
@@ -38,6 +54,9 @@ Parser::Parser(unsigned int timeout,
 	, verify_ssl(ssl_verify)
 	, doc(0)
 	, lm(0)
+	, max_age(-1)
+	, hdrs(new HeaderValues())
+	, custom_headers(nullptr)
 {
 }
 
@@ -45,18 +64,10 @@ Parser::~Parser()
 {
 	if (doc)
 		xmlFreeDoc(doc);
+	if (custom_headers)
+		curl_slist_free_all(custom_headers);
 }
 
-struct HeaderValues {
-	time_t lastmodified;
-	std::string etag;
-
-	HeaderValues()
-		: lastmodified(0)
-	{
-	}
-};
-
 static size_t handle_headers(void* ptr, size_t size, size_t nmemb, void* data)
 {
 	char* header = new char[size * nmemb + 1];
@@ -85,6 +96,20 @@ static size_t handle_headers(void* ptr, size_t size, size_t nmemb, void* data)
 		values->etag = std::string(header + 5);
 		utils::trim(values->etag);
 		LOG(Level::DEBUG, "handle_headers: got etag %s", values->etag);
+	} else if (!strncasecmp("Cache-Control:", header, 14)) {
+		const char* max_age = strcasestr(header + 14, "max-age=");
+		if (max_age) {
+			values->max_age = strtol(max_age + 8, nullptr, 10);
+			LOG(Level::DEBUG,
+				"handle_headers: got max-age %ld",
+				values->max_age);
+		}
+	} else if (!strncasecmp("Expires:", header, 8)) {
+		values->expires = curl_getdate(header + 8, nullptr);
+		LOG(Level::DEBUG,
+			"handle_headers: got expires %s (%d)",
+			header + 8,
+			values->expires);
 	}
 
 	delete[] header;
@@ -98,10 +123,28 @@ Feed Parser::parse_url(const std::string& url,
 	newsboat::RemoteApi* api,
 	const std::string& cookie_cache,
 	CURL* ehandle)
+{
+	const std::string buf = download_url(
+		url, lastmodified, etag, api, cookie_cache, ehandle);
+
+	if (buf.length() > 0) {
+		LOG(Level::DEBUG,
+			"Parser::parse_url: handing over data to "
+			"parse_buffer()");
+		return parse_buffer(buf, url);
+	}
+
+	return Feed();
+}
+
+std::string Parser::download_url(const std::string& url,
+	time_t lastmodified,
+	const std::string& etag,
+	newsboat::RemoteApi* api,
+	const std::string& cookie_cache,
+	CURL* ehandle)
 {
 	std::string buf;
-	CURLcode ret;
-	curl_slist* custom_headers{};
 
 	CURL* easyhandle = ehandle;
 	if (!easyhandle) {
@@ -111,6 +154,40 @@ Feed Parser::parse_url(const std::string& url,
 		}
 	}
 
+	prepare_transfer(
+		easyhandle, url, lastmodified, etag, api, cookie_cache, buf);
+
+	CURLcode ret = curl_easy_perform(easyhandle);
+
+	try {
+		finish_transfer(easyhandle, ret, cookie_cache);
+	} catch (const Exception&) {
+		if (!ehandle)
+			curl_easy_cleanup(easyhandle);
+		throw;
+	}
+
+	if (!ehandle)
+		curl_easy_cleanup(easyhandle);
+
+	LOG(Level::INFO,
+		"Parser::download_url: retrieved data for %s: %s",
+		url,
+		buf);
+
+	return buf;
+}
+
+void Parser::prepare_transfer(CURL* easyhandle,
+	const std::string& url,
+	time_t lastmodified,
+	const std::string& etag,
+	newsboat::RemoteApi* api,
+	const std::string& cookie_cache,
+	std::string& buffer)
+{
+	utils::apply_curl_share(easyhandle);
+
 	if (!ua.empty()) {
 		curl_easy_setopt(easyhandle, CURLOPT_USERAGENT, ua.c_str());
 	}
@@ -121,7 +198,7 @@ Feed Parser::parse_url(const std::string& url,
 	curl_easy_setopt(easyhandle, CURLOPT_URL, url.c_str());
 	curl_easy_setopt(easyhandle, CURLOPT_SSL_VERIFYPEER, verify_ssl);
 	curl_easy_setopt(easyhandle, CURLOPT_WRITEFUNCTION, my_write_data);
-	curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, &buf);
+	curl_easy_setopt(easyhandle, CURLOPT_WRITEDATA, &buffer);
 	curl_easy_setopt(easyhandle, CURLOPT_NOSIGNAL, 1);
 	curl_easy_setopt(easyhandle, CURLOPT_FOLLOWLOCATION, 1);
 	curl_easy_setopt(easyhandle, CURLOPT_MAXREDIRS, 10);
@@ -152,8 +229,8 @@ Feed Parser::parse_url(const std::string& url,
 		curl_easy_setopt(easyhandle, CURLOPT_CAINFO, curl_ca_bundle);
 	}
 
-	HeaderValues hdrs;
-	curl_easy_setopt(easyhandle, CURLOPT_HEADERDATA, &hdrs);
+	*hdrs = HeaderValues();
+	curl_easy_setopt(easyhandle, CURLOPT_HEADERDATA, hdrs.get());
 	curl_easy_setopt(easyhandle, CURLOPT_HEADERFUNCTION, handle_headers);
 
 	if (lastmodified != 0) {
@@ -178,19 +255,28 @@ Feed Parser::parse_url(const std::string& url,
 		curl_easy_setopt(
 			easyhandle, CURLOPT_HTTPHEADER, custom_headers);
 	}
+}
 
-	ret = curl_easy_perform(easyhandle);
-
-	lm = hdrs.lastmodified;
-	et = hdrs.etag;
+void Parser::finish_transfer(CURL* easyhandle,
+	CURLcode ret,
+	const std::string& cookie_cache)
+{
+	lm = hdrs->lastmodified;
+	et = hdrs->etag;
+	// Cache-Control takes precedence over Expires (RFC 7234, 5.3)
+	max_age = hdrs->max_age;
+	if (max_age < 0 && hdrs->expires > 0) {
+		max_age = std::max<long>(hdrs->expires - ::time(nullptr), 0);
+	}
 
 	if (custom_headers) {
 		curl_easy_setopt(easyhandle, CURLOPT_HTTPHEADER, 0);
 		curl_slist_free_all(custom_headers);
+		custom_headers = nullptr;
 	}
 
 	LOG(Level::DEBUG,
-		"rsspp::Parser::parse_url: ret = %d (%s)",
+		"rsspp::Parser::finish_transfer: ret = %d (%s)",
 		ret,
 		curl_easy_strerror(ret));
 
@@ -198,20 +284,30 @@ Feed Parser::parse_url(const std::string& url,
 	CURLcode infoOk =
 		curl_easy_getinfo(easyhandle, CURLINFO_RESPONSE_CODE, &status);
 
+	double connect_time = 0;
+	double appconnect_time = 0;
+	long new_connections = 0;
+	curl_easy_getinfo(easyhandle, CURLINFO_CONNECT_TIME, &connect_time);
+	curl_easy_getinfo(
+		easyhandle, CURLINFO_APPCONNECT_TIME, &appconnect_time);
+	curl_easy_getinfo(easyhandle, CURLINFO_NUM_CONNECTS, &new_connections);
+	LOG(Level::DEBUG,
+		"rsspp::Parser::finish_transfer: %ld new connections, "
+		"connected after %.3f s, TLS handshake done after %.3f s",
+		new_connections,
+		connect_time,
+		appconnect_time);
+
 	curl_easy_reset(easyhandle);
 	if (cookie_cache != "") {
 		curl_easy_setopt(
 			easyhandle, CURLOPT_COOKIEJAR, cookie_cache.c_str());
 	}
 
-	if (!ehandle)
-		curl_easy_cleanup(easyhandle);
-
 	if (ret != 0) {
 		LOG(Level::ERROR,
-			"rsspp::Parser::parse_url: curl_easy_perform returned "
-			"err "
-			"%d: %s",
+			"rsspp::Parser::finish_transfer: transfer failed with "
+			"err %d: %s",
 			ret,
 			curl_easy_strerror(ret));
 		std::string msg;
@@ -223,20 +319,6 @@ Feed Parser::parse_url(const std::string& url,
 		}
 		throw Exception(msg);
 	}
-
-	LOG(Level::INFO,
-		"Parser::parse_url: retrieved data for %s: %s",
-		url,
-		buf);
-
-	if (buf.length() > 0) {
-		LOG(Level::DEBUG,
-			"Parser::parse_url: handing over data to "
-			"parse_buffer()");
-		return parse_buffer(buf, url);
-	}
-
-	return Feed();
 }
 
 Feed Parser::parse_buffer(const std::string& buffer, const std::string& url)
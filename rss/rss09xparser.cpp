@@ -52,8 +52,29 @@ void Rss09xParser::parse_feed(Feed& f, xmlNode* rootNode)
 			f.language = get_content(node);
 		} else if (node_is(node, "managingEditor", ns)) {
 			f.managingeditor = get_content(node);
+		} else if (node_is(node, "ttl", ns)) {
+			f.ttl = utils::to_u(get_content(node), 0);
+		} else if (node_is(node, "skipHours", ns)) {
+			for (xmlNode* hour = node->children; hour != nullptr;
+				hour = hour->next) {
+				if (node_is(hour, "hour", ns)) {
+					f.skip_hours.push_back(utils::to_u(
+						get_content(hour), 24));
+				}
+			}
+		} else if (node_is(node, "skipDays", ns)) {
+			for (xmlNode* day = node->children; day != nullptr;
+				day = day->next) {
+				if (node_is(day, "day", ns)) {
+					std::string name = get_content(day);
+					utils::trim(name);
+					f.skip_days.push_back(name);
+				}
+			}
 		} else if (node_is(node, "item", ns)) {
 			f.items.push_back(parse_item(node));
+		} else {
+			parse_syndication_hint(f, node);
 		}
 	}
 }
@@ -32,6 +32,8 @@ void Rss10Parser::parse_feed(Feed& f, xmlNode* rootNode)
 						get_content(cnode));
 				} else if (node_is(cnode, "creator", DC_URI)) {
 					f.dc_creator = get_content(cnode);
+				} else {
+					parse_syndication_hint(f, cnode);
 				}
 			}
 		} else if (node_is(node, "item", RSS_1_0_NS)) {
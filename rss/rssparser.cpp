@@ -3,6 +3,8 @@
 #include <cstring>
 #include <libxml/tree.h>
 
+#include "utils.h"
+
 namespace rsspp {
 
 std::string RssParser::get_content(xmlNode* node)
@@ -139,6 +141,19 @@ std::string RssParser::__w3cdtf_to_rfc822(const std::string& w3cdtf)
 	return datebuf;
 }
 
+/* Fills in sy:updatePeriod and sy:updateFrequency, which RSS 1.0 and 2.0
+ * feeds alike use to say how often they change. */
+void RssParser::parse_syndication_hint(Feed& f, xmlNode* node)
+{
+	if (node_is(node, "updatePeriod", SYNDICATION_URI)) {
+		f.update_period = get_content(node);
+		newsboat::utils::trim(f.update_period);
+	} else if (node_is(node, "updateFrequency", SYNDICATION_URI)) {
+		f.update_frequency =
+			newsboat::utils::to_u(get_content(node), 0);
+	}
+}
+
 bool RssParser::node_is(xmlNode* node, const char* name, const char* ns_uri)
 {
 	if (!node || !name || !node->name)
@@ -4,6 +4,7 @@
 #include <curl/curl.h>
 #include <exception>
 #include <libxml/parser.h>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -66,6 +67,8 @@ class Feed {
 public:
 	Feed()
 		: rss_version(UNKNOWN)
+		, ttl(0)
+		, update_frequency(0)
 	{
 	}
 
@@ -81,6 +84,13 @@ public:
 	std::string dc_creator;
 	std::string pubDate;
 
+	// hints on how often the feed should be checked:
+	unsigned int ttl; // minutes
+	std::string update_period; // sy:updatePeriod, e.g. "daily"
+	unsigned int update_frequency; // sy:updateFrequency
+	std::vector<unsigned int> skip_hours;
+	std::vector<std::string> skip_days;
+
 	std::vector<Item> items;
 };
 
@@ -94,6 +104,8 @@ private:
 	std::string emsg;
 };
 
+struct HeaderValues;
+
 class Parser {
 public:
 	Parser(unsigned int timeout = 30,
@@ -109,6 +121,37 @@ public:
 		newsboat::RemoteApi* api = 0,
 		const std::string& cookie_cache = "",
 		CURL* ehandle = 0);
+	/// \brief Downloads \a url like parse_url() does, but returns the
+	/// document instead of parsing it.
+	///
+	/// The result is empty if the server said the document didn't change
+	/// since \a lastmodified or \a etag.
+	std::string download_url(const std::string& url,
+		time_t lastmodified = 0,
+		const std::string& etag = "",
+		newsboat::RemoteApi* api = 0,
+		const std::string& cookie_cache = "",
+		CURL* ehandle = 0);
+	/// \brief Sets up \a easyhandle to download \a url into \a buffer.
+	///
+	/// The transfer can then be performed by curl_easy_perform() or a multi
+	/// handle; once it's done, finish_transfer() has to be called on the
+	/// same handle. \a buffer must outlive the transfer.
+	void prepare_transfer(CURL* easyhandle,
+		const std::string& url,
+		time_t lastmodified,
+		const std::string& etag,
+		newsboat::RemoteApi* api,
+		const std::string& cookie_cache,
+		std::string& buffer);
+	/// \brief Cleans up after a transfer set up by prepare_transfer().
+	///
+	/// Stores Last-Modified and ETag received from the server, and resets
+	/// \a easyhandle so that it can be reused. Throws Exception if \a ret
+	/// says that the transfer failed.
+	void finish_transfer(CURL* easyhandle,
+		CURLcode ret,
+		const std::string& cookie_cache);
 	Feed parse_buffer(const std::string& buffer,
 		const std::string& url = "");
 	Feed parse_file(const std::string& filename);
@@ -120,6 +163,12 @@ public:
 	{
 		return et;
 	}
+	/// \brief How many seconds the server said the last response stays
+	/// fresh for (Cache-Control max-age or Expires), or -1.
+	long get_max_age()
+	{
+		return max_age;
+	}
 
 	static void global_init();
 	static void global_cleanup();
@@ -135,6 +184,9 @@ private:
 	xmlDocPtr doc;
 	time_t lm;
 	std::string et;
+	long max_age;
+	std::unique_ptr<HeaderValues> hdrs;
+	curl_slist* custom_headers;
 };
 
 } // namespace rsspp
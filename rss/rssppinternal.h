@@ -14,6 +14,7 @@
 #define MEDIA_RSS_URI "http://search.yahoo.com/mrss/"
 #define XML_URI "http://www.w3.org/XML/1998/namespace"
 #define RSS20USERLAND_URI "http://backend.userland.com/rss2"
+#define SYNDICATION_URI "http://purl.org/rss/1.0/modules/syndication/"
 
 namespace rsspp {
 
@@ -36,6 +37,7 @@ protected:
 	std::string w3cdtf_to_rfc822(const std::string& w3cdtf);
 	bool
 	node_is(xmlNode* node, const char* name, const char* ns_uri = nullptr);
+	void parse_syndication_hint(Feed& f, xmlNode* node);
 	xmlDocPtr doc;
 	std::string globalbase;
 };
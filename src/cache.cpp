@@ -1,6 +1,11 @@
 #include "cache.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
@@ -8,6 +13,8 @@
 #include <sqlite3.h>
 #include <sstream>
 #include <time.h>
+#include <unistd.h>
+#include <zlib.h>
 
 #include "config.h"
 #include "configcontainer.h"
@@ -20,19 +27,49 @@
 
 namespace newsboat {
 
-inline void Cache::run_sql_impl(const std::string& query,
+// Number of read-only connections opened in addition to the writer one.
+static const unsigned int READER_CONNECTIONS = 2;
+
+// How long a read-only connection waits for another instance to release an
+// exclusive lock, in milliseconds
+static const int READ_ONLY_BUSY_TIMEOUT = 5000;
+
+// How long read state and flag changes are held back, so that several of
+// them can be written in a single transaction.
+static const std::chrono::milliseconds WRITE_BEHIND_DELAY(200);
+
+// How many times the background writer tries to write changes before it drops
+// them. It waits twice as long after each failure, so that a database that
+// stays unwritable isn't retried every WRITE_BEHIND_DELAY.
+static const unsigned int WRITE_ATTEMPTS = 8;
+
+// How long the cache has to be idle before free pages are given back to the
+// file system, and how many of them are freed at a time, so that compaction
+// never holds up other writes for long.
+static const std::chrono::seconds COMPACTION_DELAY(60);
+static const unsigned int COMPACTION_PAGES = 512;
+
+// How many of the slowest queries are logged when the cache is idle.
+static const size_t LOGGED_QUERIES = 10;
+
+// Number of articles the background writer moves to the archive each time
+// the cache is idle
+static const unsigned int ARCHIVE_BATCH = 5000;
+
+inline void Cache::run_sql_impl(sqlite3* connection,
+	const std::string& query,
 	int (*callback)(void*, int, char**, char**),
 	void* callback_argument,
 	bool do_throw)
 {
 	LOG(Level::DEBUG, "running query: %s", query);
 	int rc = sqlite3_exec(
-		db, query.c_str(), callback, callback_argument, nullptr);
+		connection, query.c_str(), callback, callback_argument, nullptr);
 	if (rc != SQLITE_OK) {
 		const std::string message = "query \"%s\" failed: (%d) %s";
 		LOG(Level::CRITICAL, message, query, rc, sqlite3_errstr(rc));
 		if (do_throw) {
-			throw DbException(db);
+			throw DbException(connection);
 		}
 	}
 }
@@ -41,221 +78,794 @@ void Cache::run_sql(const std::string& query,
 	int (*callback)(void*, int, char**, char**),
 	void* callback_argument)
 {
-	run_sql_impl(query, callback, callback_argument, true);
+	run_sql_impl(db, query, callback, callback_argument, true);
 }
 
 void Cache::run_sql_nothrow(const std::string& query,
 	int (*callback)(void*, int, char**, char**),
 	void* callback_argument)
 {
-	run_sql_impl(query, callback, callback_argument, false);
+	run_sql_impl(db, query, callback, callback_argument, false);
 }
 
-struct CbHandler {
-	CbHandler()
-		: c(-1)
-	{
+void Cache::run_read_sql(const std::string& query,
+	int (*callback)(void*, int, char**, char**),
+	void* callback_argument)
+{
+	ReaderConnection* reader = nullptr;
+	const auto lock = acquire_reader(reader);
+	run_sql_impl(reader ? reader->db : db,
+		query,
+		callback,
+		callback_argument,
+		true);
+}
+
+sqlite3_stmt* Cache::get_statement(sqlite3* connection,
+	std::unordered_map<std::string, sqlite3_stmt*>& cache,
+	const std::string& query)
+{
+	const auto it = cache.find(query);
+	if (it != cache.end()) {
+		sqlite3_reset(it->second);
+		sqlite3_clear_bindings(it->second);
+		return it->second;
 	}
-	void set_count(int i)
-	{
-		c = i;
+
+	sqlite3_stmt* stmt = nullptr;
+	int rc = sqlite3_prepare_v2(
+		connection, query.c_str(), -1, &stmt, nullptr);
+	if (rc != SQLITE_OK) {
+		LOG(Level::CRITICAL,
+			"preparing query \"%s\" failed: (%d) %s",
+			query,
+			rc,
+			sqlite3_errstr(rc));
+		sqlite3_finalize(stmt);
+		throw DbException(connection);
 	}
-	int count()
-	{
-		return c;
+	cache.emplace(query, stmt);
+	return stmt;
+}
+
+static void bind_value(sqlite3_stmt* stmt, int index, const std::string& value)
+{
+	// The bound strings are owned by the caller of Cache::run_prepared and
+	// outlive the statement execution, so SQLite doesn't need a copy.
+	int rc = sqlite3_bind_text(
+		stmt, index, value.c_str(), value.length(), SQLITE_STATIC);
+	if (rc != SQLITE_OK) {
+		throw DbException(sqlite3_db_handle(stmt));
 	}
+}
 
-private:
-	int c;
-};
+static void bind_value(sqlite3_stmt* stmt, int index, sqlite3_int64 value)
+{
+	int rc = sqlite3_bind_int64(stmt, index, value);
+	if (rc != SQLITE_OK) {
+		throw DbException(sqlite3_db_handle(stmt));
+	}
+}
 
-struct HeaderValues {
-	time_t lastmodified;
-	std::string etag;
+/* Values of rss_item.content_format */
+static const sqlite3_int64 CONTENT_PLAIN = 0;
+static const sqlite3_int64 CONTENT_ZLIB = 1;
+
+/* Deflates article content into `result`. Returns false if that didn't make
+ * it any smaller, in which case the content should be stored as is. */
+static bool compress_content(const std::string& text, std::string& result)
+{
+	uLongf size = compressBound(text.size());
+	result.resize(size);
+	const int rc = compress2(reinterpret_cast<Bytef*>(&result[0]),
+			&size,
+			reinterpret_cast<const Bytef*>(text.data()),
+			text.size(),
+			Z_DEFAULT_COMPRESSION);
+	if (rc != Z_OK) {
+		LOG(Level::ERROR,
+			"compress_content: compress2 failed: error = %d",
+			rc);
+		return false;
+	}
+	result.resize(size);
+	return size < text.size();
+}
+
+static bool decompress_content(const void* data,
+	size_t size,
+	std::string& text)
+{
+	z_stream stream{};
+	if (inflateInit(&stream) != Z_OK) {
+		return false;
+	}
+	stream.next_in = const_cast<Bytef*>(static_cast<const Bytef*>(data));
+	stream.avail_in = size;
+
+	text.clear();
+	char buffer[16384];
+	int rc;
+	do {
+		stream.next_out = reinterpret_cast<Bytef*>(buffer);
+		stream.avail_out = sizeof(buffer);
+		rc = inflate(&stream, Z_NO_FLUSH);
+		if (rc != Z_OK && rc != Z_STREAM_END) {
+			break;
+		}
+		text.append(buffer, sizeof(buffer) - stream.avail_out);
+	} while (rc == Z_OK);
+	inflateEnd(&stream);
+
+	return rc == Z_STREAM_END;
+}
+
+/* Article content in the form it's written to rss_item.content. Refers to
+ * the text it was made from, so that has to outlive it. */
+struct StoredContent {
+	sqlite3_int64 format;
+	const std::string* text;
+	std::string compressed;
+
+	const std::string& bytes() const
+	{
+		return format == CONTENT_ZLIB ? compressed : *text;
+	}
 };
 
-static int
-count_callback(void* handler, int argc, char** argv, char** /* azColName */)
+static StoredContent store_content(const std::string& text, bool compress)
 {
-	CbHandler* cbh = static_cast<CbHandler*>(handler);
+	StoredContent result{CONTENT_PLAIN, &text, ""};
+	if (compress && compress_content(text, result.compressed)) {
+		result.format = CONTENT_ZLIB;
+	}
+	return result;
+}
+
+static StoredContent store_content(std::string&& text, bool compress) = delete;
 
-	if (argc > 0) {
-		std::istringstream is(argv[0]);
-		int x;
-		is >> x;
-		cbh->set_count(x);
+static void bind_value(sqlite3_stmt* stmt,
+	int index,
+	const StoredContent& content)
+{
+	const std::string& bytes = content.bytes();
+	int rc;
+	if (content.format == CONTENT_ZLIB) {
+		rc = sqlite3_bind_blob(
+			stmt, index, bytes.data(), bytes.size(), SQLITE_STATIC);
+	} else {
+		rc = sqlite3_bind_text(
+			stmt, index, bytes.data(), bytes.size(), SQLITE_STATIC);
+	}
+	if (rc != SQLITE_OK) {
+		throw DbException(sqlite3_db_handle(stmt));
 	}
+}
 
-	return 0;
+static void bind_parameters(sqlite3_stmt* /* stmt */, int /* index */) {}
+
+template<typename T, typename... Args>
+static void bind_parameters(sqlite3_stmt* stmt,
+	int index,
+	const T& argument,
+	const Args&... args)
+{
+	bind_value(stmt, index, argument);
+	bind_parameters(stmt, index + 1, args...);
 }
 
-static int single_string_callback(void* handler,
-	int argc,
-	char** argv,
-	char** /* azColName */)
+template<typename... Args>
+void Cache::run_prepared_impl(bool do_throw,
+	sqlite3* connection,
+	std::unordered_map<std::string, sqlite3_stmt*>& cache,
+	const std::string& query,
+	const std::function<void(sqlite3_stmt*)>& row_reader,
+	const Args&... args)
 {
-	std::string* value = reinterpret_cast<std::string*>(handler);
-	if (argc > 0 && argv[0]) {
-		*value = argv[0];
+	LOG(Level::DEBUG, "running prepared query: %s", query);
+	sqlite3_stmt* stmt = get_statement(connection, cache, query);
+
+	int rc;
+	try {
+		bind_parameters(stmt, 1, args...);
+		while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+			if (row_reader) {
+				row_reader(stmt);
+			}
+		}
+	} catch (...) {
+		sqlite3_reset(stmt);
+		throw;
 	}
-	return 0;
+
+	if (rc != SQLITE_DONE) {
+		const std::string message = "query \"%s\" failed: (%d) %s";
+		LOG(Level::CRITICAL, message, query, rc, sqlite3_errstr(rc));
+		if (do_throw) {
+			DbException e(connection);
+			sqlite3_reset(stmt);
+			throw e;
+		}
+	}
+	// Resetting releases the read lock that a finished SELECT still holds.
+	sqlite3_reset(stmt);
 }
 
-static int
-rssfeed_callback(void* myfeed, int argc, char** argv, char** /* azColName */)
-{
-	std::shared_ptr<RssFeed>* feed =
-		static_cast<std::shared_ptr<RssFeed>*>(myfeed);
-	// normaly, this shouldn't happen, but we keep the assert()s here
-	// nevertheless
-	assert(argc == 3);
-	assert(argv[0] != nullptr);
-	assert(argv[1] != nullptr);
-	assert(argv[2] != nullptr);
-	(*feed)->set_title(argv[0]);
-	(*feed)->set_link(argv[1]);
-	(*feed)->set_rtl(strcmp(argv[2], "1") == 0);
-	LOG(Level::INFO,
-		"rssfeed_callback: title = %s link = %s is_rtl = %s",
-		argv[0],
-		argv[1],
-		argv[2]);
-	return 0;
+template<typename... Args>
+void Cache::run_prepared(const std::string& query,
+	const std::function<void(sqlite3_stmt*)>& row_reader,
+	const Args&... args)
+{
+	run_prepared_impl(
+		true, db, statements, query, row_reader, args...);
 }
 
-static int lastmodified_callback(void* handler,
-	int argc,
-	char** argv,
-	char** /* azColName */)
+template<typename... Args>
+void Cache::run_prepared_nothrow(const std::string& query,
+	const std::function<void(sqlite3_stmt*)>& row_reader,
+	const Args&... args)
 {
-	HeaderValues* result = static_cast<HeaderValues*>(handler);
-	assert(argc == 2);
-	assert(result != nullptr);
-	if (argv[0]) {
-		std::istringstream is(argv[0]);
-		is >> result->lastmodified;
-	} else {
-		result->lastmodified = 0;
+	run_prepared_impl(
+		false, db, statements, query, row_reader, args...);
+}
+
+template<typename... Args>
+void Cache::run_read(const std::string& query,
+	const std::function<void(sqlite3_stmt*)>& row_reader,
+	const Args&... args)
+{
+	run_read_impl(nullptr, query, row_reader, args...);
+}
+
+template<typename... Args>
+void Cache::run_read(ItemsRead& read,
+	const std::string& query,
+	const std::function<void(sqlite3_stmt*)>& row_reader,
+	const Args&... args)
+{
+	run_read_impl(&read, query, row_reader, args...);
+}
+
+template<typename... Args>
+void Cache::run_read_impl(ItemsRead* read,
+	const std::string& query,
+	const std::function<void(sqlite3_stmt*)>& row_reader,
+	const Args&... args)
+{
+	ReaderConnection* reader = nullptr;
+	const auto lock = acquire_reader(reader);
+	// The snapshot is taken by the first step, not when the read was
+	// registered; batches committed in between are part of it
+	if (read) {
+		read->start();
 	}
-	if (argv[1]) {
-		result->etag = argv[1];
+	if (reader) {
+		run_prepared_impl(true,
+			reader->db,
+			reader->statements,
+			query,
+			row_reader,
+			args...);
 	} else {
-		result->etag = "";
+		run_prepared_impl(
+			true, db, statements, query, row_reader, args...);
 	}
-	LOG(Level::INFO,
-		"lastmodified_callback: lastmodified = %d etag = %s",
-		result->lastmodified,
-		result->etag);
-	return 0;
 }
 
-static int
-vectorofstring_callback(void* vp, int argc, char** argv, char** /* azColName */)
+
+/* Wraps everything done during its lifetime into a single transaction, so
+ * SQLite only has to sync its journal once. Unless commit() is called, the
+ * transaction is rolled back on destruction, e.g. when an exception is thrown.
+ */
+class ScopeTransaction {
+public:
+	explicit ScopeTransaction(sqlite3* database)
+		: db(database)
+		, committed(false)
+	{
+		int rc = sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+		if (rc != SQLITE_OK) {
+			LOG(Level::CRITICAL,
+				"ScopeTransaction: couldn't begin transaction: "
+				"(%d) %s",
+				rc,
+				sqlite3_errstr(rc));
+			throw DbException(db);
+		}
+	}
+
+	~ScopeTransaction()
+	{
+		if (!committed) {
+			LOG(Level::INFO,
+				"ScopeTransaction: rolling back transaction");
+			sqlite3_exec(
+				db, "ROLLBACK;", nullptr, nullptr, nullptr);
+		}
+	}
+
+	void commit()
+	{
+		int rc = sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+		if (rc != SQLITE_OK) {
+			LOG(Level::CRITICAL,
+				"ScopeTransaction: couldn't commit transaction: "
+				"(%d) %s",
+				rc,
+				sqlite3_errstr(rc));
+			throw DbException(db);
+		}
+		committed = true;
+	}
+
+private:
+	sqlite3* db;
+	bool committed;
+};
+
+static std::string column_string(sqlite3_stmt* stmt, int column)
 {
-	std::vector<std::string>* vectorptr =
-		static_cast<std::vector<std::string>*>(vp);
-	assert(argc == 1);
-	assert(argv[0] != nullptr);
-	vectorptr->push_back(std::string(argv[0]));
-	LOG(Level::INFO, "vectorofstring_callback: element = %s", argv[0]);
-	return 0;
+	const char* text = reinterpret_cast<const char*>(
+		sqlite3_column_text(stmt, column));
+	if (text == nullptr) {
+		return "";
+	}
+	return std::string(text, sqlite3_column_bytes(stmt, column));
 }
 
-static int
-rssitem_callback(void* myfeed, int argc, char** argv, char** /* azColName */)
+/* Columns that read_rssitem() expects, in this exact order. */
+#define RSSITEM_COLUMNS                                                  \
+	"guid, title, author, url, pubDate, content_length, unread, "    \
+	"feedurl, enclosure_url, enclosure_type, enqueued, flags, base "
+
+static std::shared_ptr<RssItem> read_rssitem(sqlite3_stmt* stmt)
 {
-	std::shared_ptr<RssFeed>* feed =
-		static_cast<std::shared_ptr<RssFeed>*>(myfeed);
-	assert(argc == 13);
+	assert(sqlite3_column_count(stmt) == 13);
 	std::shared_ptr<RssItem> item(new RssItem(nullptr));
-	item->set_guid(argv[0]);
-	item->set_title(argv[1]);
-	item->set_author(argv[2]);
-	item->set_link(argv[3]);
+	item->set_guid(column_string(stmt, 0));
+	item->set_title(column_string(stmt, 1));
+	item->set_author(column_string(stmt, 2));
+	item->set_link(column_string(stmt, 3));
+	item->set_pubDate(sqlite3_column_int64(stmt, 4));
+	item->set_size(static_cast<unsigned int>(sqlite3_column_int64(stmt, 5)));
+	item->set_unread(sqlite3_column_int(stmt, 6) == 1);
+	item->set_feedurl(column_string(stmt, 7));
+	item->set_enclosure_url(column_string(stmt, 8));
+	item->set_enclosure_type(column_string(stmt, 9));
+	item->set_enqueued(sqlite3_column_int(stmt, 10) == 1);
+	item->set_flags(column_string(stmt, 11));
+	item->set_base(column_string(stmt, 12));
+	return item;
+}
 
-	std::istringstream is(argv[4]);
-	time_t t;
-	is >> t;
-	item->set_pubDate(t);
+/* 64-bit FNV-1a. The hashes are stored in the cache, so this must never
+ * change. */
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
 
-	item->set_size(utils::to_u(argv[5]));
-	item->set_unread((std::string("1") == argv[6]));
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
 
-	item->set_feedurl(argv[7]);
+static sqlite3_int64 text_hash(const std::string& text)
+{
+	return static_cast<sqlite3_int64>(
+			fnv1a(FNV_OFFSET_BASIS, text.data(), text.size()));
+}
 
-	item->set_enclosure_url(argv[8] ? argv[8] : "");
-	item->set_enclosure_type(argv[9] ? argv[9] : "");
-	item->set_enqueued((std::string("1") == (argv[10] ? argv[10] : "")));
-	item->set_flags(argv[11] ? argv[11] : "");
-	item->set_base(argv[12] ? argv[12] : "");
+/* Hash of the GUID, stored in rss_item.guid_hash. */
+static sqlite3_int64 guid_hash(const std::string& guid)
+{
+	return text_hash(guid);
+}
 
-	//(*feed)->items().push_back(item);
-	(*feed)->add_item(item);
-	return 0;
+/* Hash of everything that update_rssitem_unlocked() writes for an article
+ * that is already in the cache, stored in rss_item.fingerprint. Each field
+ * is prefixed with its length, so that moving text from one field to the
+ * next changes the hash. */
+static sqlite3_int64 item_fingerprint(RssItem& item,
+	const std::string& feedurl,
+	sqlite3_int64 feed_id,
+	const std::string& content)
+{
+	uint64_t hash = fnv1a(FNV_OFFSET_BASIS, &feed_id, sizeof(feed_id));
+	const auto add = [&hash](const std::string& field) {
+		const uint64_t size = field.size();
+		hash = fnv1a(hash, &size, sizeof(size));
+		hash = fnv1a(hash, field.data(), field.size());
+	};
+	add(item.title_raw());
+	add(item.author_raw());
+	add(item.link());
+	add(feedurl);
+	add(content);
+	add(item.enclosure_url());
+	add(item.enclosure_type());
+	add(item.get_base());
+	return static_cast<sqlite3_int64>(hash);
 }
 
-static int fill_content_callback(void* myfeed,
+/* text_hash() as an SQL function, for schema migrations. */
+static void text_hash_function(sqlite3_context* context,
 	int argc,
-	char** argv,
-	char** /* azColName */)
+	sqlite3_value** argv)
 {
-	RssFeed* feed = static_cast<RssFeed*>(myfeed);
-	assert(argc == 2);
-	if (argv[0]) {
-		std::shared_ptr<RssItem> item =
-			feed->get_item_by_guid_unlocked(argv[0]);
-		item->set_description(argv[1] ? argv[1] : "");
+	assert(argc == 1);
+	const char* text =
+		reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
+	if (text == nullptr) {
+		sqlite3_result_null(context);
+		return;
 	}
-	return 0;
+	sqlite3_result_int64(context,
+		text_hash(std::string(text, sqlite3_value_bytes(argv[0]))));
 }
 
-static int search_item_callback(void* myfeed,
+/* content_text(content, content_format) SQL function: the text of an
+ * article, whether it's stored compressed or not. */
+static void content_text_function(sqlite3_context* context,
 	int argc,
-	char** argv,
-	char** /* azColName */)
+	sqlite3_value** argv)
 {
-	std::vector<std::shared_ptr<RssItem>>* items =
-		static_cast<std::vector<std::shared_ptr<RssItem>>*>(myfeed);
-	assert(argc == 13);
-	std::shared_ptr<RssItem> item(new RssItem(nullptr));
-	item->set_guid(argv[0]);
-	item->set_title(argv[1]);
-	item->set_author(argv[2]);
-	item->set_link(argv[3]);
-
-	std::istringstream is(argv[4]);
-	time_t t;
-	is >> t;
-	item->set_pubDate(t);
-
-	item->set_size(utils::to_u(argv[5]));
-	item->set_unread((std::string("1") == argv[6]));
-	item->set_feedurl(argv[7]);
-
-	item->set_enclosure_url(argv[8] ? argv[8] : "");
-	item->set_enclosure_type(argv[9] ? argv[9] : "");
-	item->set_enqueued((std::string("1") == argv[10]));
-	item->set_flags(argv[11] ? argv[11] : "");
-	item->set_base(argv[12] ? argv[12] : "");
-
-	items->push_back(item);
-	return 0;
+	assert(argc == 2);
+	if (sqlite3_value_int64(argv[1]) != CONTENT_ZLIB) {
+		sqlite3_result_value(context, argv[0]);
+		return;
+	}
+
+	std::string text;
+	if (!decompress_content(sqlite3_value_blob(argv[0]),
+			sqlite3_value_bytes(argv[0]),
+			text)) {
+		LOG(Level::ERROR,
+			"content_text_function: couldn't decompress article "
+			"content, treating it as empty");
+		text.clear();
+	}
+	sqlite3_result_text(
+		context, text.data(), text.size(), SQLITE_TRANSIENT);
 }
 
-static int
-guid_callback(void* myguids, int argc, char** argv, char** /* azColName */)
+/* Registers the SQL functions that schema patches, triggers and queries
+ * call. Returns SQLite error code. */
+static int create_functions(sqlite3* connection)
 {
-	auto* guids = static_cast<std::unordered_set<std::string>*>(myguids);
-	assert(argc == 1);
-	guids->emplace(argv[0]);
+	for (const char* name : {"guid_hash", "text_hash"}) {
+		const int error = sqlite3_create_function(connection,
+				name,
+				1,
+				SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+				nullptr,
+				text_hash_function,
+				nullptr,
+				nullptr);
+		if (error != SQLITE_OK) {
+			return error;
+		}
+	}
+	return sqlite3_create_function(connection,
+		"content_text",
+		2,
+		SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+		nullptr,
+		content_text_function,
+		nullptr,
+		nullptr);
+}
+
+/* Keys are hashed the same way as GUIDs, so that they can be matched with
+ * rss_item's (guid_hash, guid) through its index. */
+static const std::string create_key_set_query =
+	"CREATE TEMP TABLE IF NOT EXISTS key_set ( "
+	" key_hash INTEGER NOT NULL, "
+	" key TEXT NOT NULL );";
+
+template<typename Container>
+void Cache::fill_key_set(sqlite3* connection,
+	std::unordered_map<std::string, sqlite3_stmt*>& cache,
+	const Container& keys)
+{
+	run_prepared_impl(
+		true, connection, cache, "DELETE FROM temp.key_set;", nullptr);
+	for (const auto& key : keys) {
+		run_prepared_impl(true,
+			connection,
+			cache,
+			"INSERT INTO temp.key_set (key_hash, key) VALUES (?, ?);",
+			nullptr,
+			guid_hash(key),
+			key);
+	}
+}
+
+template<typename Container, typename... Args>
+void Cache::run_read_with_keys(const Container& keys,
+	const std::string& query,
+	const std::function<void(sqlite3_stmt*)>& row_reader,
+	const Args&... args)
+{
+	ReaderConnection* reader = nullptr;
+	const auto lock = acquire_reader(reader);
+	sqlite3* connection = reader ? reader->db : db;
+	auto& cache = reader ? reader->statements : statements;
+
+	ScopeTransaction dbtrans(connection);
+	fill_key_set(connection, cache, keys);
+	run_prepared_impl(true, connection, cache, query, row_reader, args...);
+	dbtrans.commit();
+}
+
+/* Turns a query into the shape it's profiled under: literals are replaced
+ * with `?`, and runs of whitespace with a single space. That way queries that
+ * were put together with different values are counted together. */
+static std::string normalize_query(const std::string& sql)
+{
+	const auto is_word_char = [](char c) {
+		return std::isalnum(static_cast<unsigned char>(c)) || c == '_' ||
+			c == '?';
+	};
+
+	std::string result;
+	for (size_t i = 0; i < sql.size(); ++i) {
+		const char c = sql[i];
+		if (c == '\'') {
+			// skip to the closing quote; doubled quotes are escapes
+			size_t j = i + 1;
+			while (j < sql.size()) {
+				if (sql[j] == '\'' && j + 1 < sql.size() &&
+					sql[j + 1] == '\'') {
+					j += 2;
+				} else if (sql[j] == '\'') {
+					break;
+				} else {
+					++j;
+				}
+			}
+			i = j;
+			result += '?';
+		} else if (std::isdigit(static_cast<unsigned char>(c)) &&
+			(result.empty() || !is_word_char(result.back()))) {
+			while (i + 1 < sql.size() &&
+				(is_word_char(sql[i + 1]) || sql[i + 1] == '.')) {
+				++i;
+			}
+			result += '?';
+		} else if (std::isspace(static_cast<unsigned char>(c))) {
+			if (!result.empty() && result.back() != ' ') {
+				result += ' ';
+			}
+		} else {
+			result += c;
+		}
+	}
+	if (!result.empty() && result.back() == ' ') {
+		result.pop_back();
+	}
+	return result;
+}
+
+/* sqlite3_changes() is only updated by these, and keeps its value through
+ * other statements. All queries in this file spell keywords in upper case. */
+static bool changes_rows(const std::string& query)
+{
+	for (const std::string keyword :
+		{"INSERT", "UPDATE", "DELETE", "REPLACE"}) {
+		if (query.compare(0, keyword.size(), keyword) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Called by SQLite for every row a statement returns, and once a statement
+ * finishes. Registered for the writer and all reader connections when
+ * `cache-query-stats` is set. */
+int Cache::trace_statement(unsigned int type,
+	void* context,
+	void* p,
+	void* x)
+{
+	Cache* cache = static_cast<Cache*>(context);
+	sqlite3_stmt* stmt = static_cast<sqlite3_stmt*>(p);
+
+	if (type == SQLITE_TRACE_ROW) {
+		std::lock_guard<std::mutex> lock(cache->stats_mtx);
+		cache->rows_in_progress[stmt]++;
+		return 0;
+	}
+	if (type != SQLITE_TRACE_PROFILE) {
+		return 0;
+	}
+
+	const char* sql = sqlite3_sql(stmt);
+	const std::string query = normalize_query(sql ? sql : "");
+	const uint64_t time = *static_cast<sqlite3_int64*>(x);
+	uint64_t changed = 0;
+	if (changes_rows(query)) {
+		changed = sqlite3_changes(sqlite3_db_handle(stmt));
+	}
+
+	std::lock_guard<std::mutex> lock(cache->stats_mtx);
+	QueryStats& stats = cache->query_stats[query];
+	if (stats.calls == 0) {
+		stats.sample = sql ? sql : "";
+	}
+	stats.calls++;
+	stats.total_time += time;
+	stats.max_time = std::max(stats.max_time, time);
+	stats.rows_changed += changed;
+	const auto rows = cache->rows_in_progress.find(stmt);
+	if (rows != cache->rows_in_progress.end()) {
+		stats.rows_returned += rows->second;
+		cache->rows_in_progress.erase(rows);
+	}
+	cache->query_stats_changed = true;
 	return 0;
 }
 
-Cache::Cache(const std::string& cachefile, ConfigContainer* c)
+/* Every column of rss_item, which the archive's copy of the table has, too. */
+#define ARCHIVED_COLUMNS                                                  \
+	"id, guid, title, author, url, feedurl, pubDate, content, unread, " \
+	"enclosure_url, enclosure_type, enqueued, flags, deleted, base, "  \
+	"feed_id, guid_hash, content_format, content_length, fingerprint, " \
+	"content_hash "
+
+/* Tables of the archive database. Its rss_item has to be kept in step with
+ * the one in the cache whenever schema patches add columns to that. */
+static const std::vector<std::string> archiveTables = {
+	"CREATE TABLE IF NOT EXISTS archive.rss_item ( "
+	" id INTEGER PRIMARY KEY NOT NULL, "
+	" guid VARCHAR(64) NOT NULL, "
+	" title VARCHAR(1024) NOT NULL, "
+	" author VARCHAR(1024) NOT NULL, "
+	" url VARCHAR(1024) NOT NULL, "
+	" feedurl VARCHAR(1024) NOT NULL, "
+	" pubDate INTEGER NOT NULL, "
+	" content VARCHAR(65535) NOT NULL, "
+	" unread INTEGER(1) NOT NULL, "
+	" enclosure_url VARCHAR(1024), "
+	" enclosure_type VARCHAR(1024), "
+	" enqueued INTEGER(1) NOT NULL DEFAULT 0, "
+	" flags VARCHAR(52), "
+	" deleted INTEGER(1) NOT NULL DEFAULT 0, "
+	" base VARCHAR(128) NOT NULL DEFAULT '', "
+	" feed_id INTEGER NOT NULL DEFAULT 0, "
+	" guid_hash INTEGER NOT NULL DEFAULT 0, "
+	" content_format INTEGER NOT NULL DEFAULT 0, "
+	" content_length INTEGER NOT NULL DEFAULT 0, "
+	" fingerprint INTEGER NOT NULL DEFAULT 0, "
+	" content_hash INTEGER NOT NULL DEFAULT 0 );",
+
+	"CREATE INDEX IF NOT EXISTS archive.idx_guid_hash ON "
+	"rss_item(guid_hash, fingerprint);",
+
+	/* for keep-articles-days and for removing feeds */
+	"CREATE INDEX IF NOT EXISTS archive.idx_feed_id ON "
+	"rss_item(feed_id, pubDate);",
+};
+
+/* Full-text index for article search. It doesn't store a copy of the articles,
+ * it only indexes rss_item. It's not part of the schema patches, since SQLite
+ * may be built without FTS5; see create_fts_index(). */
+static const std::vector<std::string> ftsTables = {
+	"CREATE VIRTUAL TABLE rss_item_fts USING fts5("
+	"title, author, content, "
+	"content='rss_item', content_rowid='id');",
+
+	/* matches in the title count the most, those in the content the
+	 * least */
+	"INSERT INTO rss_item_fts(rss_item_fts, rank) "
+	"VALUES('rank', 'bm25(10.0, 5.0, 1.0)');",
+
+	/* the index has to see the text, not the compressed bytes */
+	"CREATE TRIGGER rss_item_fts_insert AFTER INSERT ON "
+	"rss_item BEGIN "
+	"INSERT INTO rss_item_fts(rowid, title, author, content) "
+	"VALUES (new.id, new.title, new.author, "
+	"content_text(new.content, new.content_format)); "
+	"END;",
+
+	"CREATE TRIGGER rss_item_fts_delete AFTER DELETE ON "
+	"rss_item BEGIN "
+	"INSERT INTO rss_item_fts(rss_item_fts, rowid, title, "
+	"author, content) "
+	"VALUES ('delete', old.id, old.title, old.author, "
+	"content_text(old.content, old.content_format)); "
+	"END;",
+
+	/* every reload rewrites the articles, so only touch the index if
+	 * something actually changed */
+	"CREATE TRIGGER rss_item_fts_update "
+	"AFTER UPDATE OF title, author, content ON rss_item "
+	"WHEN old.title IS NOT new.title "
+	"OR old.author IS NOT new.author "
+	"OR old.content IS NOT new.content "
+	"BEGIN "
+	"INSERT INTO rss_item_fts(rss_item_fts, rowid, title, "
+	"author, content) "
+	"VALUES ('delete', old.id, old.title, old.author, "
+	"content_text(old.content, old.content_format)); "
+	"INSERT INTO rss_item_fts(rowid, title, author, content) "
+	"VALUES (new.id, new.title, new.author, "
+	"content_text(new.content, new.content_format)); "
+	"END;",
+
+	/* 'rebuild' would index compressed content as it's stored */
+	"INSERT INTO rss_item_fts(rowid, title, author, content) "
+	"SELECT id, title, author, content_text(content, content_format) "
+	"FROM rss_item;",
+};
+
+/* Full-text index of the archive. Archived articles are never changed, only
+ * inserted and deleted. */
+static const std::vector<std::string> archiveFtsTables = {
+	"CREATE VIRTUAL TABLE IF NOT EXISTS archive.rss_item_fts USING "
+	"fts5(title, author, content, content='rss_item', "
+	"content_rowid='id');",
+
+	"CREATE TRIGGER IF NOT EXISTS archive.rss_item_fts_insert "
+	"AFTER INSERT ON rss_item BEGIN "
+	"INSERT INTO rss_item_fts(rowid, title, author, content) "
+	"VALUES (new.id, new.title, new.author, "
+	"content_text(new.content, new.content_format)); "
+	"END;",
+
+	"CREATE TRIGGER IF NOT EXISTS archive.rss_item_fts_delete "
+	"AFTER DELETE ON rss_item BEGIN "
+	"INSERT INTO rss_item_fts(rss_item_fts, rowid, title, author, "
+	"content) "
+	"VALUES ('delete', old.id, old.title, old.author, "
+	"content_text(old.content, old.content_format)); "
+	"END;",
+
+	/* ranked like the cache's index, since search results from both are
+	 * sorted together */
+	"INSERT INTO archive.rss_item_fts(rss_item_fts, rank) "
+	"VALUES('rank', 'bm25(10.0, 5.0, 1.0)');",
+};
+
+static int attach_archive(sqlite3* connection, const std::string& filename)
+{
+	sqlite3_stmt* stmt = nullptr;
+	int error = sqlite3_prepare_v2(connection,
+			"ATTACH DATABASE ? AS archive;",
+			-1,
+			&stmt,
+			nullptr);
+	if (error == SQLITE_OK) {
+		bind_value(stmt, 1, filename);
+		error = sqlite3_step(stmt);
+		if (error == SQLITE_DONE) {
+			error = SQLITE_OK;
+		}
+	}
+	sqlite3_finalize(stmt);
+	return error;
+}
+
+Cache::Cache(const std::string& cachefile,
+	ConfigContainer* c,
+	CacheMode mode)
 	: db(0)
 	, cfg(c)
+	, read_only(mode == CacheMode::READ_ONLY)
+	, fts_enabled(false)
+	, incremental_vacuum(false)
+	, next_reader(0)
+	, changes_generation(0)
+	, accept_changes(!read_only)
+	, query_stats_changed(false)
+	, collect_query_stats(c->get_configvalue_as_bool("cache-query-stats"))
 {
-	int error = sqlite3_open(cachefile.c_str(), &db);
+	const int flags = read_only
+		? SQLITE_OPEN_READONLY
+		: SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+	int error = sqlite3_open_v2(cachefile.c_str(), &db, flags, nullptr);
 	if (error != SQLITE_OK) {
 		LOG(Level::ERROR,
 			"couldn't sqlite3_open(%s): error = %d",
@@ -264,10 +874,49 @@ Cache::Cache(const std::string& cachefile, ConfigContainer* c)
 		throw DbException(db);
 	}
 
+	error = create_functions(db);
+	if (error != SQLITE_OK) {
+		LOG(Level::ERROR,
+			"couldn't register SQL functions: error = %d",
+			error);
+		throw DbException(db);
+	}
+	// Counting rows takes a lock for each one, so it's only done on request
+	if (collect_query_stats) {
+		sqlite3_trace_v2(db,
+			SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW,
+			&Cache::trace_statement,
+			this);
+	}
+
+	if (read_only) {
+		open_read_only();
+		return;
+	}
+
+	// Only takes effect when the database is created, or on the next
+	// VACUUM; see do_vacuum()
+	run_sql("PRAGMA auto_vacuum = INCREMENTAL;");
+
 	populate_tables();
 	set_pragmas();
+	run_sql(create_key_set_query);
+
+	run_prepared("PRAGMA auto_vacuum;", [&](sqlite3_stmt* stmt) {
+		incremental_vacuum = sqlite3_column_int(stmt, 0) == 2;
+	});
+	if (!incremental_vacuum) {
+		LOG(Level::INFO,
+			"Cache::Cache: incremental vacuum is off, run "
+			"`newsboat --vacuum' once to turn it on");
+	}
 
-	clean_old_articles();
+	create_fts_index();
+	open_archive();
+	delete_old_articles();
+	open_readers(cachefile);
+
+	changes_writer = std::thread(&Cache::write_pending_changes_loop, this);
 
 	// we need to manually lock all DB operations because SQLite has no
 	// explicit support for multithreading.
@@ -275,6 +924,24 @@ Cache::Cache(const std::string& cachefile, ConfigContainer* c)
 
 Cache::~Cache()
 {
+	try {
+		stop_changes_writer();
+	} catch (const DbException& e) {
+		LOG(Level::ERROR,
+			"Cache::~Cache: couldn't write pending changes: %s",
+			e.what());
+	}
+	log_query_stats();
+
+	for (const auto& reader : readers) {
+		for (const auto& statement : reader->statements) {
+			sqlite3_finalize(statement.second);
+		}
+		sqlite3_close(reader->db);
+	}
+	for (const auto& statement : statements) {
+		sqlite3_finalize(statement.second);
+	}
 	sqlite3_close(db);
 }
 
@@ -286,8 +953,102 @@ void Cache::set_pragmas()
 	// then we disable case-sensitive matching for the LIKE operator in
 	// SQLite, for search operations
 	run_sql("PRAGMA case_sensitive_like=OFF;");
+
+	// with write-ahead log, readers and the writer don't block each
+	// other. In-memory databases silently stay in "memory" mode.
+	run_prepared("PRAGMA journal_mode = WAL;", nullptr);
 }
 
+void Cache::open_readers(const std::string& cachefile)
+{
+	std::string journal_mode;
+	run_prepared("PRAGMA journal_mode;", [&](sqlite3_stmt* stmt) {
+		journal_mode = column_string(stmt, 0);
+	});
+	const char* filename = sqlite3_db_filename(db, "main");
+	if (journal_mode != "wal" || filename == nullptr ||
+		strlen(filename) == 0) {
+		LOG(Level::INFO,
+			"Cache::open_readers: %s can't be shared, all queries "
+			"will use a single connection",
+			cachefile);
+		return;
+	}
+
+	for (unsigned int i = 0; i < READER_CONNECTIONS; ++i) {
+		std::unique_ptr<ReaderConnection> reader(new ReaderConnection);
+		reader->db = nullptr;
+		int error = sqlite3_open_v2(
+			filename, &reader->db, SQLITE_OPEN_READONLY, nullptr);
+		if (error != SQLITE_OK) {
+			LOG(Level::ERROR,
+				"Cache::open_readers: couldn't open reader "
+				"for %s: error = %d",
+				cachefile,
+				error);
+			sqlite3_close(reader->db);
+			break;
+		}
+		error = create_functions(reader->db);
+		if (error == SQLITE_OK) {
+			error = sqlite3_exec(reader->db,
+					create_key_set_query.c_str(),
+					nullptr,
+					nullptr,
+					nullptr);
+		}
+		if (error == SQLITE_OK && !archive_file.empty()) {
+			error = attach_archive(reader->db, archive_file);
+		}
+		if (error != SQLITE_OK) {
+			LOG(Level::ERROR,
+				"Cache::open_readers: couldn't set up reader: "
+				"error = %d",
+				error);
+			sqlite3_close(reader->db);
+			break;
+		}
+		if (collect_query_stats) {
+			sqlite3_trace_v2(reader->db,
+				SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW,
+				&Cache::trace_statement,
+				this);
+		}
+		readers.push_back(std::move(reader));
+	}
+}
+
+std::unique_lock<std::mutex> Cache::acquire_reader(ReaderConnection*& reader)
+{
+	if (readers.empty()) {
+		reader = nullptr;
+		return std::unique_lock<std::mutex>(mtx);
+	}
+
+	for (const auto& candidate : readers) {
+		std::unique_lock<std::mutex> lock(
+			candidate->mtx, std::try_to_lock);
+		if (lock.owns_lock()) {
+			reader = candidate.get();
+			return lock;
+		}
+	}
+
+	// all readers are busy; wait for one, taking turns so that no reader
+	// gets all the waiters
+	reader = readers[next_reader++ % readers.size()].get();
+	return std::unique_lock<std::mutex>(reader->mtx);
+}
+
+/* Recounts unread and total articles of every feed into rss_feed_counts,
+ * which must be empty. Deleted articles aren't counted. */
+static const std::string fill_feed_counts_query =
+	"INSERT INTO rss_feed_counts (feedurl, unread_count, total_count) "
+	"SELECT feedurl, sum(unread = 1), count(*) "
+	"FROM rss_item "
+	"WHERE deleted = 0 "
+	"GROUP BY feedurl;";
+
 static const schema_patches schemaPatches{
 	{{2, 10},
 		{
@@ -369,7 +1130,174 @@ static const schema_patches schemaPatches{
 		 " db_schema_version_major INTEGER NOT NULL, "
 		 " db_schema_version_minor INTEGER NOT NULL );"
 
-		 "INSERT INTO metadata VALUES ( 2, 11 );"}}};
+		 "INSERT INTO metadata VALUES ( 2, 11 );"}},
+	{{2, 13},
+		{
+			/* per-feed article counts, kept up to date by the
+			 * triggers below so that they don't have to be counted
+			 * over the whole rss_item table */
+			"CREATE TABLE rss_feed_counts ( "
+			" feedurl VARCHAR(1024) PRIMARY KEY NOT NULL, "
+			" unread_count INTEGER NOT NULL DEFAULT 0, "
+			" total_count INTEGER NOT NULL DEFAULT 0 );",
+
+			"CREATE TRIGGER rss_feed_counts_insert AFTER INSERT ON "
+			"rss_item WHEN new.deleted = 0 BEGIN "
+			"INSERT INTO rss_feed_counts "
+			"(feedurl, unread_count, total_count) "
+			"VALUES (new.feedurl, new.unread = 1, 1) "
+			"ON CONFLICT(feedurl) DO UPDATE "
+			"SET unread_count = unread_count + excluded.unread_count, "
+			"total_count = total_count + 1; "
+			"END;",
+
+			"CREATE TRIGGER rss_feed_counts_delete AFTER DELETE ON "
+			"rss_item WHEN old.deleted = 0 BEGIN "
+			"UPDATE rss_feed_counts "
+			"SET unread_count = unread_count - (old.unread = 1), "
+			"total_count = total_count - 1 "
+			"WHERE feedurl = old.feedurl; "
+			"END;",
+
+			/* an update is counted as a removal of the old row and
+			 * an insertion of the new one */
+			"CREATE TRIGGER rss_feed_counts_update "
+			"AFTER UPDATE OF unread, deleted, feedurl ON rss_item "
+			"WHEN old.unread IS NOT new.unread "
+			"OR old.deleted IS NOT new.deleted "
+			"OR old.feedurl IS NOT new.feedurl "
+			"BEGIN "
+			"UPDATE rss_feed_counts "
+			"SET unread_count = unread_count - (old.unread = 1), "
+			"total_count = total_count - 1 "
+			"WHERE feedurl = old.feedurl AND old.deleted = 0; "
+			"INSERT INTO rss_feed_counts "
+			"(feedurl, unread_count, total_count) "
+			"SELECT new.feedurl, new.unread = 1, 1 "
+			"WHERE new.deleted = 0 "
+			"ON CONFLICT(feedurl) DO UPDATE "
+			"SET unread_count = unread_count + excluded.unread_count, "
+			"total_count = total_count + 1; "
+			"END;",
+
+			/* rss_feed gets an explicit integer key, so that
+			 * VACUUM can't renumber it. fetch_time is how long the
+			 * feed took to fetch on its last reload, in
+			 * milliseconds; next_reload is when `adaptive-reload`
+			 * should reload it, 0 meaning right away; body_hash is
+			 * hash_body() of the document it was last parsed from,
+			 * 0 if unknown. The rest are the refresh hints it
+			 * declared: minimum seconds between reloads, and bit
+			 * masks of the hours and days of the week to skip */
+			"CREATE TABLE rss_feed_new ( "
+			" id INTEGER PRIMARY KEY NOT NULL, "
+			" rssurl VARCHAR(1024) UNIQUE NOT NULL, "
+			" url VARCHAR(1024) NOT NULL, "
+			" title VARCHAR(1024) NOT NULL, "
+			" lastmodified INTEGER(11) NOT NULL DEFAULT 0, "
+			" is_rtl INTEGER(1) NOT NULL DEFAULT 0, "
+			" etag VARCHAR(128) NOT NULL DEFAULT '', "
+			" fetch_time INTEGER NOT NULL DEFAULT 0, "
+			" next_reload INTEGER NOT NULL DEFAULT 0, "
+			" body_hash INTEGER NOT NULL DEFAULT 0, "
+			" hint_interval INTEGER NOT NULL DEFAULT 0, "
+			" skip_hours INTEGER NOT NULL DEFAULT 0, "
+			" skip_days INTEGER NOT NULL DEFAULT 0 );",
+
+			"INSERT INTO rss_feed_new "
+			"(rssurl, url, title, lastmodified, is_rtl, etag) "
+			"SELECT rssurl, url, title, lastmodified, is_rtl, etag "
+			"FROM rss_feed;",
+
+			"DROP TABLE rss_feed;",
+
+			"ALTER TABLE rss_feed_new RENAME TO rss_feed;",
+
+			"CREATE INDEX IF NOT EXISTS idx_lastmodified ON "
+			"rss_feed(lastmodified);",
+
+			/* articles are looked up by integer keys rather than by
+			 * long URLs and GUIDs. feedurl and guid are still
+			 * stored, the latter to tell apart colliding hashes */
+			"ALTER TABLE rss_item ADD feed_id INTEGER NOT NULL "
+			"DEFAULT 0;",
+
+			"ALTER TABLE rss_item ADD guid_hash INTEGER NOT NULL "
+			"DEFAULT 0;",
+
+			/* content can be stored compressed, as indicated by
+			 * content_format. Its length is kept separately, so
+			 * loading articles doesn't have to inflate them */
+			"ALTER TABLE rss_item ADD content_format INTEGER "
+			"NOT NULL DEFAULT 0;",
+
+			"ALTER TABLE rss_item ADD content_length INTEGER "
+			"NOT NULL DEFAULT 0;",
+
+			/* reloads compare these to the incoming articles, and
+			 * only write the ones that changed. Fingerprints are
+			 * left out here, so existing articles are rewritten on
+			 * their first reload; the content hash is needed to
+			 * tell if that reload changed them */
+			"ALTER TABLE rss_item ADD fingerprint INTEGER NOT NULL "
+			"DEFAULT 0;",
+
+			"ALTER TABLE rss_item ADD content_hash INTEGER NOT NULL "
+			"DEFAULT 0;",
+
+			"UPDATE rss_item SET "
+			"feed_id = coalesce((SELECT id FROM rss_feed "
+			"WHERE rssurl = rss_item.feedurl), 0), "
+			"guid_hash = guid_hash(guid), "
+			"content_length = length(content), "
+			"content_hash = text_hash(content);",
+
+			/* articles whose feed is gone can't be shown anywhere,
+			 * and queries by feed id wouldn't count them */
+			"DELETE FROM rss_item WHERE feed_id = 0;",
+
+			fill_feed_counts_query,
+
+			"DROP INDEX IF EXISTS idx_feedurl;",
+
+			"DROP INDEX IF EXISTS idx_guid;",
+
+			/* superseded by idx_feed_items */
+			"DROP INDEX IF EXISTS idx_deleted;",
+
+			"CREATE INDEX IF NOT EXISTS idx_feed_id ON "
+			"rss_item(feed_id);",
+
+			/* lets reloads look the hashes up without reading the
+			 * rows themselves */
+			"CREATE INDEX IF NOT EXISTS idx_guid_hash ON "
+			"rss_item(guid_hash, fingerprint, content_hash);",
+
+			/* returns a feed's articles in the order they're
+			 * displayed in, so neither reading nor trimming them to
+			 * `max-items` has to sort them */
+			"CREATE INDEX IF NOT EXISTS idx_feed_items ON "
+			"rss_item(feed_id, pubDate DESC, id DESC) "
+			"WHERE deleted = 0;",
+
+			/* "mark all read" only has to visit unread articles */
+			"CREATE INDEX IF NOT EXISTS idx_unread ON "
+			"rss_item(feed_id) WHERE unread = 1;",
+
+			"ANALYZE;",
+
+			"UPDATE metadata SET db_schema_version_major = 2, "
+			"db_schema_version_minor = 13;",
+		}}};
+
+/* Patches up to 2.11 predate the metadata table, so they're run over caches
+ * that may already have parts of them; errors in these are logged and skipped.
+ * Every other patch is applied in a single transaction, and the cache isn't
+ * opened if any of its steps fails. */
+static bool is_atomic_patch(const SchemaVersion& version)
+{
+	return version > SchemaVersion{2, 11};
+}
 
 void Cache::populate_tables()
 {
@@ -401,24 +1329,150 @@ void Cache::populate_tables()
 			"for version %u.%u",
 			patch_version.major,
 			patch_version.minor);
+		if (!is_atomic_patch(patch_version)) {
+			for (const auto& query : patches_it->second) {
+				run_sql_nothrow(query);
+			}
+			continue;
+		}
+
+		// Patches that rebuild tables would lose data if they went on
+		// after a failed step, so they're rolled back instead
+		ScopeTransaction dbtrans(db);
 		for (const auto& query : patches_it->second) {
-			run_sql_nothrow(query);
+			run_sql(query);
 		}
+		dbtrans.commit();
 	}
 }
 
+/* Creates the full-text index if the cache doesn't have it yet. That's the
+ * case after upgrading from schema 2.11, and every time the cache is opened
+ * with an SQLite built without FTS5; searches then fall back to LIKE. */
+void Cache::create_fts_index()
+{
+	run_prepared("SELECT count(*) FROM sqlite_master "
+		     "WHERE type = 'table' AND name = 'rss_item_fts';",
+		[&](sqlite3_stmt* stmt) {
+			fts_enabled = sqlite3_column_int(stmt, 0) > 0;
+		});
+	if (fts_enabled) {
+		return;
+	}
+
+	// without the index, these would make every write fail
+	run_sql("DROP TRIGGER IF EXISTS rss_item_fts_insert;");
+	run_sql("DROP TRIGGER IF EXISTS rss_item_fts_delete;");
+	run_sql("DROP TRIGGER IF EXISTS rss_item_fts_update;");
+
+	try {
+		ScopeTransaction dbtrans(db);
+		for (const auto& query : ftsTables) {
+			run_sql(query);
+		}
+		dbtrans.commit();
+		fts_enabled = true;
+	} catch (const DbException& e) {
+		LOG(Level::ERROR,
+			"Cache::create_fts_index: couldn't create the full-text "
+			"index (is SQLite built without FTS5?), searches will be "
+			"slow: %s",
+			e.what());
+	}
+}
+
+/* Prepares a connection that never writes to the database, so that it can be
+ * used while another instance has the cache open. With write-ahead log, it
+ * reads a consistent snapshot without waiting for that instance's writes, and
+ * without holding them up. */
+void Cache::open_read_only()
+{
+	const SchemaVersion version = get_schema_version();
+	const SchemaVersion latest = schemaPatches.crbegin()->first;
+	if (version.major != latest.major || version < latest) {
+		const std::string msg = strprintf::fmt(
+			"Database schema version %u.%u is out of date; start "
+			"%s normally once to upgrade it",
+			version.major,
+			version.minor,
+			PROGRAM_NAME);
+		LOG(Level::ERROR, "Cache::open_read_only: %s", msg);
+		throw std::runtime_error(msg);
+	}
+
+	// Another instance may be recovering the write-ahead log or
+	// checkpointing it, which takes an exclusive lock for a moment
+	sqlite3_busy_timeout(db, READ_ONLY_BUSY_TIMEOUT);
+
+	run_sql("PRAGMA case_sensitive_like=OFF;");
+	run_sql(create_key_set_query);
+	run_prepared("SELECT count(*) FROM sqlite_master "
+		     "WHERE type = 'table' AND name = 'rss_item_fts';",
+		[&](sqlite3_stmt* stmt) {
+			fts_enabled = sqlite3_column_int(stmt, 0) > 0;
+		});
+	open_archive();
+}
+
+/* Attaches the archive that old read articles are moved to. It's a file next
+ * to the cache, so that the cache itself stays small. The archive is only
+ * created once `archive-articles-days` is set, but stays in use after it's
+ * unset, so that archived articles can still be found. */
+void Cache::open_archive()
+{
+	const char* filename = sqlite3_db_filename(db, "main");
+	if (filename == nullptr || strlen(filename) == 0) {
+		return;
+	}
+	const std::string archive = std::string(filename) + ".archive";
+	const bool exists = ::access(archive.c_str(), F_OK) == 0;
+	if (!exists &&
+		(read_only ||
+			cfg->get_configvalue_as_int("archive-articles-days") ==
+			0)) {
+		return;
+	}
+
+	if (attach_archive(db, archive) != SQLITE_OK) {
+		LOG(Level::ERROR,
+			"Cache::open_archive: couldn't attach %s: %s",
+			archive,
+			sqlite3_errmsg(db));
+		throw DbException(db);
+	}
+	archive_file = archive;
+
+	if (!read_only) {
+		// Like in the cache, auto_vacuum only takes effect when the
+		// archive is created
+		run_sql("PRAGMA archive.auto_vacuum = INCREMENTAL;");
+		run_sql("PRAGMA archive.synchronous = OFF;");
+		run_prepared("PRAGMA archive.journal_mode = WAL;", nullptr);
+		for (const auto& query : archiveTables) {
+			run_sql(query);
+		}
+		if (fts_enabled) {
+			for (const auto& query : archiveFtsTables) {
+				run_sql(query);
+			}
+		}
+	}
+	LOG(Level::INFO, "Cache::open_archive: attached %s", archive_file);
+}
+
 void Cache::fetch_lastmodified(const std::string& feedurl,
 	time_t& t,
 	std::string& etag)
 {
-	std::lock_guard<std::mutex> lock(mtx);
-	std::string query = prepare_query(
-		"SELECT lastmodified, etag FROM rss_feed WHERE rssurl = '%q';",
+	t = 0;
+	etag = "";
+	run_read(
+		"SELECT lastmodified, etag FROM rss_feed WHERE rssurl = ?;",
+		[&](sqlite3_stmt* stmt) {
+			t = sqlite3_column_int64(stmt, 0);
+			etag = column_string(stmt, 1);
+		},
 		feedurl);
-	HeaderValues result = {0, ""};
-	run_sql(query, lastmodified_callback, &result);
-	t = result.lastmodified;
-	etag = result.etag;
 	LOG(Level::DEBUG,
 		"Cache::fetch_lastmodified: t = %d etag = %s",
 		t,
@@ -436,36 +1490,288 @@ void Cache::update_lastmodified(const std::string& feedurl,
 		return;
 	}
 	std::lock_guard<std::mutex> lock(mtx);
-	std::string query = "UPDATE rss_feed SET ";
-	if (t > 0)
-		query.append(prepare_query("lastmodified = '%d'", t));
-	if (etag.length() > 0) {
-		query.append(prepare_query("%c etag = %s",
-			(t > 0 ? ',' : ' '),
-			prepare_query("'%q'", etag)));
+	if (t > 0 && etag.length() > 0) {
+		run_prepared_nothrow(
+			"UPDATE rss_feed SET lastmodified = ?, etag = ? "
+			"WHERE rssurl = ?;",
+			nullptr,
+			t,
+			etag,
+			feedurl);
+	} else if (t > 0) {
+		run_prepared_nothrow(
+			"UPDATE rss_feed SET lastmodified = ? WHERE rssurl = ?;",
+			nullptr,
+			t,
+			feedurl);
+	} else {
+		run_prepared_nothrow(
+			"UPDATE rss_feed SET etag = ? WHERE rssurl = ?;",
+			nullptr,
+			etag,
+			feedurl);
+	}
+}
+
+std::unordered_map<std::string, unsigned int> Cache::get_fetch_times()
+{
+	std::unordered_map<std::string, unsigned int> fetch_times;
+	run_read("SELECT rssurl, fetch_time FROM rss_feed "
+		 "WHERE fetch_time > 0;",
+		[&](sqlite3_stmt* stmt) {
+			fetch_times[column_string(stmt, 0)] =
+				sqlite3_column_int(stmt, 1);
+		});
+	return fetch_times;
+}
+
+void Cache::update_fetch_times(
+	const std::unordered_map<std::string, unsigned int>& fetch_times)
+{
+	if (fetch_times.empty()) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(mtx);
+	ScopeTransaction dbtrans(db);
+	for (const auto& fetch_time : fetch_times) {
+		run_prepared("UPDATE rss_feed SET fetch_time = ? "
+			     "WHERE rssurl = ?;",
+			nullptr,
+			fetch_time.second,
+			fetch_time.first);
+	}
+	dbtrans.commit();
+}
+
+std::unordered_map<std::string, time_t> Cache::get_next_reload_times()
+{
+	std::unordered_map<std::string, time_t> next_reloads;
+	run_read("SELECT rssurl, next_reload FROM rss_feed "
+		 "WHERE next_reload > 0;",
+		[&](sqlite3_stmt* stmt) {
+			next_reloads[column_string(stmt, 0)] =
+				sqlite3_column_int64(stmt, 1);
+		});
+	return next_reloads;
+}
+
+void Cache::set_next_reload_time(const std::string& feedurl,
+	time_t next_reload)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	run_prepared("UPDATE rss_feed SET next_reload = ? WHERE rssurl = ?;",
+		nullptr,
+		next_reload,
+		feedurl);
+}
+
+int64_t Cache::hash_body(const std::string& body,
+	const std::string& settings)
+{
+	const uint64_t size = settings.size();
+	uint64_t hash = fnv1a(FNV_OFFSET_BASIS, &size, sizeof(size));
+	hash = fnv1a(hash, settings.data(), settings.size());
+	hash = fnv1a(hash, body.data(), body.size());
+	return static_cast<int64_t>(hash);
+}
+
+int64_t Cache::get_body_hash(const std::string& feedurl)
+{
+	int64_t hash = 0;
+	run_read("SELECT body_hash FROM rss_feed WHERE rssurl = ?;",
+		[&](sqlite3_stmt* stmt) {
+			hash = sqlite3_column_int64(stmt, 0);
+		},
+		feedurl);
+	return hash;
+}
+
+void Cache::set_body_hash(const std::string& feedurl, int64_t hash)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	run_prepared("UPDATE rss_feed SET body_hash = ? WHERE rssurl = ?;",
+		nullptr,
+		hash,
+		feedurl);
+}
+
+static sqlite3_int64 to_bit_mask(const std::set<unsigned int>& bits)
+{
+	sqlite3_int64 mask = 0;
+	for (const auto bit : bits) {
+		if (bit < 32) {
+			mask |= sqlite3_int64(1) << bit;
+		}
+	}
+	return mask;
+}
+
+static std::set<unsigned int> from_bit_mask(sqlite3_int64 mask)
+{
+	std::set<unsigned int> bits;
+	for (unsigned int bit = 0; bit < 32; ++bit) {
+		if (mask & (sqlite3_int64(1) << bit)) {
+			bits.insert(bit);
+		}
+	}
+	return bits;
+}
+
+RefreshHints Cache::get_refresh_hints(const std::string& feedurl)
+{
+	RefreshHints hints;
+	run_read("SELECT hint_interval, skip_hours, skip_days FROM rss_feed "
+		 "WHERE rssurl = ?;",
+		[&](sqlite3_stmt* stmt) {
+			hints.min_interval = sqlite3_column_int64(stmt, 0);
+			hints.skip_hours =
+				from_bit_mask(sqlite3_column_int64(stmt, 1));
+			hints.skip_days =
+				from_bit_mask(sqlite3_column_int64(stmt, 2));
+		},
+		feedurl);
+	return hints;
+}
+
+void Cache::set_refresh_hints(const std::string& feedurl,
+	const RefreshHints& hints)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	run_prepared("UPDATE rss_feed SET hint_interval = ?, skip_hours = ?, "
+		     "skip_days = ? WHERE rssurl = ?;",
+		nullptr,
+		static_cast<sqlite3_int64>(hints.min_interval),
+		to_bit_mask(hints.skip_hours),
+		to_bit_mask(hints.skip_days),
+		feedurl);
+}
+
+/* Returns publication times of a feed's newest articles, newest first. */
+std::vector<time_t> Cache::get_recent_pubdates(const std::string& feedurl,
+	unsigned int limit)
+{
+	std::vector<time_t> pubdates;
+	run_read("SELECT pubDate FROM rss_item "
+		 "WHERE feed_id = (SELECT id FROM rss_feed WHERE rssurl = ?) "
+		 "AND deleted = 0 "
+		 "ORDER BY pubDate DESC, id DESC LIMIT ?;",
+		[&](sqlite3_stmt* stmt) {
+			pubdates.push_back(sqlite3_column_int64(stmt, 0));
+		},
+		feedurl,
+		limit);
+	return pubdates;
+}
+
+/* Rewrites the content of every article, archived ones included, in the
+ * format that `compress-cache` asks for. */
+RecompressStats Cache::recompress_content()
+{
+	ScopeMeasure m1("Cache::recompress_content");
+	const bool compress = cfg->get_configvalue_as_bool("compress-cache");
+	using Clock = std::chrono::steady_clock;
+	RecompressStats stats{0, 0, 0, 0.0};
+	Clock::duration decode_time{};
+
+	std::lock_guard<std::mutex> lock(mtx);
+	ScopeTransaction dbtrans(db);
+
+	std::vector<std::string> tables = {"rss_item"};
+	if (!archive_file.empty()) {
+		tables.push_back("archive.rss_item");
+	}
+
+	// Go in batches, so that we neither hold all articles in memory nor
+	// update rows that a running SELECT is going through
+	for (const auto& table : tables) {
+		sqlite3_int64 last_id = 0;
+		std::vector<std::pair<sqlite3_int64, std::string>> batch;
+		do {
+			batch.clear();
+			run_prepared("SELECT id, "
+				"content_text(content, content_format), "
+				"length(content) "
+				"FROM " + table + " "
+				"WHERE id > ? ORDER BY id LIMIT 1000;",
+				[&](sqlite3_stmt* stmt) {
+					last_id = sqlite3_column_int64(stmt, 0);
+					batch.emplace_back(last_id,
+						column_string(stmt, 1));
+					stats.bytes_before +=
+						sqlite3_column_int64(stmt, 2);
+				},
+				last_id);
+
+			for (const auto& article : batch) {
+				const StoredContent content =
+					store_content(article.second, compress);
+				run_prepared("UPDATE " + table + " "
+					"SET content = ?, content_format = ? "
+					"WHERE id = ?;",
+					nullptr,
+					content,
+					content.format,
+					article.first);
+
+				++stats.articles;
+				stats.bytes_after += content.bytes().size();
+
+				if (content.format == CONTENT_ZLIB) {
+					std::string text;
+					const auto start = Clock::now();
+					decompress_content(
+						content.bytes().data(),
+						content.bytes().size(),
+						text);
+					decode_time += Clock::now() - start;
+				}
+			}
+		} while (!batch.empty());
+	}
+
+	dbtrans.commit();
+
+	if (stats.articles > 0) {
+		stats.decode_time =
+			std::chrono::duration<double, std::micro>(decode_time)
+				.count() /
+			stats.articles;
 	}
-	query.append(" WHERE rssurl = ");
-	query.append(prepare_query("'%q'", feedurl));
-	run_sql_nothrow(query);
+	LOG(Level::INFO,
+		"Cache::recompress_content: %u articles, %" PRIu64
+		" bytes before, %" PRIu64 " bytes after",
+		stats.articles,
+		stats.bytes_before,
+		stats.bytes_after);
+	return stats;
 }
 
 void Cache::mark_item_deleted(const std::string& guid, bool b)
 {
 	std::lock_guard<std::mutex> lock(mtx);
-	std::string query = prepare_query(
-		"UPDATE rss_item SET deleted = %u WHERE guid = '%q'",
+	if (!archive_file.empty()) {
+		ScopeTransaction dbtrans(db);
+		fill_key_set(db, statements, std::vector<std::string>{guid});
+		restore_archived_items();
+		dbtrans.commit();
+	}
+	run_prepared_nothrow(
+		"UPDATE rss_item SET deleted = ? "
+		"WHERE guid_hash = ? AND guid = ?;",
+		nullptr,
 		b ? 1 : 0,
+		guid_hash(guid),
 		guid);
-	run_sql_nothrow(query);
 }
 
 void Cache::mark_feed_items_deleted(const std::string& feedurl)
 {
 	std::lock_guard<std::mutex> lock(mtx);
-	std::string query = prepare_query(
-		"UPDATE rss_item SET deleted = 1 WHERE feedurl = '%s';",
+	run_prepared_nothrow(
+		"UPDATE rss_item SET deleted = 1 "
+		"WHERE feed_id = (SELECT id FROM rss_feed WHERE rssurl = ?);",
+		nullptr,
 		feedurl);
-	run_sql_nothrow(query);
 }
 
 // this function writes an RssFeed including all RssItems to the database
@@ -477,43 +1783,30 @@ void Cache::externalize_rssfeed(std::shared_ptr<RssFeed> feed,
 		return;
 	}
 
+	flush_pending_changes();
+
 	std::lock_guard<std::mutex> lock(mtx);
 	std::lock_guard<std::mutex> feedlock(feed->item_mutex);
-	// scope_transaction dbtrans(db);
-
-	CbHandler count_cbh;
-	auto query = prepare_query(
-		"SELECT count(*) FROM rss_feed WHERE rssurl = '%q';",
-		feed->rssurl());
-	run_sql(query, count_callback, &count_cbh);
-
-	int count = count_cbh.count();
-	LOG(Level::DEBUG,
-		"Cache::externalize_rss_feed: rss_feeds with rssurl = '%s': "
-		"found "
-		"%d",
+	ScopeTransaction dbtrans(db);
+
+	run_prepared(
+		"INSERT INTO rss_feed (rssurl, url, title, is_rtl) "
+		"VALUES ( ?, ?, ?, ? ) "
+		"ON CONFLICT(rssurl) DO UPDATE "
+		"SET title = excluded.title, url = excluded.url, "
+		"is_rtl = excluded.is_rtl;",
+		nullptr,
 		feed->rssurl(),
-		count);
-	if (count > 0) {
-		std::string updatequery = prepare_query(
-			"UPDATE rss_feed "
-			"SET title = '%q', url = '%q', is_rtl = %u "
-			"WHERE rssurl = '%q';",
-			feed->title_raw(),
-			feed->link(),
-			feed->is_rtl() ? 1 : 0,
-			feed->rssurl());
-		run_sql(updatequery);
-	} else {
-		std::string insertquery = prepare_query(
-			"INSERT INTO rss_feed (rssurl, url, title, is_rtl) "
-			"VALUES ( '%q', '%q', '%q', %u );",
-			feed->rssurl(),
-			feed->link(),
-			feed->title_raw(),
-			feed->is_rtl() ? 1 : 0);
-		run_sql(insertquery);
-	}
+		feed->link(),
+		feed->title_raw(),
+		feed->is_rtl() ? 1 : 0);
+
+	sqlite3_int64 feed_id = 0;
+	run_prepared("SELECT id FROM rss_feed WHERE rssurl = ?;",
+		[&](sqlite3_stmt* stmt) {
+			feed_id = sqlite3_column_int64(stmt, 0);
+		},
+		feed->rssurl());
 
 	unsigned int max_items = cfg->get_configvalue_as_int("max-items");
 
@@ -524,9 +1817,11 @@ void Cache::externalize_rssfeed(std::shared_ptr<RssFeed> feed,
 		max_items,
 		feed->total_item_count());
 
+	// Items past `max-items` would be deleted again by
+	// delete_expired_items() below, so they aren't written at all.
+	auto end = feed->items().end();
 	if (max_items > 0 && feed->total_item_count() > max_items) {
-		feed->erase_items(
-			feed->items().begin() + max_items, feed->items().end());
+		end = feed->items().begin() + max_items;
 	}
 
 	unsigned int days = cfg->get_configvalue_as_int("keep-articles-days");
@@ -534,58 +1829,335 @@ void Cache::externalize_rssfeed(std::shared_ptr<RssFeed> feed,
 
 	// the reverse iterator is there for the sorting foo below (think about
 	// it)
-	for (auto it = feed->items().rbegin(); it != feed->items().rend();
+	for (auto it = std::reverse_iterator<decltype(end)>(end);
+		it != feed->items().rend();
 		++it) {
 		if (days == 0 || (*it)->pubDate_timestamp() >= old_time)
 			update_rssitem_unlocked(
-				*it, feed->rssurl(), reset_unread);
+				*it, feed->rssurl(), feed_id, reset_unread);
+	}
+
+	delete_expired_items(feed_id);
+
+	dbtrans.commit();
+}
+
+/* Deletes the feed's articles that are older than `keep-articles-days`, and
+ * unflagged ones that are past the newest `max-items`. Runs as part of
+ * externalize_rssfeed(), so the cache never holds more than the limits
+ * allow, and reading feeds doesn't have to delete anything. */
+void Cache::delete_expired_items(sqlite3_int64 feed_id)
+{
+	unsigned int days = cfg->get_configvalue_as_int("keep-articles-days");
+	if (days > 0) {
+		time_t old_date = time(nullptr) - days * 24 * 60 * 60;
+
+		LOG(Level::DEBUG,
+			"Cache::delete_expired_items: about to delete articles "
+			"with a pubDate older than %d",
+			old_date);
+		run_prepared(
+			"DELETE FROM rss_item WHERE feed_id = ? AND pubDate < ?;",
+			nullptr,
+			feed_id,
+			old_date);
+		if (!archive_file.empty()) {
+			run_prepared(
+				"DELETE FROM archive.rss_item "
+				"WHERE feed_id = ? AND pubDate < ?;",
+				nullptr,
+				feed_id,
+				old_date);
+		}
+	}
+
+	unsigned int max_items = cfg->get_configvalue_as_int("max-items");
+	if (max_items > 0) {
+		// Same order as the one internalize_rssfeed() reads items in
+		run_prepared(
+			"DELETE FROM rss_item "
+			"WHERE feed_id = ?1 AND deleted = 0 "
+			"AND (flags IS NULL OR flags = '') "
+			"AND id NOT IN (SELECT id FROM rss_item "
+			"WHERE feed_id = ?1 AND deleted = 0 "
+			"ORDER BY pubDate DESC, id DESC LIMIT ?2);",
+			nullptr,
+			feed_id,
+			max_items);
+	}
+}
+
+/* Deletes articles older than `keep-articles-days` from every feed. Reloads
+ * only do that for the feeds they write, so this catches the ones that
+ * failed, weren't due or aren't in the urls file anymore. Runs once, when the
+ * cache is opened. */
+void Cache::delete_old_articles()
+{
+	const unsigned int days =
+		cfg->get_configvalue_as_int("keep-articles-days");
+	if (days == 0) {
+		return;
 	}
+	const time_t old_date = time(nullptr) - days * 24 * 60 * 60;
+	LOG(Level::DEBUG,
+		"Cache::delete_old_articles: about to delete articles with a "
+		"pubDate older than %d",
+		old_date);
+
+	ScopeTransaction dbtrans(db);
+	run_prepared("DELETE FROM rss_item WHERE pubDate < ?;",
+		nullptr,
+		old_date);
+	if (!archive_file.empty()) {
+		run_prepared("DELETE FROM archive.rss_item WHERE pubDate < ?;",
+			nullptr,
+			old_date);
+	}
+	dbtrans.commit();
+}
+
+// this function reads an RssFeed including all of its RssItems.
+// the feed parameter needs to have the rssurl member set.
+std::shared_ptr<RssFeed> Cache::internalize_rssfeed(std::string rssurl,
+	RssIgnores* ign)
+{
+	ScopeMeasure m1("Cache::internalize_rssfeed");
+
+	std::shared_ptr<RssFeed> feed(new RssFeed(this));
+	feed->set_rssurl(rssurl);
+
+	if (utils::is_query_url(rssurl)) {
+		return feed;
+	}
+
+	std::lock_guard<std::mutex> feedlock(feed->item_mutex);
+
+	/* first, we read the feed from the database (if it's there at all) */
+	bool feed_found = false;
+	run_read(
+		"SELECT title, url, is_rtl FROM rss_feed WHERE rssurl = ?;",
+		[&](sqlite3_stmt* stmt) {
+			feed_found = true;
+			feed->set_title(column_string(stmt, 0));
+			feed->set_link(column_string(stmt, 1));
+			feed->set_rtl(sqlite3_column_int(stmt, 2) == 1);
+		},
+		rssurl);
+
+	if (!feed_found) {
+		return feed;
+	}
+
+	/* ...and then the associated items */
+	ItemsRead read(*this);
+	run_read(read,
+		"SELECT " RSSITEM_COLUMNS
+		"FROM rss_item "
+		"WHERE feed_id = "
+		"(SELECT id FROM rss_feed WHERE rssurl = ?) "
+		"AND deleted = 0 "
+		"ORDER BY pubDate DESC, id DESC;",
+		[&](sqlite3_stmt* stmt) { feed->add_item(read_rssitem(stmt)); },
+		rssurl);
+
+	prepare_internalized_feed(feed, ign, read);
+	return feed;
+}
+
+static std::string feed_loading_error(const std::string& rssurl,
+	const std::string& error)
+{
+	return strprintf::fmt(
+		_("Error while loading feed '%s': %s"), rssurl, error);
+}
+
+static std::shared_ptr<RssFeed> new_feed_for_url(Cache* cache,
+	const std::string& rssurl)
+{
+	std::shared_ptr<RssFeed> feed(new RssFeed(cache));
+	try {
+		feed->set_rssurl(rssurl);
+	} catch (const std::string& str) {
+		throw feed_loading_error(rssurl, str);
+	}
+	return feed;
+}
+
+// this function reads all feeds with given URLs, and their items, in a single
+// pass over the database. Feeds are returned in the same order as the URLs.
+std::vector<std::shared_ptr<RssFeed>> Cache::internalize_rssfeeds(
+	const std::vector<std::string>& rssurls,
+	RssIgnores* ign)
+{
+	ScopeMeasure m1("Cache::internalize_rssfeeds");
+
+	std::vector<std::shared_ptr<RssFeed>> feeds;
+	std::unordered_map<std::string, std::shared_ptr<RssFeed>> feeds_by_url;
+	for (const auto& rssurl : rssurls) {
+		if (feeds_by_url.count(rssurl) > 0) {
+			// Each URL gets its own RssFeed object, but it's rare
+			// enough to not complicate the scans below for it.
+			try {
+				feeds.push_back(
+					internalize_rssfeed(rssurl, ign));
+			} catch (const std::string& str) {
+				throw feed_loading_error(rssurl, str);
+			}
+			continue;
+		}
+
+		const auto feed = new_feed_for_url(this, rssurl);
+		feeds.push_back(feed);
+		if (!utils::is_query_url(rssurl)) {
+			feeds_by_url.emplace(rssurl, feed);
+		}
+	}
+
+	// The feeds aren't shared with anyone yet, so it's safe to fill them
+	// without holding their item_mutex.
+	std::unordered_set<std::string> found_urls;
+	run_read("SELECT rssurl, title, url, is_rtl FROM rss_feed;",
+		[&](sqlite3_stmt* stmt) {
+			const auto it = feeds_by_url.find(column_string(stmt, 0));
+			if (it == feeds_by_url.end()) {
+				return;
+			}
+			found_urls.insert(it->first);
+			it->second->set_title(column_string(stmt, 1));
+			it->second->set_link(column_string(stmt, 2));
+			it->second->set_rtl(sqlite3_column_int(stmt, 3) == 1);
+		});
+	m1.stopover("reading feeds");
+
+	std::shared_ptr<RssFeed> current_feed;
+	ItemsRead read(*this);
+	run_read(read,
+		"SELECT " RSSITEM_COLUMNS
+		"FROM rss_item "
+		"WHERE deleted = 0 "
+		"ORDER BY feed_id, pubDate DESC, id DESC;",
+		[&](sqlite3_stmt* stmt) {
+			const auto item = read_rssitem(stmt);
+			if (!current_feed ||
+				current_feed->rssurl() != item->feedurl()) {
+				const auto it = feeds_by_url.find(item->feedurl());
+				if (it == feeds_by_url.end() ||
+					found_urls.count(it->first) == 0) {
+					current_feed = nullptr;
+					return;
+				}
+				current_feed = it->second;
+			}
+			current_feed->add_item(item);
+		});
+	m1.stopover("reading items");
+
+	for (const auto& entry : feeds_by_url) {
+		std::lock_guard<std::mutex> feedlock(entry.second->item_mutex);
+		prepare_internalized_feed(entry.second, ign, read);
+	}
+	m1.stopover("filtering items");
+
+	return feeds;
+}
+
+// this function reads feeds with given URLs, but only counts their items.
+// The items are read by internalize_rssitems() once a feed needs them.
+std::vector<std::shared_ptr<RssFeed>> Cache::internalize_rssfeed_counts(
+	const std::vector<std::string>& rssurls,
+	RssIgnores* ign)
+{
+	ScopeMeasure m1("Cache::internalize_rssfeed_counts");
+
+	struct FeedRow {
+		std::string title;
+		std::string link;
+		bool is_rtl;
+	};
+	std::unordered_map<std::string, FeedRow> feed_rows;
+	run_read("SELECT rssurl, title, url, is_rtl FROM rss_feed;",
+		[&](sqlite3_stmt* stmt) {
+			feed_rows[column_string(stmt, 0)] = FeedRow{
+				column_string(stmt, 1),
+				column_string(stmt, 2),
+				sqlite3_column_int(stmt, 3) == 1};
+		});
+
+	const auto counts = get_feed_counts();
+	const unsigned int max_items = cfg->get_configvalue_as_int("max-items");
+
+	std::vector<std::shared_ptr<RssFeed>> feeds;
+	for (const auto& rssurl : rssurls) {
+		const auto feed = new_feed_for_url(this, rssurl);
+		feeds.push_back(feed);
+		if (feed->is_query_feed()) {
+			continue;
+		}
+
+		const auto row = feed_rows.find(rssurl);
+		if (row != feed_rows.end()) {
+			feed->set_title(row->second.title);
+			feed->set_link(row->second.link);
+			feed->set_rtl(row->second.is_rtl);
+		}
+		const auto count = counts.find(rssurl);
+		if (row == feed_rows.end() || count == counts.end()) {
+			feed->set_lazy_items(ign, 0, 0);
+			continue;
+		}
+		feed->set_lazy_items(
+			ign, count->second.unread, count->second.total);
+
+		// The stored counts include articles that ignores or
+		// `max-items` hide, so such feeds have to be loaded to be
+		// counted right.
+		if ((ign && ign->has_rules_for(rssurl)) ||
+			(max_items > 0 && count->second.total > max_items)) {
+			feed->load_items();
+		}
+	}
+
+	return feeds;
 }
 
-// this function reads an RssFeed including all of its RssItems.
-// the feed parameter needs to have the rssurl member set.
-std::shared_ptr<RssFeed> Cache::internalize_rssfeed(std::string rssurl,
+// this function reads the items of a feed, like internalize_rssfeed() does,
+// for RssFeed objects that were created by internalize_rssfeed_counts().
+std::vector<std::shared_ptr<RssItem>> Cache::internalize_rssitems(
+	const std::string& rssurl,
 	RssIgnores* ign)
 {
-	ScopeMeasure m1("Cache::internalize_rssfeed");
+	ScopeMeasure m1("Cache::internalize_rssitems");
 
 	std::shared_ptr<RssFeed> feed(new RssFeed(this));
 	feed->set_rssurl(rssurl);
 
-	if (utils::is_query_url(rssurl)) {
-		return feed;
-	}
-
-	std::lock_guard<std::mutex> lock(mtx);
 	std::lock_guard<std::mutex> feedlock(feed->item_mutex);
-
-	/* first, we check whether the feed is there at all */
-	std::string query = prepare_query(
-		"SELECT count(*) FROM rss_feed WHERE rssurl = '%q';", rssurl);
-	CbHandler count_cbh;
-	run_sql(query, count_callback, &count_cbh);
-
-	if (count_cbh.count() == 0) {
-		return feed;
-	}
-
-	/* then we first read the feed from the database */
-	query = prepare_query(
-		"SELECT title, url, is_rtl FROM rss_feed WHERE rssurl = '%q';",
-		rssurl);
-	run_sql(query, rssfeed_callback, &feed);
-
-	/* ...and then the associated items */
-	query = prepare_query(
-		"SELECT guid, title, author, url, pubDate, length(content), "
-		"unread, "
-		"feedurl, enclosure_url, enclosure_type, enqueued, flags, base "
+	ItemsRead read(*this);
+	run_read(read,
+		"SELECT " RSSITEM_COLUMNS
 		"FROM rss_item "
-		"WHERE feedurl = '%q' "
+		"WHERE feed_id = "
+		"(SELECT id FROM rss_feed WHERE rssurl = ?) "
 		"AND deleted = 0 "
 		"ORDER BY pubDate DESC, id DESC;",
+		[&](sqlite3_stmt* stmt) { feed->add_item(read_rssitem(stmt)); },
 		rssurl);
-	run_sql(query, rssitem_callback, &feed);
+
+	prepare_internalized_feed(feed, ign, read);
+
+	return feed->items();
+}
+
+/* Applies ignores, `max-items` limit and sort order to the items that were
+ * just read into the feed. The cache is trimmed to the limit whenever the feed
+ * is written, so unflagged items over it only show up here if the limit was
+ * lowered since; they're dropped from the feed, and deleted from the cache on
+ * the next reload. The caller must hold feed's item_mutex. */
+void Cache::prepare_internalized_feed(std::shared_ptr<RssFeed> feed,
+	RssIgnores* ign,
+	const ItemsRead& read)
+{
+	apply_pending_changes(feed->items(), read);
 
 	std::vector<std::shared_ptr<RssItem>> filtered_items;
 	for (const auto& item : feed->items()) {
@@ -610,9 +2182,7 @@ std::shared_ptr<RssFeed> Cache::internalize_rssfeed(std::string rssurl,
 		std::vector<std::shared_ptr<RssItem>> flagged_items;
 		for (unsigned int j = max_items; j < feed->total_item_count();
 			++j) {
-			if (feed->items()[j]->flags().length() == 0) {
-				delete_item(feed->items()[j]);
-			} else {
+			if (feed->items()[j]->flags().length() != 0) {
 				flagged_items.push_back(feed->items()[j]);
 			}
 		}
@@ -625,49 +2195,88 @@ std::shared_ptr<RssFeed> Cache::internalize_rssfeed(std::string rssurl,
 		feed->add_items(flagged_items);
 	}
 	feed->sort_unlocked(cfg->get_article_sort_strategy());
-	return feed;
+}
+
+/* Turns the user's search phrase into an FTS5 query that matches articles
+ * containing the phrase, with its last word possibly being incomplete. */
+static std::string fts_query(const std::string& querystr)
+{
+	return "\"" + utils::replace_all(querystr, "\"", "\"\"") + "\"*";
+}
+
+/* The FTS5 tokenizer drops punctuation, so the index would look "c++" up as
+ * "c" and find every word that starts with it. Only phrases made of words and
+ * spaces are looked up in the index; the rest are searched for with LIKE. */
+static bool is_fts_phrase(const std::string& querystr)
+{
+	const auto is_word_char = [](char c) {
+		return std::isalnum(static_cast<unsigned char>(c)) ||
+			static_cast<unsigned char>(c) >= 0x80;
+	};
+	return std::any_of(querystr.begin(), querystr.end(), is_word_char) &&
+		std::all_of(querystr.begin(), querystr.end(), [&](char c) {
+			return is_word_char(c) ||
+				std::isspace(static_cast<unsigned char>(c));
+		});
 }
 
 std::vector<std::shared_ptr<RssItem>>
 Cache::search_for_items(const std::string& querystr, const std::string& feedurl)
 {
 	assert(!utils::is_query_url(feedurl));
-	std::string query;
 	std::vector<std::shared_ptr<RssItem>> items;
+	const auto add_item = [&](sqlite3_stmt* stmt) {
+		items.push_back(read_rssitem(stmt));
+	};
+	const bool by_relevance =
+		cfg->get_configvalue("search-result-order") == "relevance";
+
+	// Finds matches in one of the tables; both are searched when articles
+	// were archived
+	const bool use_fts = fts_enabled && is_fts_phrase(querystr);
+	const auto search_in = [&](const std::string& schema) {
+		std::string query = "SELECT " RSSITEM_COLUMNS
+				    ", id, matches.rank AS rank FROM " +
+			schema + "rss_item ";
+		if (use_fts) {
+			query += "JOIN (SELECT rowid, rank FROM " + schema +
+				"rss_item_fts WHERE rss_item_fts MATCH ?1) "
+				"AS matches ON id = matches.rowid ";
+		} else {
+			query += "JOIN (SELECT ?1 AS pattern, 0 AS rank) "
+				 "AS matches "
+				 "ON (title LIKE pattern "
+				 "OR content_text(content, content_format) "
+				 "LIKE pattern) ";
+		}
+		query += "WHERE deleted = 0 ";
+		if (feedurl.length() > 0) {
+			query += "AND feed_id = "
+				 "(SELECT id FROM rss_feed WHERE rssurl = ?2) ";
+		}
+		return query;
+	};
+	const std::string match =
+		use_fts ? fts_query(querystr) : "%" + querystr + "%";
+
+	std::string query = "SELECT " RSSITEM_COLUMNS "FROM (" + search_in("");
+	if (!archive_file.empty()) {
+		query += "UNION ALL " + search_in("archive.");
+	}
+	query += by_relevance ? ") ORDER BY rank, pubDate DESC, id DESC;"
+			      : ") ORDER BY pubDate DESC, id DESC;";
 
-	std::lock_guard<std::mutex> lock(mtx);
+	ItemsRead read(*this);
 	if (feedurl.length() > 0) {
-		query = prepare_query(
-			"SELECT guid, title, author, url, pubDate, "
-			"length(content), "
-			"unread, feedurl, enclosure_url, enclosure_type, "
-			"enqueued, flags, base "
-			"FROM rss_item "
-			"WHERE (title LIKE '%%%q%%' OR content LIKE '%%%q%%') "
-			"AND feedurl = '%q' "
-			"AND deleted = 0 "
-			"ORDER BY pubDate DESC, id DESC;",
-			querystr,
-			querystr,
-			feedurl);
+		run_read(read, query, add_item, match, feedurl);
 	} else {
-		query = prepare_query(
-			"SELECT guid, title, author, url, pubDate, "
-			"length(content), "
-			"unread, feedurl, enclosure_url, enclosure_type, "
-			"enqueued, flags, base "
-			"FROM rss_item "
-			"WHERE (title LIKE '%%%q%%' OR content LIKE '%%%q%%') "
-			"AND deleted = 0 "
-			"ORDER BY pubDate DESC,  id DESC;",
-			querystr,
-			querystr);
-	}
-
-	run_sql(query, search_item_callback, &items);
+		run_read(read, query, add_item, match);
+	}
+
 	for (const auto& item : items) {
 		item->set_cache(this);
 	}
+	apply_pending_changes(items, read);
 
 	return items;
 }
@@ -676,43 +2285,241 @@ std::unordered_set<std::string> Cache::search_in_items(
 	const std::string& querystr,
 	const std::unordered_set<std::string>& guids)
 {
-	std::string list = "(";
-
-	for (const auto& guid : guids) {
-		list.append(prepare_query("%Q, ", guid));
+	if (guids.empty()) {
+		return {};
 	}
-	list.append("'')");
 
-	std::string query = prepare_query(
-		"SELECT guid "
-		"FROM rss_item "
-		"WHERE (title LIKE '%%%q%%' OR content LIKE '%%%q%%') "
-		"AND guid IN %s;",
-		querystr,
-		querystr,
-		list);
+	const bool use_fts = fts_enabled && is_fts_phrase(querystr);
+	const auto search_in = [&](const std::string& schema) {
+		std::string query = "SELECT guid FROM " + schema + "rss_item ";
+		if (use_fts) {
+			query += "WHERE id IN (SELECT rowid FROM " + schema +
+				"rss_item_fts WHERE rss_item_fts MATCH ?1) ";
+		} else {
+			query += "WHERE (title LIKE ?1 "
+				 "OR content_text(content, content_format) "
+				 "LIKE ?1) ";
+		}
+		return query +
+			"AND (guid_hash, guid) IN "
+			"(SELECT key_hash, key FROM temp.key_set) ";
+	};
+	const std::string match =
+		use_fts ? fts_query(querystr) : "%" + querystr + "%";
+
+	std::string query = search_in("");
+	if (!archive_file.empty()) {
+		query += "UNION ALL " + search_in("archive.");
+	}
+	query += ";";
 
 	std::unordered_set<std::string> items;
-	std::lock_guard<std::mutex> lock(mtx);
-	run_sql(query, guid_callback, &items);
+	run_read_with_keys(guids,
+		query,
+		[&](sqlite3_stmt* stmt) { items.insert(column_string(stmt, 0)); },
+		match);
 	return items;
 }
 
-void Cache::delete_item(const std::shared_ptr<RssItem>& item)
+void Cache::do_vacuum()
 {
-	std::string query = prepare_query(
-		"DELETE FROM rss_item WHERE guid = '%q';", item->guid());
-	run_sql(query);
+	std::lock_guard<std::mutex> lock(mtx);
+	// The auto_vacuum setting of an existing database only changes when
+	// it's rebuilt, so this also turns on incremental vacuum for caches
+	// that were created without it.
+	run_sql("PRAGMA auto_vacuum = INCREMENTAL;");
+	run_sql("VACUUM;");
+	if (!archive_file.empty()) {
+		run_sql("VACUUM archive;");
+	}
+	incremental_vacuum = true;
 }
 
-void Cache::do_vacuum()
+StorageStats Cache::get_storage_stats()
 {
 	std::lock_guard<std::mutex> lock(mtx);
-	run_sql("VACUUM;");
+	return get_storage_stats_unlocked();
+}
+
+StorageStats Cache::get_storage_stats_unlocked()
+{
+	StorageStats stats{0, 0, 0};
+	run_prepared("PRAGMA page_size;", [&](sqlite3_stmt* stmt) {
+		stats.page_size = sqlite3_column_int64(stmt, 0);
+	});
+	run_prepared("PRAGMA page_count;", [&](sqlite3_stmt* stmt) {
+		stats.pages = sqlite3_column_int64(stmt, 0);
+	});
+	run_prepared("PRAGMA freelist_count;", [&](sqlite3_stmt* stmt) {
+		stats.free_pages = sqlite3_column_int64(stmt, 0);
+	});
+	return stats;
+}
+
+std::vector<std::pair<std::string, QueryStats>> Cache::get_query_stats()
+{
+	std::vector<std::pair<std::string, QueryStats>> result;
+	{
+		std::lock_guard<std::mutex> lock(stats_mtx);
+		result.assign(query_stats.begin(), query_stats.end());
+	}
+	using Entry = std::pair<std::string, QueryStats>;
+	std::sort(result.begin(),
+		result.end(),
+		[](const Entry& a, const Entry& b) {
+			return a.second.total_time > b.second.total_time;
+		});
+	return result;
+}
+
+/* Logs the queries that took the most time so far, unless nothing was run
+ * since the last time. */
+void Cache::log_query_stats()
+{
+	{
+		std::lock_guard<std::mutex> lock(stats_mtx);
+		if (!query_stats_changed) {
+			return;
+		}
+		query_stats_changed = false;
+	}
+
+	const auto stats = get_query_stats();
+	const size_t count = std::min<size_t>(stats.size(), LOGGED_QUERIES);
+	for (size_t i = 0; i < count; ++i) {
+		const QueryStats& entry = stats[i].second;
+		LOG(Level::INFO,
+			"Cache::log_query_stats: %" PRIu64 " calls, %" PRIu64
+			" us total, %" PRIu64 " us max, %" PRIu64
+			" rows returned, %" PRIu64 " rows changed: %s",
+			entry.calls,
+			entry.total_time / 1000,
+			entry.max_time / 1000,
+			entry.rows_returned,
+			entry.rows_changed,
+			stats[i].first);
+	}
+}
+
+/* Gives up to `max_pages` free pages back to the file system. Unlike
+ * do_vacuum(), this doesn't rewrite the database, so it's quick enough to run
+ * while Newsboat is in use. Returns the number of pages that were freed. */
+unsigned int Cache::compact(unsigned int max_pages)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return compact_unlocked(max_pages);
+}
+
+unsigned int Cache::compact_unlocked(unsigned int max_pages)
+{
+	if (!incremental_vacuum) {
+		return 0;
+	}
+
+	const StorageStats before = get_storage_stats_unlocked();
+	if (before.free_pages == 0) {
+		return 0;
+	}
+
+	ScopeMeasure m1("Cache::compact");
+	run_sql("PRAGMA incremental_vacuum(" + std::to_string(max_pages) +
+		");");
+
+	const StorageStats after = get_storage_stats_unlocked();
+	LOG(Level::INFO,
+		"Cache::compact: %" PRIu64 " bytes with %" PRIu64
+		" free pages before, %" PRIu64 " bytes with %" PRIu64
+		" free pages after",
+		before.pages * before.page_size,
+		before.free_pages,
+		after.pages * after.page_size,
+		after.free_pages);
+	return before.pages - after.pages;
+}
+
+/* Moves up to `max_items` articles that are read, not flagged and older than
+ * `archive-articles-days` from the cache to the archive. Reading feeds then
+ * doesn't have to go past them, but they can still be found by searches.
+ * Returns the number of articles that were moved. */
+unsigned int Cache::archive_old_items(unsigned int max_items)
+{
+	flush_pending_changes();
+	std::lock_guard<std::mutex> lock(mtx);
+	return archive_old_items_unlocked(max_items);
+}
+
+unsigned int Cache::archive_old_items_unlocked(unsigned int max_items)
+{
+	const unsigned int days =
+		cfg->get_configvalue_as_int("archive-articles-days");
+	if (days == 0 || archive_file.empty()) {
+		return 0;
+	}
+	const time_t old_date = time(nullptr) - days * 24 * 60 * 60;
+
+	const std::string old_items =
+		"(SELECT id FROM main.rss_item "
+		"WHERE unread = 0 AND deleted = 0 "
+		"AND (flags IS NULL OR flags = '') AND pubDate < ?1 "
+		"ORDER BY id LIMIT ?2)";
+	ScopeTransaction dbtrans(db);
+	// The cache and the archive are separate files, so a crash can leave
+	// an article in both. The archive's copy is deleted first, so that its
+	// trigger takes it out of the full-text index; REPLACE wouldn't fire it
+	run_prepared("DELETE FROM archive.rss_item WHERE id IN " + old_items +
+			";",
+		nullptr,
+		old_date,
+		max_items);
+	run_prepared("INSERT INTO archive.rss_item "
+		     "(" ARCHIVED_COLUMNS ") "
+		     "SELECT " ARCHIVED_COLUMNS "FROM main.rss_item "
+		     "WHERE id IN " +
+			old_items + ";",
+		nullptr,
+		old_date,
+		max_items);
+	const unsigned int moved = sqlite3_changes(db);
+	run_prepared("DELETE FROM main.rss_item WHERE id IN " + old_items +
+			";",
+		nullptr,
+		old_date,
+		max_items);
+	dbtrans.commit();
+
+	if (moved > 0) {
+		LOG(Level::INFO,
+			"Cache::archive_old_items: moved %u articles to the "
+			"archive",
+			moved);
+	}
+	return moved;
+}
+
+/* Moves the archived articles whose GUIDs are in temp.key_set back to the
+ * cache, so that they can be changed. They keep their ids, which the cache
+ * never hands out again. Must be called with `mtx` held, inside a
+ * transaction. */
+void Cache::restore_archived_items()
+{
+	run_prepared("INSERT OR IGNORE INTO main.rss_item "
+		     "(" ARCHIVED_COLUMNS ") "
+		     "SELECT " ARCHIVED_COLUMNS "FROM archive.rss_item "
+		     "WHERE (guid_hash, guid) IN "
+		     "(SELECT key_hash, key FROM temp.key_set);",
+		nullptr);
+	run_prepared("DELETE FROM archive.rss_item "
+		     "WHERE (guid_hash, guid) IN "
+		     "(SELECT key_hash, key FROM temp.key_set);",
+		nullptr);
 }
 
 void Cache::cleanup_cache(std::vector<std::shared_ptr<RssFeed>>& feeds)
 {
+	// No writes can happen once `mtx` is locked below, so write the queued
+	// changes and don't take any more
+	stop_changes_writer();
+
 	mtx.lock(); // we don't use the std::lock_guard<> here... see comments
 		    // below
 
@@ -730,35 +2537,40 @@ void Cache::cleanup_cache(std::vector<std::shared_ptr<RssFeed>>& feeds)
 	 */
 	if (cfg->get_configvalue_as_bool("cleanup-on-quit")) {
 		LOG(Level::DEBUG, "Cache::cleanup_cache: cleaning up cache...");
-		std::string list = "(";
-
+		std::vector<std::string> feedurls;
 		for (const auto& feed : feeds) {
-			std::string name =
-				prepare_query("'%q'", feed->rssurl());
-			list.append(name);
-			list.append(", ");
+			feedurls.push_back(feed->rssurl());
 		}
-		list.append("'')");
-
-		std::string cleanup_rss_feeds_statement(
-			"DELETE FROM rss_feed WHERE rssurl NOT IN ");
-		cleanup_rss_feeds_statement.append(list);
-		cleanup_rss_feeds_statement.append(1, ';');
-
-		std::string cleanup_rss_items_statement(
-			"DELETE FROM rss_item WHERE feedurl NOT IN ");
-		cleanup_rss_items_statement.append(list);
-		cleanup_rss_items_statement.append(1, ';');
 
-		std::string cleanup_read_items_statement(
-			"UPDATE rss_item SET deleted = 1 WHERE unread = 0");
-
-		run_sql(cleanup_rss_feeds_statement);
-		run_sql(cleanup_rss_items_statement);
+		ScopeTransaction dbtrans(db);
+		fill_key_set(db, statements, feedurls);
+		run_sql("DELETE FROM rss_item "
+			"WHERE feed_id IN "
+			"(SELECT id FROM rss_feed "
+			"WHERE rssurl NOT IN (SELECT key FROM temp.key_set));");
+		if (!archive_file.empty()) {
+			run_sql("DELETE FROM archive.rss_item "
+				"WHERE feed_id IN "
+				"(SELECT id FROM rss_feed "
+				"WHERE rssurl NOT IN "
+				"(SELECT key FROM temp.key_set));");
+		}
+		run_sql("DELETE FROM rss_feed "
+			"WHERE rssurl NOT IN (SELECT key FROM temp.key_set);");
+		run_sql("DELETE FROM rss_feed_counts "
+			"WHERE feedurl NOT IN (SELECT key FROM temp.key_set);");
 		if (cfg->get_configvalue_as_bool(
 			    "delete-read-articles-on-quit")) {
-			run_sql(cleanup_read_items_statement);
+			run_sql("UPDATE rss_item SET deleted = 1 "
+				"WHERE unread = 0");
+			// They have to stay in the archive, too, or the next
+			// reload would bring them back as new articles
+			if (!archive_file.empty()) {
+				run_sql("UPDATE archive.rss_item "
+					"SET deleted = 1;");
+			}
 		}
+		dbtrans.commit();
 
 		// WARNING: THE MISSING UNLOCK OPERATION IS MISSING FOR A
 		// PURPOSE! It's missing so that no database operation can occur
@@ -771,152 +2583,207 @@ void Cache::cleanup_cache(std::vector<std::shared_ptr<RssFeed>>& feeds)
 
 void Cache::update_rssitem_unlocked(std::shared_ptr<RssItem> item,
 	const std::string& feedurl,
+	sqlite3_int64 feed_id,
 	bool reset_unread)
 {
-	std::string query = prepare_query(
-		"SELECT count(*) FROM rss_item WHERE guid = '%q';",
-		item->guid());
-	CbHandler count_cbh;
-	run_sql(query, count_callback, &count_cbh);
-	if (count_cbh.count() > 0) {
-		if (reset_unread) {
-			std::string content;
-			query = prepare_query(
-				"SELECT content FROM rss_item WHERE guid = "
-				"'%q';",
-				item->guid());
-			run_sql(query, single_string_callback, &content);
-			if (content != item->description_raw()) {
-				LOG(Level::DEBUG,
-					"Cache::update_rssitem_unlocked: '%s' "
-					"is "
-					"different from '%s'",
-					content,
-					item->description_raw());
-				query = prepare_query(
-					"UPDATE rss_item SET unread = 1 WHERE "
-					"guid = '%q';",
-					item->guid());
-				run_sql(query);
-			}
+	const sqlite3_int64 hash = guid_hash(item->guid());
+	const std::string description = item->description_raw();
+	const sqlite3_int64 fingerprint =
+		item_fingerprint(*item, feedurl, feed_id, description);
+	const sqlite3_int64 content_hash = text_hash(description);
+
+	bool found = false;
+	sqlite3_int64 id = 0;
+	sqlite3_int64 stored_fingerprint = 0;
+	sqlite3_int64 stored_content_hash = 0;
+	const auto find_stored = [&](const std::string& schema) {
+		run_prepared("SELECT id, fingerprint, content_hash FROM " +
+				schema +
+				"rss_item "
+				"WHERE guid_hash = ? AND guid = ?;",
+			[&](sqlite3_stmt* stmt) {
+				found = true;
+				id = sqlite3_column_int64(stmt, 0);
+				stored_fingerprint =
+					sqlite3_column_int64(stmt, 1);
+				stored_content_hash =
+					sqlite3_column_int64(stmt, 2);
+			},
+			hash,
+			item->guid());
+	};
+	find_stored("");
+
+	if (!found && !archive_file.empty()) {
+		// Archived articles stay where they are, unless the feed
+		// changed them or wants them unread again
+		find_stored("archive.");
+		if (found && fingerprint == stored_fingerprint &&
+			!(item->override_unread() && item->unread())) {
+			return;
 		}
-		std::string update;
-		if (item->override_unread()) {
-			update = prepare_query(
-				"UPDATE rss_item "
-				"SET title = '%q', author = '%q', url = '%q', "
-				"feedurl = '%q', "
-				"content = '%q', enclosure_url = '%q', "
-				"enclosure_type = '%q', base = '%q', unread = "
-				"'%d' "
-				"WHERE guid = '%q'",
-				item->title_raw(),
-				item->author_raw(),
-				item->link(),
-				feedurl,
-				item->description_raw(),
-				item->enclosure_url(),
-				item->enclosure_type(),
-				item->get_base(),
-				(item->unread() ? 1 : 0),
-				item->guid());
-		} else {
-			update = prepare_query(
-				"UPDATE rss_item "
-				"SET title = '%q', author = '%q', url = '%q', "
-				"feedurl = '%q', "
-				"content = '%q', enclosure_url = '%q', "
-				"enclosure_type = '%q', base = '%q' "
-				"WHERE guid = '%q'",
-				item->title_raw(),
-				item->author_raw(),
-				item->link(),
-				feedurl,
-				item->description_raw(),
-				item->enclosure_url(),
-				item->enclosure_type(),
-				item->get_base(),
-				item->guid());
+		if (found) {
+			fill_key_set(db,
+				statements,
+				std::vector<std::string>{item->guid()});
+			restore_archived_items();
 		}
-		run_sql(update);
-	} else {
-		std::string insert = prepare_query(
-			"INSERT INTO rss_item (guid, title, author, url, "
-			"feedurl, "
-			"pubDate, content, unread, enclosure_url, "
-			"enclosure_type, enqueued, base) "
-			"VALUES "
-			"('%q','%q','%q','%q','%q','%u','%q','%d','%q','%q',%d,"
-			" "
-			"'%q')",
+	}
+
+	if (!found) {
+		const StoredContent content = store_content(description,
+				cfg->get_configvalue_as_bool("compress-cache"));
+		run_prepared(
+			"INSERT INTO rss_item (guid, guid_hash, title, author, "
+			"url, feedurl, feed_id, pubDate, content, "
+			"content_format, content_length, content_hash, "
+			"fingerprint, unread, enclosure_url, enclosure_type, "
+			"enqueued, base) "
+			"VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, length(?), ?, ?, "
+			"?, ?, ?, ?, ?);",
+			nullptr,
 			item->guid(),
+			hash,
 			item->title_raw(),
 			item->author_raw(),
 			item->link(),
 			feedurl,
+			feed_id,
 			item->pubDate_timestamp(),
-			item->description_raw(),
-			(item->unread() ? 1 : 0),
+			content,
+			content.format,
+			description,
+			content_hash,
+			fingerprint,
+			item->unread() ? 1 : 0,
 			item->enclosure_url(),
 			item->enclosure_type(),
 			item->enqueued() ? 1 : 0,
 			item->get_base());
-		run_sql(insert);
+		return;
+	}
+
+	/* Most reloads bring back the same articles, and there's no point in
+	 * rewriting them. "unread" is only touched if we were asked to
+	 * override it, or if reset_unread is set and the content changed.
+	 * pubDate and "enqueued" always keep their stored values. */
+	if (fingerprint == stored_fingerprint) {
+		if (item->override_unread()) {
+			run_prepared("UPDATE rss_item SET unread = ? WHERE id = ?;",
+				nullptr,
+				item->unread() ? 1 : 0,
+				id);
+		}
+		return;
+	}
+
+	const bool content_changed = content_hash != stored_content_hash;
+	run_prepared(
+		"UPDATE rss_item "
+		"SET title = ?, author = ?, url = ?, feedurl = ?, feed_id = ?, "
+		"enclosure_url = ?, enclosure_type = ?, base = ?, "
+		"fingerprint = ?, "
+		"unread = CASE WHEN ? THEN ? WHEN ? THEN 1 ELSE unread END "
+		"WHERE id = ?;",
+		nullptr,
+		item->title_raw(),
+		item->author_raw(),
+		item->link(),
+		feedurl,
+		feed_id,
+		item->enclosure_url(),
+		item->enclosure_type(),
+		item->get_base(),
+		fingerprint,
+		item->override_unread() ? 1 : 0,
+		item->unread() ? 1 : 0,
+		reset_unread && content_changed ? 1 : 0,
+		id);
+
+	if (content_changed) {
+		const StoredContent content = store_content(description,
+				cfg->get_configvalue_as_bool("compress-cache"));
+		run_prepared(
+			"UPDATE rss_item "
+			"SET content = ?, content_format = ?, "
+			"content_length = length(?), content_hash = ? "
+			"WHERE id = ?;",
+			nullptr,
+			content,
+			content.format,
+			description,
+			content_hash,
+			id);
 	}
 }
 
 void Cache::mark_all_read(std::shared_ptr<RssFeed> feed)
 {
+	flush_pending_changes();
 	std::lock_guard<std::mutex> lock(mtx);
 	std::lock_guard<std::mutex> itemlock(feed->item_mutex);
-	std::string query =
-		"UPDATE rss_item SET unread = '0' WHERE unread != '0' AND guid "
-		"IN (";
-
+	std::vector<std::string> guids;
 	for (const auto& item : feed->items()) {
-		query.append(prepare_query("'%q',", item->guid()));
+		guids.push_back(item->guid());
+	}
+	if (guids.empty()) {
+		return;
 	}
-	query.append("'');");
 
-	run_sql(query);
+	ScopeTransaction dbtrans(db);
+	fill_key_set(db, statements, guids);
+	run_prepared(
+		"UPDATE rss_item SET unread = 0 "
+		"WHERE unread = 1 AND (guid_hash, guid) IN "
+		"(SELECT key_hash, key FROM temp.key_set);",
+		nullptr);
+	dbtrans.commit();
 }
 
 /* this function marks all RssItems (optionally of a certain feed url) as read
  */
 void Cache::mark_all_read(const std::string& feedurl)
 {
+	flush_pending_changes();
 	std::lock_guard<std::mutex> lock(mtx);
 
-	std::string query;
 	if (feedurl.length() > 0) {
-		query = prepare_query(
+		run_prepared(
 			"UPDATE rss_item "
-			"SET unread = '0' "
-			"WHERE unread != '0' "
-			"AND feedurl = '%q';",
+			"SET unread = 0 "
+			"WHERE unread = 1 "
+			"AND feed_id = "
+			"(SELECT id FROM rss_feed WHERE rssurl = ?);",
+			nullptr,
 			feedurl);
 	} else {
-		query = prepare_query(
+		run_prepared(
 			"UPDATE rss_item "
-			"SET unread = '0' "
-			"WHERE unread != '0';");
+			"SET unread = 0 "
+			"WHERE unread = 1;",
+			nullptr);
 	}
-	run_sql(query);
 }
 
 void Cache::update_rssitem_unread_and_enqueued(RssItem* item,
 	const std::string& /* feedurl */)
 {
-	std::lock_guard<std::mutex> lock(mtx);
-
-	auto query = prepare_query(
-		"UPDATE rss_item "
-		"SET unread = '%d', enqueued = '%d' "
-		"WHERE guid = '%q'",
-		item->unread() ? 1 : 0,
-		item->enqueued() ? 1 : 0,
-		item->guid());
-	run_sql(query);
+	{
+		std::lock_guard<std::mutex> lock(pending_mtx);
+		if (!accept_changes) {
+			LOG(Level::WARN,
+				"Cache::update_rssitem_unread_and_enqueued: "
+				"cache doesn't accept changes, dropping change "
+				"of %s",
+				item->guid());
+			return;
+		}
+		PendingChange& change = pending_changes[item->guid()];
+		change.state_changed = true;
+		change.unread = item->unread();
+		change.enqueued = item->enqueued();
+	}
+	pending_cv.notify_one();
 }
 
 /* this function updates the unread and enqueued flags */
@@ -926,48 +2793,291 @@ void Cache::update_rssitem_unread_and_enqueued(std::shared_ptr<RssItem> item,
 	update_rssitem_unread_and_enqueued(item.get(), feedurl);
 }
 
-/* helper function to wrap std::string around the sqlite3_*mprintf function */
-std::string Cache::prepare_query(const std::string& format)
+void Cache::update_rssitem_flags(RssItem* item)
 {
-	return format;
+	{
+		std::lock_guard<std::mutex> lock(pending_mtx);
+		if (!accept_changes) {
+			LOG(Level::WARN,
+				"Cache::update_rssitem_flags: cache doesn't "
+				"accept changes, dropping change of %s",
+				item->guid());
+			return;
+		}
+		PendingChange& change = pending_changes[item->guid()];
+		change.flags_changed = true;
+		change.flags = item->flags();
+	}
+	pending_cv.notify_one();
 }
 
-template<typename... Args>
-std::string Cache::prepare_query(const std::string& format,
-	const std::string& argument,
-	Args... args)
+/* Writes all queued changes in a single transaction. Doesn't return until
+ * the changes queued by now are in the database, even if another thread is
+ * writing them. The caller must not hold `mtx`. */
+void Cache::flush_pending_changes()
+{
+	std::lock_guard<std::mutex> flushing(flush_mtx);
+	{
+		std::lock_guard<std::mutex> lock(pending_mtx);
+		if (pending_changes.empty()) {
+			return;
+		}
+		writing_changes.swap(pending_changes);
+	}
+
+	try {
+		ScopeMeasure m1("Cache::flush_pending_changes");
+		std::lock_guard<std::mutex> lock(mtx);
+		ScopeTransaction dbtrans(db);
+		if (!archive_file.empty()) {
+			std::vector<std::string> guids;
+			for (const auto& entry : writing_changes) {
+				guids.push_back(entry.first);
+			}
+			fill_key_set(db, statements, guids);
+			restore_archived_items();
+		}
+		for (const auto& entry : writing_changes) {
+			const std::string& guid = entry.first;
+			const PendingChange& change = entry.second;
+			if (change.state_changed) {
+				run_prepared(
+					"UPDATE rss_item "
+					"SET unread = ?, enqueued = ? "
+					"WHERE guid_hash = ? AND guid = ?;",
+					nullptr,
+					change.unread ? 1 : 0,
+					change.enqueued ? 1 : 0,
+					guid_hash(guid),
+					guid);
+			}
+			if (change.flags_changed) {
+				run_prepared(
+					"UPDATE rss_item SET flags = ? "
+					"WHERE guid_hash = ? AND guid = ?;",
+					nullptr,
+					change.flags,
+					guid_hash(guid),
+					guid);
+			}
+		}
+		dbtrans.commit();
+
+		// Reads that are still running may have taken their snapshot
+		// before the commit, so they still need the batch. It's counted
+		// while `mtx` is held, so that a read on this connection sees
+		// both the commit and the new generation, or neither
+		std::lock_guard<std::mutex> pending_lock(pending_mtx);
+		changes_generation++;
+		if (!active_reads.empty()) {
+			committed_changes.emplace_back(
+				changes_generation, std::move(writing_changes));
+		}
+		writing_changes.clear();
+	} catch (const DbException&) {
+		// Queue the batch again so that the next flush retries it.
+		// Whatever was queued meanwhile is newer and wins.
+		std::lock_guard<std::mutex> lock(pending_mtx);
+		for (const auto& entry : writing_changes) {
+			const PendingChange& failed = entry.second;
+			PendingChange& queued = pending_changes[entry.first];
+			if (failed.state_changed && !queued.state_changed) {
+				queued.state_changed = true;
+				queued.unread = failed.unread;
+				queued.enqueued = failed.enqueued;
+			}
+			if (failed.flags_changed && !queued.flags_changed) {
+				queued.flags_changed = true;
+				queued.flags = failed.flags;
+			}
+		}
+		writing_changes.clear();
+		throw;
+	}
+}
+
+Cache::ItemsRead::ItemsRead(Cache& c)
+	: cache(c)
 {
-	return prepare_query(format, argument.c_str(), args...);
+	std::lock_guard<std::mutex> lock(cache.pending_mtx);
+	read_generation = cache.changes_generation;
+	cache.active_reads.insert(read_generation);
 }
 
-template<typename T, typename... Args>
-std::string
-Cache::prepare_query(const std::string& format, const T& argument, Args... args)
+void Cache::ItemsRead::start()
 {
-	std::string local_format, remaining_format;
-	std::tie(local_format, remaining_format) =
-		strprintf::split_format(format);
+	std::lock_guard<std::mutex> lock(cache.pending_mtx);
+	cache.active_reads.erase(cache.active_reads.find(read_generation));
+	read_generation = cache.changes_generation;
+	cache.active_reads.insert(read_generation);
+}
 
-	char* piece = sqlite3_mprintf(local_format.c_str(), argument);
-	std::string result;
-	if (piece) {
-		result = piece;
-		sqlite3_free(piece);
+Cache::ItemsRead::~ItemsRead()
+{
+	std::lock_guard<std::mutex> lock(cache.pending_mtx);
+	cache.active_reads.erase(cache.active_reads.find(read_generation));
+
+	// Drop the batches that every remaining read has in its snapshot
+	const uint64_t oldest_read = cache.active_reads.empty()
+		? cache.changes_generation
+		: *cache.active_reads.begin();
+	while (!cache.committed_changes.empty() &&
+		cache.committed_changes.front().first <= oldest_read) {
+		cache.committed_changes.pop_front();
+	}
+}
+
+/* Makes items that were just read from the database reflect the changes
+ * that aren't written yet, and the ones that were committed after `read`
+ * started. */
+void Cache::apply_pending_changes(
+	const std::vector<std::shared_ptr<RssItem>>& items,
+	const ItemsRead& read)
+{
+	std::lock_guard<std::mutex> lock(pending_mtx);
+	if (pending_changes.empty() && writing_changes.empty() &&
+		committed_changes.empty()) {
+		return;
 	}
 
-	return result + prepare_query(remaining_format, args...);
+	const auto apply = [](RssItem& item, const PendingChange& change) {
+		if (change.state_changed) {
+			item.set_unread_nowrite(change.unread);
+			item.set_enqueued(change.enqueued);
+		}
+		if (change.flags_changed) {
+			item.set_flags(change.flags);
+		}
+	};
+	for (const auto& item : items) {
+		// committed batches are older than the one being written, which
+		// is older than queued changes
+		for (const auto& batch : committed_changes) {
+			if (batch.first <= read.generation()) {
+				continue;
+			}
+			const auto committed = batch.second.find(item->guid());
+			if (committed != batch.second.end()) {
+				apply(*item, committed->second);
+			}
+		}
+		auto it = writing_changes.find(item->guid());
+		if (it != writing_changes.end()) {
+			apply(*item, it->second);
+		}
+		it = pending_changes.find(item->guid());
+		if (it != pending_changes.end()) {
+			apply(*item, it->second);
+		}
+	}
 }
 
-void Cache::update_rssitem_flags(RssItem* item)
+void Cache::write_pending_changes_loop()
 {
-	std::lock_guard<std::mutex> lock(mtx);
+	std::unique_lock<std::mutex> lock(pending_mtx);
+	unsigned int failures = 0;
+	for (;;) {
+		const bool woken =
+			pending_cv.wait_for(lock, COMPACTION_DELAY, [this]() {
+				return !accept_changes ||
+					!pending_changes.empty();
+			});
+		if (!accept_changes) {
+			return;
+		}
+		if (!woken) {
+			lock.unlock();
+			archive_when_idle();
+			compact_when_idle();
+			log_query_stats();
+			lock.lock();
+			continue;
+		}
+
+		pending_cv.wait_for(lock, WRITE_BEHIND_DELAY * (1 << failures),
+			[this]() {
+				return !accept_changes;
+			});
+
+		lock.unlock();
+		try {
+			flush_pending_changes();
+			failures = 0;
+		} catch (const DbException& e) {
+			failures++;
+			if (failures < WRITE_ATTEMPTS) {
+				LOG(Level::ERROR,
+					"Cache::write_pending_changes_loop: "
+					"couldn't write changes, will retry: %s",
+					e.what());
+			} else {
+				lock.lock();
+				LOG(Level::ERROR,
+					"Cache::write_pending_changes_loop: "
+					"couldn't write changes %u times, dropping "
+					"%u of them: %s",
+					failures,
+					static_cast<unsigned int>(
+						pending_changes.size()),
+					e.what());
+				pending_changes.clear();
+				failures = 0;
+				continue;
+			}
+		}
+		lock.lock();
+	}
+}
+
+/* Archives a batch of old articles if nothing else is using the database
+ * right now. Called by the background writer, like compact_when_idle(). */
+void Cache::archive_when_idle()
+{
+	std::unique_lock<std::mutex> lock(mtx, std::try_to_lock);
+	if (!lock.owns_lock()) {
+		return;
+	}
+	try {
+		archive_old_items_unlocked(ARCHIVE_BATCH);
+	} catch (const DbException& e) {
+		LOG(Level::ERROR,
+			"Cache::archive_when_idle: couldn't archive articles: "
+			"%s",
+			e.what());
+	}
+}
 
-	std::string update = prepare_query(
-		"UPDATE rss_item SET flags = '%q' WHERE guid = '%q';",
-		item->flags(),
-		item->guid());
+/* Frees some pages if nothing else is using the database right now. Called by
+ * the background writer when there were no changes to write for a while. */
+void Cache::compact_when_idle()
+{
+	std::unique_lock<std::mutex> lock(mtx, std::try_to_lock);
+	if (!lock.owns_lock()) {
+		return;
+	}
+	try {
+		compact_unlocked(COMPACTION_PAGES);
+	} catch (const DbException& e) {
+		LOG(Level::ERROR,
+			"Cache::compact_when_idle: couldn't compact the cache: "
+			"%s",
+			e.what());
+	}
+}
 
-	run_sql(update);
+/* Stops the background writer and writes whatever it left behind. Changes
+ * that are queued after this are dropped. */
+void Cache::stop_changes_writer()
+{
+	{
+		std::lock_guard<std::mutex> lock(pending_mtx);
+		accept_changes = false;
+	}
+	pending_cv.notify_all();
+	if (changes_writer.joinable()) {
+		changes_writer.join();
+	}
+	flush_pending_changes();
 }
 
 void Cache::remove_old_deleted_items(const std::string& rssurl,
@@ -982,99 +3092,193 @@ void Cache::remove_old_deleted_items(const std::string& rssurl,
 			"no changes)");
 		return;
 	}
-	std::string guidset = "(";
-	for (const auto& guid : guids) {
-		guidset.append(prepare_query("'%q', ", guid));
-	}
-	guidset.append("'')");
-	std::string query = prepare_query(
+	std::lock_guard<std::mutex> lock(mtx);
+	ScopeTransaction dbtrans(db);
+	fill_key_set(db, statements, guids);
+	run_prepared(
 		"DELETE FROM rss_item "
-		"WHERE feedurl = '%q' "
+		"WHERE feed_id = (SELECT id FROM rss_feed WHERE rssurl = ?) "
 		"AND deleted = 1 "
-		"AND guid NOT IN %s;",
-		rssurl,
-		guidset);
-	std::lock_guard<std::mutex> lock(mtx);
-	run_sql(query);
+		"AND (guid_hash, guid) NOT IN "
+		"(SELECT key_hash, key FROM temp.key_set);",
+		nullptr,
+		rssurl);
+	dbtrans.commit();
 }
 
 unsigned int Cache::get_unread_count()
 {
-	std::lock_guard<std::mutex> lock(mtx);
-
-	std::string countquery =
-		"SELECT count(id) FROM rss_item WHERE unread = 1;";
-	CbHandler count_cbh;
-	run_sql(countquery, count_callback, &count_cbh);
-	unsigned int count = static_cast<unsigned int>(count_cbh.count());
+	flush_pending_changes();
+	unsigned int count = 0;
+	run_read("SELECT coalesce(sum(unread_count), 0) FROM rss_feed_counts;",
+		[&](sqlite3_stmt* stmt) {
+			count = static_cast<unsigned int>(
+				sqlite3_column_int64(stmt, 0));
+		});
 	LOG(Level::DEBUG, "Cache::get_unread_count: count = %u", count);
 	return count;
 }
 
-void Cache::mark_items_read_by_guid(const std::vector<std::string>& guids)
+std::unordered_map<std::string, FeedCounts> Cache::get_feed_counts()
 {
-	ScopeMeasure m1("Cache::mark_items_read_by_guid");
-	std::string guidset("(");
-	for (const auto& guid : guids) {
-		guidset.append(prepare_query("'%q', ", guid));
+	flush_pending_changes();
+	std::unordered_map<std::string, FeedCounts> counts;
+	run_read("SELECT feedurl, unread_count, total_count "
+		 "FROM rss_feed_counts;",
+		[&](sqlite3_stmt* stmt) {
+			counts[column_string(stmt, 0)] = FeedCounts{
+				static_cast<unsigned int>(
+					sqlite3_column_int64(stmt, 1)),
+				static_cast<unsigned int>(
+					sqlite3_column_int64(stmt, 2))};
+		});
+	return counts;
+}
+
+bool Cache::check_feed_counts()
+{
+	ScopeMeasure m1("Cache::check_feed_counts");
+
+	const auto stored = get_feed_counts();
+	std::unordered_map<std::string, FeedCounts> actual;
+	run_read("SELECT feedurl, sum(unread = 1), count(*) "
+		 "FROM rss_item "
+		 "WHERE deleted = 0 "
+		 "GROUP BY feedurl;",
+		[&](sqlite3_stmt* stmt) {
+			actual[column_string(stmt, 0)] = FeedCounts{
+				static_cast<unsigned int>(
+					sqlite3_column_int64(stmt, 1)),
+				static_cast<unsigned int>(
+					sqlite3_column_int64(stmt, 2))};
+		});
+
+	// feeds without articles may or may not have a row of zeros
+	const auto lookup = [](
+		const std::unordered_map<std::string, FeedCounts>& counts,
+		const std::string& feedurl) {
+		const auto it = counts.find(feedurl);
+		return it == counts.end() ? FeedCounts{0, 0} : it->second;
+	};
+
+	std::unordered_set<std::string> feedurls;
+	for (const auto& entry : stored) {
+		feedurls.insert(entry.first);
+	}
+	for (const auto& entry : actual) {
+		feedurls.insert(entry.first);
 	}
-	guidset.append("'')");
 
-	std::string updatequery = prepare_query(
-		"UPDATE rss_item SET unread = 0 WHERE unread = 1 AND guid IN "
-		"%s;",
-		guidset);
+	bool consistent = true;
+	for (const auto& feedurl : feedurls) {
+		const auto saved = lookup(stored, feedurl);
+		const auto counted = lookup(actual, feedurl);
+		if (saved.unread != counted.unread ||
+			saved.total != counted.total) {
+			LOG(Level::ERROR,
+				"Cache::check_feed_counts: %s has %u/%u "
+				"unread/total articles, but %u/%u are stored",
+				feedurl,
+				counted.unread,
+				counted.total,
+				saved.unread,
+				saved.total);
+			consistent = false;
+		}
+	}
+	return consistent;
+}
 
+void Cache::rebuild_feed_counts()
+{
+	ScopeMeasure m1("Cache::rebuild_feed_counts");
+	flush_pending_changes();
 	std::lock_guard<std::mutex> lock(mtx);
-	run_sql(updatequery);
+	ScopeTransaction dbtrans(db);
+	run_sql("DELETE FROM rss_feed_counts;");
+	run_sql(fill_feed_counts_query);
+	dbtrans.commit();
 }
 
-std::vector<std::string> Cache::get_read_item_guids()
+/* Marks articles with the given GUIDs read, in a single transaction. Returns
+ * the number of articles that were unread before. */
+unsigned int Cache::mark_items_read_by_guid(
+	const std::vector<std::string>& guids)
 {
-	std::vector<std::string> guids;
-	std::string query = "SELECT guid FROM rss_item WHERE unread = 0;";
+	ScopeMeasure m1("Cache::mark_items_read_by_guid");
+	if (guids.empty()) {
+		return 0;
+	}
+	flush_pending_changes();
 
 	std::lock_guard<std::mutex> lock(mtx);
-	run_sql(query, vectorofstring_callback, &guids);
-
-	return guids;
+	ScopeTransaction dbtrans(db);
+	fill_key_set(db, statements, guids);
+	run_prepared(
+		"UPDATE rss_item SET unread = 0 "
+		"WHERE unread = 1 AND (guid_hash, guid) IN "
+		"(SELECT key_hash, key FROM temp.key_set);",
+		nullptr);
+	const unsigned int marked = sqlite3_changes(db);
+	dbtrans.commit();
+	return marked;
 }
 
-void Cache::clean_old_articles()
+/* Calls `callback` with the GUID of each read article as soon as it's read from
+ * the database, so that the GUIDs never have to be in memory all at once. */
+void Cache::for_each_read_item_guid(
+	const std::function<void(const std::string&)>& callback)
 {
-	std::lock_guard<std::mutex> lock(mtx);
-
-	unsigned int days = cfg->get_configvalue_as_int("keep-articles-days");
-	if (days > 0) {
-		time_t old_date = time(nullptr) - days * 24 * 60 * 60;
+	flush_pending_changes();
 
-		std::string query(prepare_query(
-			"DELETE FROM rss_item WHERE pubDate < %d", old_date));
-		LOG(Level::DEBUG,
-			"Cache::clean_old_articles: about to delete articles "
-			"with a pubDate older than %d",
-			old_date);
-		run_sql(query);
-	} else {
-		LOG(Level::DEBUG,
-			"Cache::clean_old_articles, days == 0, not cleaning up "
-			"anything");
+	std::string query = "SELECT guid FROM rss_item WHERE unread = 0";
+	if (!archive_file.empty()) {
+		query += " UNION ALL "
+			 "SELECT guid FROM archive.rss_item WHERE unread = 0";
 	}
+	query += ";";
+
+	run_read(query, [&](sqlite3_stmt* stmt) {
+		callback(column_string(stmt, 0));
+	});
+}
+
+std::vector<std::string> Cache::get_read_item_guids()
+{
+	std::vector<std::string> guids;
+	for_each_read_item_guid(
+		[&](const std::string& guid) { guids.push_back(guid); });
+	return guids;
 }
 
 void Cache::fetch_descriptions(RssFeed* feed)
 {
 	std::vector<std::string> guids;
 	for (const auto& item : feed->items()) {
-		guids.push_back(prepare_query("'%q'", item->guid()));
+		guids.push_back(item->guid());
+	}
+	if (guids.empty()) {
+		return;
 	}
-	std::string in_clause = utils::join(guids, ", ");
-
-	std::string query = prepare_query(
-		"SELECT guid, content FROM rss_item WHERE guid IN (%s);",
-		in_clause);
 
-	run_sql(query, fill_content_callback, feed);
+	const std::string select =
+		"SELECT guid, content_text(content, content_format) "
+		"FROM %srss_item "
+		"WHERE (guid_hash, guid) IN "
+		"(SELECT key_hash, key FROM temp.key_set)";
+	std::string query = strprintf::fmt(select, "");
+	if (!archive_file.empty()) {
+		query += " UNION ALL " + strprintf::fmt(select, "archive.");
+	}
+	query += ";";
+
+	run_read_with_keys(guids,
+		query,
+		[&](sqlite3_stmt* stmt) {
+			const auto item = feed->get_item_by_guid_unlocked(
+				column_string(stmt, 0));
+			item->set_description(column_string(stmt, 1));
+		});
 }
 
 SchemaVersion Cache::get_schema_version()
@@ -20,8 +20,12 @@ const std::string ConfigContainer::PARTIAL_FILE_SUFFIX = ".part";
 
 ConfigContainer::ConfigContainer()
 	// create the config options and set their resp. default value and type
-	: config_data{{"always-display-description",
-			      ConfigData("false", ConfigDataType::BOOL)},
+	: config_data{{"adaptive-reload",
+			      ConfigData("no", ConfigDataType::BOOL)},
+		  {"always-display-description",
+			  ConfigData("false", ConfigDataType::BOOL)},
+		  {"archive-articles-days",
+			  ConfigData("0", ConfigDataType::INT)},
 		  {"article-sort-order",
 			  ConfigData("date-asc", ConfigDataType::STR)},
 		  {"articlelist-format",
@@ -37,7 +41,9 @@ ConfigContainer::ConfigContainer()
 			  ConfigData(utils::get_default_browser(),
 				  ConfigDataType::PATH)},
 		  {"cache-file", ConfigData("", ConfigDataType::PATH)},
+		  {"cache-query-stats", ConfigData("no", ConfigDataType::BOOL)},
 		  {"cleanup-on-quit", ConfigData("yes", ConfigDataType::BOOL)},
+		  {"compress-cache", ConfigData("no", ConfigDataType::BOOL)},
 		  {"confirm-exit", ConfigData("no", ConfigDataType::BOOL)},
 		  {"cookie-cache", ConfigData("", ConfigDataType::PATH)},
 		  {"datetime-format", ConfigData("%b %d", ConfigDataType::STR)},
@@ -98,6 +104,8 @@ ConfigContainer::ConfigContainer()
 		  {"inoreader-flag-star", ConfigData("", ConfigDataType::STR)},
 		  {"inoreader-min-items", ConfigData("20", ConfigDataType::INT)},
 		  {"keep-articles-days", ConfigData("0", ConfigDataType::INT)},
+		  {"lazy-load-articles",
+			  ConfigData("false", ConfigDataType::BOOL)},
 		  {"mark-as-read-on-hover",
 			  ConfigData("false", ConfigDataType::BOOL)},
 		  {"max-browser-tabs", ConfigData("10", ConfigDataType::INT)},
@@ -168,12 +176,17 @@ ConfigContainer::ConfigContainer()
 		  {"reload-only-visible-feeds",
 			  ConfigData("false", ConfigDataType::BOOL)},
 		  {"reload-threads", ConfigData("1", ConfigDataType::INT)},
+		  {"reload-transfers", ConfigData("100", ConfigDataType::INT)},
 		  {"reload-time", ConfigData("60", ConfigDataType::INT)},
 		  {"save-path", ConfigData("~/", ConfigDataType::PATH)},
 		  {"search-highlight-colors",
 			  ConfigData("black yellow bold",
 				  ConfigDataType::STR,
 				  true)},
+		  {"search-result-order",
+			  ConfigData("date",
+				  std::unordered_set<std::string>(
+					  {"date", "relevance"}))},
 		  {"show-keymap-hint", ConfigData("yes", ConfigDataType::BOOL)},
 		  {"show-read-articles", ConfigData("yes", ConfigDataType::BOOL)},
 		  {"show-read-feeds", ConfigData("yes", ConfigDataType::BOOL)},
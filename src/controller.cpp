@@ -1,7 +1,9 @@
 #include "controller.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
+#include <chrono>
 #include <cstdlib>
 #include <ctime>
 #include <curl/curl.h>
@@ -73,6 +75,92 @@ void omg_a_child_died(int /* sig */)
 	::signal(SIGCHLD, omg_a_child_died); /* in case of unreliable signals */
 }
 
+static void print_storage_stats(const std::string& format,
+	const StorageStats& stats)
+{
+	const double free_ratio = stats.pages == 0
+		? 0.0
+		: 100.0 * stats.free_pages / stats.pages;
+	std::cout << strprintf::fmt(format,
+			     static_cast<unsigned long long>(
+				     stats.pages * stats.page_size),
+			     free_ratio)
+		  << std::endl;
+}
+
+static void print_query_stats(
+	const std::vector<std::pair<std::string, QueryStats>>& queries)
+{
+	std::cout << strprintf::fmt("%8s %12s %12s %10s %10s  %s",
+			     _("calls"),
+			     _("total (ms)"),
+			     _("max (ms)"),
+			     _("returned"),
+			     _("changed"),
+			     _("query"))
+		  << std::endl;
+	for (const auto& entry : queries) {
+		const QueryStats& stats = entry.second;
+		std::cout << strprintf::fmt(
+				     "%8llu %12.3f %12.3f %10llu %10llu  %s",
+				     static_cast<unsigned long long>(
+					     stats.calls),
+				     stats.total_time / 1e6,
+				     stats.max_time / 1e6,
+				     static_cast<unsigned long long>(
+					     stats.rows_returned),
+				     static_cast<unsigned long long>(
+					     stats.rows_changed),
+				     entry.first)
+			  << std::endl;
+	}
+}
+
+/* Whether everything the command line asks for only reads the cache, so that
+ * it can be done while another instance is running. Caches that don't exist
+ * yet have to be created, which is a write. */
+static bool only_reads_cache(const CliArgsParser& args,
+	const std::string& cachefile)
+{
+	static const std::unordered_set<std::string> read_only_commands = {
+		"print-unread", "check-counts", "cache-stats"};
+
+	if (args.do_export || args.do_vacuum || args.do_read_import) {
+		return false;
+	}
+	if (args.execute_cmds) {
+		if (!std::all_of(args.cmds_to_execute.begin(),
+			    args.cmds_to_execute.end(),
+			    [](const std::string& cmd) {
+				    return read_only_commands.count(cmd) > 0;
+			    })) {
+			return false;
+		}
+	} else if (!args.do_read_export) {
+		return false;
+	}
+	return ::access(cachefile.c_str(), F_OK) == 0;
+}
+
+// Number of GUIDs import_read_information() marks read in one transaction.
+// Exports log their progress every time they write that many.
+static const size_t READ_INFO_BATCH_SIZE = 5000;
+
+static void log_read_info_progress(const std::string& function,
+	unsigned long long guids,
+	std::chrono::steady_clock::time_point start)
+{
+	const double seconds = std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start)
+		.count();
+	LOG(Level::INFO,
+		"%s: %llu GUIDs in %.3f s (%.0f GUIDs/s)",
+		function,
+		guids,
+		seconds,
+		seconds > 0 ? guids / seconds : 0.0);
+}
+
 Controller::Controller()
 	: v(0)
 	, urlcfg(0)
@@ -81,10 +169,13 @@ Controller::Controller()
 	, api(0)
 	, queueManager(&cfg, &configpaths)
 {
+	utils::set_curl_share(&curl_share);
 }
 
 Controller::~Controller()
 {
+	utils::set_curl_share(nullptr);
+
 	delete rsscache;
 	delete urlcfg;
 	delete api;
@@ -146,13 +237,25 @@ int Controller::run(const CliArgsParser& args)
 		return EXIT_FAILURE;
 	}
 
+	// Read-only commands rely on the write-ahead log to see a consistent
+	// snapshot of the cache, so they don't need the lock
+	const bool read_only =
+		only_reads_cache(args, configpaths.cache_file());
+	if (read_only) {
+		LOG(Level::INFO,
+			"Controller::run: opening the cache read-only, without "
+			"taking the lock");
+	}
+
 	if (!args.do_export) {
 		if (!args.silent)
 			std::cout << strprintf::fmt(_("Starting %s %s..."),
 					     PROGRAM_NAME,
 					     PROGRAM_VERSION)
 				  << std::endl;
+	}
 
+	if (!args.do_export && !read_only) {
 		fslock = std::unique_ptr<FsLock>(new FsLock());
 		pid_t pid;
 		if (!fslock->try_lock(configpaths.lock_file(), pid)) {
@@ -210,6 +313,8 @@ int Controller::run(const CliArgsParser& args)
 	std::string cachefilepath = cfg.get_configvalue("cache-file");
 	if (cachefilepath.length() > 0 && !args.set_cache_file) {
 		configpaths.set_cache_file(cachefilepath);
+	}
+	if (cachefilepath.length() > 0 && !args.set_cache_file && !read_only) {
 		fslock = std::unique_ptr<FsLock>(new FsLock());
 		pid_t pid;
 		if (!fslock->try_lock(configpaths.lock_file(), pid)) {
@@ -227,8 +332,18 @@ int Controller::run(const CliArgsParser& args)
 		std::cout << _("Opening cache...");
 		std::cout.flush();
 	}
+	// Queries are only profiled on request, since that slows them down
+	if (args.execute_cmds &&
+		std::count(args.cmds_to_execute.begin(),
+			args.cmds_to_execute.end(),
+			"cache-stats") > 0) {
+		cfg.set_configvalue("cache-query-stats", "yes");
+	}
 	try {
-		rsscache = new Cache(configpaths.cache_file(), &cfg);
+		rsscache = new Cache(configpaths.cache_file(),
+			&cfg,
+			read_only ? CacheMode::READ_ONLY
+				  : CacheMode::READ_WRITE);
 	} catch (const DbException& e) {
 		std::cerr << strprintf::fmt(
 				     _("Error: opening the cache file `%s' "
@@ -358,6 +473,45 @@ int Controller::run(const CliArgsParser& args)
 		return EXIT_FAILURE;
 	}
 
+	if (args.do_read_import) {
+		LOG(Level::INFO,
+			"Importing read information file from %s",
+			args.readinfofile);
+		std::cout << _("Importing list of read articles...");
+		std::cout.flush();
+		import_read_information(args.readinfofile);
+		std::cout << _("done.") << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	if (args.do_read_export) {
+		LOG(Level::INFO,
+			"Exporting read information file to %s",
+			args.readinfofile);
+		std::cout << _("Exporting list of read articles...");
+		std::cout.flush();
+		if (!export_read_information(args.readinfofile)) {
+			std::cout << std::endl;
+			std::cerr << strprintf::fmt(
+					     _("Error: couldn't write the list "
+					       "of read articles to `%s'"),
+					     args.readinfofile)
+				  << std::endl;
+			return EXIT_FAILURE;
+		}
+		std::cout << _("done.") << std::endl;
+		return EXIT_SUCCESS;
+	}
+
+	// these commands only need the cache, so there's no point in loading
+	// the feeds first
+	if (args.execute_cmds &&
+		std::none_of(args.cmds_to_execute.begin(),
+			args.cmds_to_execute.end(),
+			[](const std::string& cmd) { return cmd == "reload"; })) {
+		return execute_commands(args.cmds_to_execute);
+	}
+
 	if (!args.do_export && !args.do_vacuum && !args.silent)
 		std::cout << _("Loading articles from cache...");
 	if (args.do_vacuum)
@@ -366,40 +520,41 @@ int Controller::run(const CliArgsParser& args)
 
 	if (args.do_vacuum) {
 		std::cout << _("done.") << std::endl;
+		const StorageStats before = rsscache->get_storage_stats();
 		std::cout << _("Cleaning up cache thoroughly...");
 		std::cout.flush();
 		rsscache->do_vacuum();
 		std::cout << _("done.") << std::endl;
+		const StorageStats after = rsscache->get_storage_stats();
+		print_storage_stats(
+			_("Before: %llu bytes, %.1f%% of them unused"), before);
+		print_storage_stats(
+			_("After: %llu bytes, %.1f%% of them unused"), after);
 		return EXIT_SUCCESS;
 	}
 
-	unsigned int i = 0;
-	for (const auto& url : urlcfg->get_urls()) {
-		try {
-			bool ignore_disp =
-				(cfg.get_configvalue("ignore-mode") ==
-					"display");
-			std::shared_ptr<RssFeed> feed =
-				rsscache->internalize_rssfeed(
-					url, ignore_disp ? &ign : nullptr);
-			feed->set_tags(urlcfg->get_tags(url));
-			feed->set_order(i);
-			feedcontainer.add_feed(feed);
-		} catch (const DbException& e) {
-			std::cout << _("Error while loading feeds from "
-				       "database: ")
-				  << e.what() << std::endl;
-			return EXIT_FAILURE;
-		} catch (const std::string& str) {
-			std::cout << strprintf::fmt(
-					     _("Error while loading feed '%s': "
-					       "%s"),
-					     url,
-					     str)
-				  << std::endl;
-			return EXIT_FAILURE;
+	try {
+		ScopeMeasure m1("Controller::run: loading feeds from cache");
+		const bool ignore_disp =
+			(cfg.get_configvalue("ignore-mode") == "display");
+		const auto urls = urlcfg->get_urls();
+		RssIgnores* ignores = ignore_disp ? &ign : nullptr;
+		const auto feeds =
+			cfg.get_configvalue_as_bool("lazy-load-articles")
+			? rsscache->internalize_rssfeed_counts(urls, ignores)
+			: rsscache->internalize_rssfeeds(urls, ignores);
+		for (unsigned int i = 0; i < feeds.size(); ++i) {
+			feeds[i]->set_tags(urlcfg->get_tags(urls[i]));
+			feeds[i]->set_order(i);
+			feedcontainer.add_feed(feeds[i]);
 		}
-		i++;
+	} catch (const DbException& e) {
+		std::cout << _("Error while loading feeds from database: ")
+			  << e.what() << std::endl;
+		return EXIT_FAILURE;
+	} catch (const std::string& str) {
+		std::cout << str << std::endl;
+		return EXIT_FAILURE;
 	}
 
 	std::vector<std::string> tags = urlcfg->get_alltags();
@@ -429,28 +584,6 @@ int Controller::run(const CliArgsParser& args)
 		return EXIT_SUCCESS;
 	}
 
-	if (args.do_read_import) {
-		LOG(Level::INFO,
-			"Importing read information file from %s",
-			args.readinfofile);
-		std::cout << _("Importing list of read articles...");
-		std::cout.flush();
-		import_read_information(args.readinfofile);
-		std::cout << _("done.") << std::endl;
-		return EXIT_SUCCESS;
-	}
-
-	if (args.do_read_export) {
-		LOG(Level::INFO,
-			"Exporting read information file to %s",
-			args.readinfofile);
-		std::cout << _("Exporting list of read articles...");
-		std::cout.flush();
-		export_read_information(args.readinfofile);
-		std::cout << _("done.") << std::endl;
-		return EXIT_SUCCESS;
-	}
-
 	// hand over the important objects to the View
 	v->set_config_container(&cfg);
 	v->set_keymap(&keys);
@@ -459,8 +592,7 @@ int Controller::run(const CliArgsParser& args)
 	v->set_filters(&filters);
 
 	if (args.execute_cmds) {
-		execute_commands(args.cmds_to_execute);
-		return EXIT_SUCCESS;
+		return execute_commands(args.cmds_to_execute);
 	}
 
 	// if the user wants to refresh on startup via configuration file, then
@@ -756,6 +888,40 @@ int Controller::execute_commands(const std::vector<std::string>& cmds)
 			std::cout << strprintf::fmt(_("%u unread articles"),
 					     rsscache->get_unread_count())
 				  << std::endl;
+		} else if (cmd == "check-counts") {
+			if (!rsscache->check_feed_counts()) {
+				std::cout << _("Article counts in the cache are "
+					       "wrong; run `-x rebuild-counts' "
+					       "to fix them.")
+					  << std::endl;
+				return EXIT_FAILURE;
+			}
+			std::cout << _("Article counts in the cache are "
+				       "correct.")
+				  << std::endl;
+		} else if (cmd == "rebuild-counts") {
+			rsscache->rebuild_feed_counts();
+		} else if (cmd == "cache-stats") {
+			print_query_stats(rsscache->get_query_stats());
+		} else if (cmd == "recompress") {
+			const RecompressStats stats =
+				rsscache->recompress_content();
+			std::cout << strprintf::fmt(
+					     _("Rewrote %u articles: %llu bytes "
+					       "of content before, %llu bytes "
+					       "after. Reading an article back "
+					       "takes %.1f microseconds on "
+					       "average."),
+					     stats.articles,
+					     static_cast<unsigned long long>(
+						     stats.bytes_before),
+					     static_cast<unsigned long long>(
+						     stats.bytes_after),
+					     stats.decode_time)
+				  << std::endl;
+			std::cout << _("Run `newsboat --vacuum' to shrink the "
+				       "cache file.")
+				  << std::endl;
 		} else {
 			std::cerr
 				<< strprintf::fmt(_("%s: %s: unknown command"),
@@ -811,32 +977,81 @@ void Controller::write_item(std::shared_ptr<RssItem> item, std::ostream& ostr)
 
 void Controller::import_read_information(const std::string& readinfofile)
 {
-	std::vector<std::string> guids;
-
 	std::ifstream f(readinfofile.c_str());
-	std::string line;
-	getline(f, line);
 	if (!f.is_open()) {
 		return;
 	}
-	while (f.is_open() && !f.eof()) {
+
+	const auto start = std::chrono::steady_clock::now();
+	unsigned long long total = 0;
+	unsigned long long marked = 0;
+	std::vector<std::string> guids;
+	guids.reserve(READ_INFO_BATCH_SIZE);
+
+	// Every batch is committed on its own, so that memory use doesn't grow
+	// with the size of the file
+	const auto mark_batch = [&]() {
+		marked += rsscache->mark_items_read_by_guid(guids);
+		total += guids.size();
+		guids.clear();
+		log_read_info_progress(
+			"Controller::import_read_information", total, start);
+	};
+
+	std::string line;
+	while (std::getline(f, line)) {
+		if (line.empty()) {
+			continue;
+		}
 		guids.push_back(line);
-		getline(f, line);
+		if (guids.size() == READ_INFO_BATCH_SIZE) {
+			mark_batch();
+		}
+	}
+	if (!guids.empty()) {
+		mark_batch();
 	}
-	rsscache->mark_items_read_by_guid(guids);
+
+	LOG(Level::INFO,
+		"Controller::import_read_information: %llu of %llu articles "
+		"were unread",
+		marked,
+		total);
 }
 
-void Controller::export_read_information(const std::string& readinfofile)
+/* Returns false if the file couldn't be written, e.g. because the disk is
+ * full. */
+bool Controller::export_read_information(const std::string& readinfofile)
 {
-	std::vector<std::string> guids = rsscache->get_read_item_guids();
+	std::ofstream f(readinfofile.c_str());
+	if (!f.is_open()) {
+		return false;
+	}
 
-	std::fstream f;
-	f.open(readinfofile.c_str(), std::fstream::out);
-	if (f.is_open()) {
-		for (const auto& guid : guids) {
-			f << guid << std::endl;
+	const auto start = std::chrono::steady_clock::now();
+	unsigned long long total = 0;
+	rsscache->for_each_read_item_guid([&](const std::string& guid) {
+		f << guid << '\n';
+		if (++total % READ_INFO_BATCH_SIZE == 0) {
+			log_read_info_progress(
+				"Controller::export_read_information",
+				total,
+				start);
 		}
+	});
+	log_read_info_progress(
+		"Controller::export_read_information", total, start);
+
+	f.close();
+	if (f.fail()) {
+		LOG(Level::ERROR,
+			"Controller::export_read_information: couldn't write "
+			"%s after %llu articles",
+			readinfofile,
+			total);
+		return false;
 	}
+	return true;
 }
 
 void Controller::update_config()
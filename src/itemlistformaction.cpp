@@ -820,6 +820,17 @@ void ItemListFormAction::qna_start_search()
 	v->push_searchresult(search_dummy_feed, searchphrase);
 }
 
+void ItemListFormAction::set_show_searchresult(bool b)
+{
+	show_searchresult = b;
+	// Results ranked by relevance come out of the cache already ordered, so
+	// we only sort them once the user picks a different sort order.
+	if (show_searchresult &&
+		cfg->get_configvalue("search-result-order") == "relevance") {
+		old_sort_strategy = cfg->get_article_sort_strategy();
+	}
+}
+
 void ItemListFormAction::do_update_visible_items()
 {
 	if (!(invalidated && invalidation_mode == InvalidationMode::COMPLETE))
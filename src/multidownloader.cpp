@@ -0,0 +1,190 @@
+#include "multidownloader.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "logger.h"
+#include "utils.h"
+
+namespace newsboat {
+
+MultiDownloader::MultiDownloader(unsigned int max_transfers,
+	unsigned int max_per_host)
+	: multi(curl_multi_init())
+	, max_transfers(std::max(max_transfers, 1u))
+	, max_per_host(std::max(max_per_host, 1u))
+	, new_connections(0)
+	, reused_connections(0)
+	, connection_setup_time(0)
+{
+	if (!multi) {
+		throw std::runtime_error("Can't obtain curl multi handle");
+	}
+}
+
+MultiDownloader::~MultiDownloader()
+{
+	for (const auto& transfer : running) {
+		curl_multi_remove_handle(multi, transfer.first);
+	}
+	curl_multi_cleanup(multi);
+}
+
+void MultiDownloader::add(const std::string& url,
+	Setup setup,
+	Completion done,
+	unsigned int attempts)
+{
+	pending.push_back(Transfer{utils::extract_host(url),
+		setup,
+		done,
+		std::max(attempts, 1u),
+		nullptr});
+}
+
+void MultiDownloader::run()
+{
+	start_transfers();
+	while (!running.empty()) {
+		int still_running = 0;
+		curl_multi_perform(multi, &still_running);
+
+		CURLMsg* msg;
+		int msgs_left = 0;
+		while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+			if (msg->msg == CURLMSG_DONE) {
+				finish_transfer(
+					msg->easy_handle, msg->data.result);
+			}
+		}
+
+		start_transfers();
+		if (!running.empty()) {
+			curl_multi_wait(multi, nullptr, 0, 1000, nullptr);
+		}
+	}
+
+	log_connection_stats();
+}
+
+void MultiDownloader::start_transfers()
+{
+	auto it = pending.begin();
+	while (running.size() < max_transfers && it != pending.end()) {
+		if (per_host[it->host] >= max_per_host) {
+			++it;
+			continue;
+		}
+
+		Transfer transfer = *it;
+		it = pending.erase(it);
+		transfer.handle = idle_handle();
+		CURL* easyhandle = transfer.handle->ptr();
+		try {
+			transfer.setup(*transfer.handle);
+		} catch (const std::exception& e) {
+			LOG(Level::ERROR,
+				"MultiDownloader::start_transfers: setup "
+				"failed: %s",
+				e.what());
+			curl_easy_reset(easyhandle);
+			transfer.done(*transfer.handle, CURLE_FAILED_INIT);
+			idle.push_back(transfer.handle);
+			continue;
+		}
+
+		per_host[transfer.host]++;
+		running[easyhandle] = transfer;
+		curl_multi_add_handle(multi, easyhandle);
+	}
+	LOG(Level::DEBUG,
+		"MultiDownloader::start_transfers: %u running, %u pending",
+		static_cast<unsigned int>(running.size()),
+		static_cast<unsigned int>(pending.size()));
+}
+
+void MultiDownloader::finish_transfer(CURL* easyhandle, CURLcode result)
+{
+	curl_multi_remove_handle(multi, easyhandle);
+
+	auto it = running.find(easyhandle);
+	if (it == running.end()) {
+		return;
+	}
+	Transfer transfer = it->second;
+	running.erase(it);
+	per_host[transfer.host]--;
+
+	record_connection_stats(easyhandle);
+	if (result != CURLE_OK && transfer.attempts > 1) {
+		LOG(Level::INFO,
+			"MultiDownloader::finish_transfer: transfer failed: "
+			"%s; %u attempts left",
+			curl_easy_strerror(result),
+			transfer.attempts - 1);
+		curl_easy_reset(easyhandle);
+		idle.push_back(transfer.handle);
+		transfer.handle = nullptr;
+		transfer.attempts--;
+		pending.push_back(transfer);
+		return;
+	}
+
+	transfer.done(*transfer.handle, result);
+	idle.push_back(transfer.handle);
+}
+
+void MultiDownloader::record_connection_stats(CURL* easyhandle)
+{
+	long connects = 0;
+	curl_easy_getinfo(easyhandle, CURLINFO_NUM_CONNECTS, &connects);
+	if (connects == 0) {
+		reused_connections++;
+		return;
+	}
+
+	// For HTTPS, APPCONNECT_TIME is when the TLS handshake was done;
+	// for plain HTTP it's zero, and CONNECT_TIME is what matters.
+	double connect_time = 0;
+	double appconnect_time = 0;
+	curl_easy_getinfo(easyhandle, CURLINFO_CONNECT_TIME, &connect_time);
+	curl_easy_getinfo(
+		easyhandle, CURLINFO_APPCONNECT_TIME, &appconnect_time);
+	new_connections++;
+	connection_setup_time += std::max(connect_time, appconnect_time);
+}
+
+void MultiDownloader::log_connection_stats()
+{
+	if (new_connections == 0) {
+		LOG(Level::INFO,
+			"MultiDownloader::run: %u transfers reused existing "
+			"connections",
+			reused_connections);
+		return;
+	}
+
+	const double average = connection_setup_time / new_connections;
+	LOG(Level::INFO,
+		"MultiDownloader::run: %u transfers opened new connections, "
+		"which took %.3f s on average to connect and finish the TLS "
+		"handshake; %u transfers reused connections, saving about "
+		"%.3f s",
+		new_connections,
+		average,
+		reused_connections,
+		average * reused_connections);
+}
+
+CurlHandle* MultiDownloader::idle_handle()
+{
+	if (idle.empty()) {
+		handles.emplace_back(new CurlHandle());
+		return handles.back().get();
+	}
+	CurlHandle* handle = idle.back();
+	idle.pop_back();
+	return handle;
+}
+
+} // namespace newsboat
@@ -136,6 +136,8 @@ PbController::PbController()
 	, ql(0)
 	, lock_file("pb-lock.pid")
 {
+	utils::set_curl_share(&curl_share);
+
 	char* cfgdir;
 	if (!(cfgdir = ::getenv("HOME"))) {
 		struct passwd* spw = ::getpwuid(::getuid());
@@ -183,6 +185,8 @@ PbController::PbController()
 
 PbController::~PbController()
 {
+	utils::set_curl_share(nullptr);
+
 	delete cfg;
 }
 
@@ -1,15 +1,21 @@
 #include "reloader.h"
 
 #include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <ncurses.h>
 #include <thread>
+#include <unordered_map>
 
+#include "cache.h"
 #include "controller.h"
 #include "downloadthread.h"
 #include "exceptions.h"
 #include "formatstring.h"
-#include "reloadrangethread.h"
+#include "multidownloader.h"
+#include "reloadschedule.h"
 #include "reloadthread.h"
 #include "rss/rsspp.h"
 #include "rssparser.h"
@@ -18,10 +24,82 @@
 
 namespace newsboat {
 
+// Upper limit on simultaneous downloads from a single server, so that
+// reloading many feeds from one site doesn't flood it.
+static const unsigned int MAX_TRANSFERS_PER_HOST = 6;
+
+// With adaptive-reload, feeds are reloaded at least this often, however
+// rarely they publish.
+static const time_t MAX_RELOAD_INTERVAL = 24 * 60 * 60;
+
+// How many of a feed's newest articles adaptive-reload looks at to estimate
+// how often the feed publishes.
+static const unsigned int SCHEDULING_PUBDATES = 10;
+
+static unsigned int milliseconds_since(
+	std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - start)
+		.count();
+}
+
+// Returns positions in `urls` in the order the feeds should be reloaded in:
+// the slowest ones first, so that they don't hold up the end of the reload,
+// but with feeds from the same host kept together, so that they can reuse
+// connections. Hosts go in the order of the total time of their feeds. Feeds
+// that weren't timed yet are assumed to take as long as an average one.
+static std::vector<unsigned int> reload_order(
+	const std::vector<std::string>& urls,
+	const std::unordered_map<std::string, unsigned int>& fetch_times)
+{
+	unsigned long long total_time = 0;
+	unsigned int timed = 0;
+	for (const auto& url : urls) {
+		const auto it = fetch_times.find(url);
+		if (it != fetch_times.end()) {
+			total_time += it->second;
+			timed++;
+		}
+	}
+	const unsigned int average = (timed > 0) ? total_time / timed : 0;
+
+	std::vector<unsigned int> costs;
+	std::vector<std::string> hosts;
+	std::unordered_map<std::string, unsigned long long> host_costs;
+	for (const auto& url : urls) {
+		const auto it = fetch_times.find(url);
+		costs.push_back(
+			(it != fetch_times.end()) ? it->second : average);
+		hosts.push_back(utils::extract_host(url));
+		host_costs[hosts.back()] += costs.back();
+	}
+
+	std::vector<unsigned int> order;
+	for (unsigned int pos = 0; pos < urls.size(); ++pos) {
+		order.push_back(pos);
+	}
+	std::stable_sort(order.begin(),
+		order.end(),
+		[&](unsigned int a, unsigned int b) {
+			const auto cost_a = host_costs[hosts[a]];
+			const auto cost_b = host_costs[hosts[b]];
+			if (cost_a != cost_b) {
+				return cost_a > cost_b;
+			}
+			if (hosts[a] != hosts[b]) {
+				return hosts[a] < hosts[b];
+			}
+			return costs[a] > costs[b];
+		});
+	return order;
+}
+
 Reloader::Reloader(Controller* c, Cache* cc, ConfigContainer* cfg)
 	: ctrl(c)
 	, rsscache(cc)
 	, cfg(cfg)
+	, unchanged_feeds(0)
 {
 }
 
@@ -57,60 +135,125 @@ void Reloader::reload(unsigned int pos,
 	if (pos < ctrl->get_feedcontainer()->feeds.size()) {
 		std::shared_ptr<RssFeed> oldfeed =
 			ctrl->get_feedcontainer()->feeds[pos];
-		std::string errmsg;
-		if (!unattended) {
-			ctrl->get_view()->set_status(
-				strprintf::fmt(_("%sLoading %s..."),
-					prepare_message(pos + 1, max),
-					utils::censor_url(oldfeed->rssurl())));
+		std::unique_ptr<RssParser> parser = create_parser(oldfeed);
+		parser->set_easyhandle(easyhandle);
+		LOG(Level::DEBUG, "Reloader::reload: created parser");
+		replace_feed(pos, max, unattended, *parser, [&]() {
+			return parser->parse();
+		});
+	} else {
+		ctrl->get_view()->show_error(_("Error: invalid feed!"));
+	}
+}
+
+std::unique_ptr<RssParser> Reloader::create_parser(
+	std::shared_ptr<RssFeed> feed)
+{
+	bool ignore_dl = (cfg->get_configvalue("ignore-mode") == "download");
+
+	return std::unique_ptr<RssParser>(new RssParser(feed->rssurl(),
+		rsscache,
+		cfg,
+		ignore_dl ? ctrl->get_ignores() : nullptr,
+		ctrl->get_api()));
+}
+
+void Reloader::replace_feed(unsigned int pos,
+	unsigned int max,
+	bool unattended,
+	RssParser& parser,
+	const std::function<std::shared_ptr<RssFeed>()>& parse)
+{
+	std::shared_ptr<RssFeed> oldfeed =
+		ctrl->get_feedcontainer()->feeds[pos];
+	std::string errmsg;
+	if (!unattended) {
+		ctrl->get_view()->set_status(
+			strprintf::fmt(_("%sLoading %s..."),
+				prepare_message(pos + 1, max),
+				utils::censor_url(oldfeed->rssurl())));
+	}
+
+	try {
+		oldfeed->set_status(DlStatus::DURING_DOWNLOAD);
+		std::shared_ptr<RssFeed> newfeed = parse();
+		if (parser.is_unchanged()) {
+			LOG(Level::DEBUG,
+				"Reloader::reload: feed is unchanged");
+			unchanged_feeds++;
+		} else if (newfeed->total_item_count() > 0) {
+			ctrl->replace_feed(oldfeed, newfeed, pos, unattended);
+		} else {
+			LOG(Level::DEBUG, "Reloader::reload: feed is empty");
 		}
+		parser.store_parse_results();
+		schedule_next_reload(oldfeed->rssurl(), parser);
+		oldfeed->set_status(DlStatus::SUCCESS);
+		ctrl->get_view()->set_status("");
+	} catch (const DbException& e) {
+		errmsg = strprintf::fmt(_("Error while retrieving %s: %s"),
+			utils::censor_url(oldfeed->rssurl()),
+			e.what());
+	} catch (const std::string& emsg) {
+		errmsg = strprintf::fmt(_("Error while retrieving %s: %s"),
+			utils::censor_url(oldfeed->rssurl()),
+			emsg);
+	} catch (rsspp::Exception& e) {
+		errmsg = strprintf::fmt(_("Error while retrieving %s: %s"),
+			utils::censor_url(oldfeed->rssurl()),
+			e.what());
+	}
+	if (errmsg != "") {
+		oldfeed->set_status(DlStatus::DL_ERROR);
+		ctrl->get_view()->set_status(errmsg);
+		LOG(Level::USERERROR, "%s", errmsg);
+	}
+}
 
-		bool ignore_dl =
-			(cfg->get_configvalue("ignore-mode") == "download");
+time_t Reloader::reload_interval()
+{
+	const time_t interval = 60 * cfg->get_configvalue_as_int("reload-time");
+	return (interval > 0) ? interval : 60;
+}
 
-		RssParser parser(oldfeed->rssurl(),
-			rsscache,
-			cfg,
-			ignore_dl ? ctrl->get_ignores() : nullptr,
-			ctrl->get_api());
-		parser.set_easyhandle(easyhandle);
-		LOG(Level::DEBUG, "Reloader::reload: created parser");
-		try {
-			oldfeed->set_status(DlStatus::DURING_DOWNLOAD);
-			std::shared_ptr<RssFeed> newfeed = parser.parse();
-			if (newfeed->total_item_count() > 0) {
-				ctrl->replace_feed(
-					oldfeed, newfeed, pos, unattended);
-			} else {
-				LOG(Level::DEBUG,
-					"Reloader::reload: feed is empty");
-			}
-			oldfeed->set_status(DlStatus::SUCCESS);
-			ctrl->get_view()->set_status("");
-		} catch (const DbException& e) {
-			errmsg = strprintf::fmt(
-				_("Error while retrieving %s: %s"),
-				utils::censor_url(oldfeed->rssurl()),
-				e.what());
-		} catch (const std::string& emsg) {
-			errmsg = strprintf::fmt(
-				_("Error while retrieving %s: %s"),
-				utils::censor_url(oldfeed->rssurl()),
-				emsg);
-		} catch (rsspp::Exception& e) {
-			errmsg = strprintf::fmt(
-				_("Error while retrieving %s: %s"),
-				utils::censor_url(oldfeed->rssurl()),
-				e.what());
+void Reloader::schedule_next_reload(const std::string& url,
+	const RssParser& parser)
+{
+	if (!cfg->get_configvalue_as_bool("adaptive-reload") ||
+		utils::is_query_url(url)) {
+		return;
+	}
+	const time_t now = time(nullptr);
+	const time_t next_reload = next_reload_time(now,
+		rsscache->get_recent_pubdates(url, SCHEDULING_PUBDATES),
+		parser.get_refresh_hints(),
+		reload_interval(),
+		MAX_RELOAD_INTERVAL);
+	rsscache->set_next_reload_time(url, next_reload);
+	LOG(Level::DEBUG,
+		"Reloader::schedule_next_reload: reloading %s again in %u "
+		"seconds",
+		url,
+		static_cast<unsigned int>(next_reload - now));
+}
+
+std::vector<int> Reloader::get_due_feeds()
+{
+	const time_t due = time(nullptr) + reload_interval() / 2;
+	const auto next_reloads = rsscache->get_next_reload_times();
+	const auto feeds = ctrl->get_feedcontainer()->get_all_feeds();
+
+	std::vector<int> indexes;
+	for (unsigned int pos = 0; pos < feeds.size(); ++pos) {
+		if (feeds[pos]->is_query_feed()) {
+			continue;
 		}
-		if (errmsg != "") {
-			oldfeed->set_status(DlStatus::DL_ERROR);
-			ctrl->get_view()->set_status(errmsg);
-			LOG(Level::USERERROR, "%s", errmsg);
+		const auto it = next_reloads.find(feeds[pos]->rssurl());
+		if (it == next_reloads.end() || it->second <= due) {
+			indexes.push_back(pos);
 		}
-	} else {
-		ctrl->get_view()->show_error(_("Error: invalid feed!"));
 	}
+	return indexes;
 }
 
 std::string Reloader::prepare_message(unsigned int pos, unsigned int max)
@@ -127,61 +270,14 @@ void Reloader::reload_all(bool unattended)
 		ctrl->get_feedcontainer()->unread_feed_count();
 	const auto unread_articles =
 		ctrl->get_feedcontainer()->unread_item_count();
-	int num_threads = cfg->get_configvalue_as_int("reload-threads");
-	time_t t1, t2, dt;
-
-	ctrl->get_feedcontainer()->reset_feeds_status();
-	const auto num_feeds = ctrl->get_feedcontainer()->feeds_size();
-
-	// TODO: change to std::clamp in C++17
-	const int min_threads = 1;
-	const int max_threads = num_feeds;
-	num_threads = std::max(min_threads, std::min(num_threads, max_threads));
-
-	t1 = time(nullptr);
 
 	LOG(Level::DEBUG, "Reloader::reload_all: starting with reload all...");
-	if (num_threads == 1) {
-		reload_range(0, num_feeds - 1, num_feeds, unattended);
-	} else {
-		std::vector<std::pair<unsigned int, unsigned int>> partitions =
-			utils::partition_indexes(0, num_feeds - 1, num_threads);
-		std::vector<std::thread> threads;
-		LOG(Level::DEBUG,
-			"Reloader::reload_all: starting reload threads...");
-		for (int i = 0; i < num_threads - 1; i++) {
-			threads.push_back(std::thread(ReloadRangeThread(*this,
-				partitions[i].first,
-				partitions[i].second,
-				num_feeds,
-				unattended)));
-		}
-		LOG(Level::DEBUG,
-			"Reloader::reload_all: starting my own reload...");
-		reload_range(partitions[num_threads - 1].first,
-			partitions[num_threads - 1].second,
-			num_feeds,
-			unattended);
-		LOG(Level::DEBUG,
-			"Reloader::reload_all: joining other threads...");
-		for (size_t i = 0; i < threads.size(); i++) {
-			threads[i].join();
-		}
-	}
-
-	// refresh query feeds (update and sort)
-	LOG(Level::DEBUG, "Reloader::reload_all: refresh query feeds");
-	for (const auto& feed : ctrl->get_feedcontainer()->feeds) {
-		ctrl->get_view()->prepare_query_feed(feed);
+	std::vector<unsigned int> positions;
+	const auto num_feeds = ctrl->get_feedcontainer()->feeds_size();
+	for (unsigned int pos = 0; pos < num_feeds; ++pos) {
+		positions.push_back(pos);
 	}
-	ctrl->get_view()->force_redraw();
-
-	ctrl->get_feedcontainer()->sort_feeds(cfg->get_feed_sort_strategy());
-	ctrl->update_feedlist();
-
-	t2 = time(nullptr);
-	dt = t2 - t1;
-	LOG(Level::INFO, "Reloader::reload_all: reload took %d seconds", dt);
+	reload_feeds(positions, unattended);
 
 	const auto unread_feeds2 =
 		ctrl->get_feedcontainer()->unread_feed_count();
@@ -216,9 +312,13 @@ void Reloader::reload_indexes(const std::vector<int>& indexes, bool unattended)
 		ctrl->get_feedcontainer()->unread_item_count();
 	const auto size = ctrl->get_feedcontainer()->feeds_size();
 
+	std::vector<unsigned int> positions;
 	for (const auto& idx : indexes) {
-		reload(idx, size, unattended);
+		if (idx >= 0 && static_cast<unsigned int>(idx) < size) {
+			positions.push_back(idx);
+		}
 	}
+	reload_feeds(positions, unattended);
 
 	const auto unread_feeds2 =
 		ctrl->get_feedcontainer()->unread_feed_count();
@@ -241,41 +341,187 @@ void Reloader::reload_indexes(const std::vector<int>& indexes, bool unattended)
 	}
 }
 
-void Reloader::reload_range(unsigned int start,
-	unsigned int end,
-	unsigned int size,
+void Reloader::reload_feeds(const std::vector<unsigned int>& positions,
 	bool unattended)
 {
-	std::vector<unsigned int> v;
-	for (unsigned int i = start; i <= end; ++i) {
-		v.push_back(i);
+	int num_threads = cfg->get_configvalue_as_int("reload-threads");
+	time_t t1, t2, dt;
+
+	ctrl->get_feedcontainer()->reset_feeds_status();
+
+	// TODO: change to std::clamp in C++17
+	const int min_threads = 1;
+	const int max_threads = positions.size();
+	num_threads = std::max(min_threads, std::min(num_threads, max_threads));
+
+	t1 = time(nullptr);
+
+	reload_concurrently(positions, num_threads, unattended);
+
+	// refresh query feeds (update and sort)
+	LOG(Level::DEBUG, "Reloader::reload_feeds: refresh query feeds");
+	for (const auto& feed : ctrl->get_feedcontainer()->feeds) {
+		ctrl->get_view()->prepare_query_feed(feed);
 	}
+	ctrl->get_view()->force_redraw();
+
+	ctrl->get_feedcontainer()->sort_feeds(cfg->get_feed_sort_strategy());
+	ctrl->update_feedlist();
 
-	auto extract = [](std::string& s, const std::string& url) {
-		size_t p = url.find("//");
-		p = (p == std::string::npos) ? 0 : p + 2;
-		std::string suff(url.substr(p));
-		p = suff.find('/');
-		s = suff.substr(0, p);
+	t2 = time(nullptr);
+	dt = t2 - t1;
+	LOG(Level::INFO,
+		"Reloader::reload_feeds: reloading %u feeds took %d seconds",
+		static_cast<unsigned int>(positions.size()),
+		dt);
+}
+
+void Reloader::reload_concurrently(const std::vector<unsigned int>& positions,
+	unsigned int num_threads,
+	bool unattended)
+{
+	const unsigned int num_feeds = ctrl->get_feedcontainer()->feeds_size();
+	std::mutex queue_mutex;
+	std::condition_variable queue_cond;
+	std::deque<std::function<void(CurlHandle&)>> queue;
+	bool downloads_done = false;
+	auto enqueue = [&](std::function<void(CurlHandle&)> job) {
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		queue.push_back(job);
+		queue_cond.notify_one();
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+	unchanged_feeds = 0;
+	std::mutex times_mutex;
+	std::unordered_map<std::string, unsigned int> fetch_times;
+	unsigned long long total_fetch_time = 0;
+	auto record_fetch_time = [&](const std::string& url, unsigned int ms) {
+		std::lock_guard<std::mutex> lock(times_mutex);
+		if (ms > 0) {
+			fetch_times[url] = ms;
+		}
+		total_fetch_time += ms;
 	};
 
-	std::sort(v.begin(), v.end(), [&](unsigned int a, unsigned int b) {
-		std::string domain1, domain2;
-		extract(domain1, ctrl->get_feedcontainer()->feeds[a]->rssurl());
-		extract(domain2, ctrl->get_feedcontainer()->feeds[b]->rssurl());
-		std::reverse(domain1.begin(), domain1.end());
-		std::reverse(domain2.begin(), domain2.end());
-		return domain1 < domain2;
+	std::vector<std::string> urls(num_feeds);
+	std::vector<std::string> reloaded_urls;
+	for (const auto pos : positions) {
+		urls[pos] = ctrl->get_feedcontainer()->feeds[pos]->rssurl();
+		reloaded_urls.push_back(urls[pos]);
+	}
+
+	MultiDownloader downloader(
+		cfg->get_configvalue_as_int("reload-transfers"),
+		MAX_TRANSFERS_PER_HOST);
+	const unsigned int download_attempts =
+		std::max(cfg->get_configvalue_as_int("download-retries"), 1);
+	std::vector<std::unique_ptr<RssParser>> parsers(num_feeds);
+	std::vector<std::string> setup_errors(num_feeds);
+	for (const auto i :
+		reload_order(reloaded_urls, rsscache->get_fetch_times())) {
+		const unsigned int pos = positions[i];
+		std::shared_ptr<RssFeed> feed =
+			ctrl->get_feedcontainer()->feeds[pos];
+		parsers[pos] = create_parser(feed);
+		if (!parsers[pos]->is_http_download()) {
+			enqueue([&, pos](CurlHandle& easyhandle) {
+				const auto t = std::chrono::steady_clock::now();
+				reload(pos, num_feeds, unattended, &easyhandle);
+				record_fetch_time(urls[pos],
+					milliseconds_since(t));
+			});
+			continue;
+		}
+
+		RssParser* parser = parsers[pos].get();
+		std::string* setup_error = &setup_errors[pos];
+		auto parse = [=]() -> std::shared_ptr<RssFeed> {
+			if (!setup_error->empty()) {
+				throw *setup_error;
+			}
+			return parser->parse_download();
+		};
+		auto finish = [=]() {
+			replace_feed(
+				pos, num_feeds, unattended, *parser, parse);
+		};
+		downloader.add(feed->rssurl(),
+			[parser, setup_error, feed](CurlHandle& easyhandle) {
+				feed->set_status(DlStatus::DURING_DOWNLOAD);
+				try {
+					parser->start_download(easyhandle);
+				} catch (const DbException& e) {
+					*setup_error = e.what();
+					throw;
+				}
+			},
+			[&, pos, parser, finish](CurlHandle& easyhandle,
+				CURLcode result) {
+				double seconds = 0;
+				curl_easy_getinfo(easyhandle.ptr(),
+					CURLINFO_TOTAL_TIME,
+					&seconds);
+				record_fetch_time(urls[pos], seconds * 1000);
+				parser->finish_download(easyhandle, result);
+				enqueue([finish](CurlHandle&) {
+					finish();
+				});
+			},
+			download_attempts);
+	}
+
+	// Downloads run on a thread of their own, while this thread and
+	// reload-threads - 1 others parse the downloaded feeds and reload the
+	// ones that aren't fetched over HTTP.
+	std::thread download_thread([&]() {
+		downloader.run();
+		std::lock_guard<std::mutex> lock(queue_mutex);
+		downloads_done = true;
+		queue_cond.notify_all();
 	});
 
-	CurlHandle easyhandle;
+	auto work = [&]() {
+		CurlHandle easyhandle;
+		for (;;) {
+			std::function<void(CurlHandle&)> job;
+			{
+				std::unique_lock<std::mutex> lock(queue_mutex);
+				queue_cond.wait(lock, [&]() {
+					return !queue.empty() || downloads_done;
+				});
+				if (queue.empty()) {
+					return;
+				}
+				job = queue.front();
+				queue.pop_front();
+			}
+			job(easyhandle);
+		}
+	};
 
-	for (const auto& i : v) {
-		LOG(Level::DEBUG,
-			"Reloader::reload_range: reloading feed #%u",
-			i);
-		reload(i, size, unattended, &easyhandle);
+	std::vector<std::thread> threads;
+	for (unsigned int i = 1; i < num_threads; i++) {
+		threads.push_back(std::thread(work));
 	}
+	work();
+
+	LOG(Level::DEBUG,
+		"Reloader::reload_concurrently: joining other threads...");
+	download_thread.join();
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	rsscache->update_fetch_times(fetch_times);
+	LOG(Level::INFO,
+		"Reloader::reload_concurrently: reloaded %u feeds (%u "
+		"unchanged) in %.3f s; fetching them one by one would have "
+		"taken %.3f s",
+		static_cast<unsigned int>(positions.size()),
+		unchanged_feeds.load(),
+		milliseconds_since(start) / 1000.0,
+		total_fetch_time / 1000.0);
 }
 
 void Reloader::notify(const std::string& msg)
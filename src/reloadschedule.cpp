@@ -0,0 +1,40 @@
+#include "reloadschedule.h"
+
+#include <algorithm>
+
+namespace newsboat {
+
+time_t next_reload_time(time_t now,
+	const std::vector<time_t>& pubdates,
+	const RefreshHints& hints,
+	time_t min_interval,
+	time_t max_interval)
+{
+	time_t interval = min_interval;
+	if (!pubdates.empty()) {
+		const time_t oldest =
+			*std::min_element(pubdates.begin(), pubdates.end());
+		const time_t span = std::max<time_t>(now - oldest, 0);
+		interval = span / pubdates.size() / 2;
+	}
+	interval = std::max(interval, hints.min_interval);
+	interval = std::min(std::max(interval, min_interval), max_interval);
+
+	time_t next = now + interval;
+
+	// Move to the start of the next hour until we're out of skipped hours
+	// and days; a week's worth of hours covers every combination.
+	for (int i = 0; i < 24 * 7; i++) {
+		struct tm t;
+		gmtime_r(&next, &t);
+		if (hints.skip_hours.count(t.tm_hour) == 0 &&
+			hints.skip_days.count(t.tm_wday) == 0) {
+			break;
+		}
+		next = next - (next % 3600) + 3600;
+	}
+
+	return next;
+}
+
+} // namespace newsboat
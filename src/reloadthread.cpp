@@ -32,13 +32,12 @@ void ReloadThread::operator()()
 
 		if (cfg->get_configvalue_as_bool("auto-reload")) {
 			if (suppressed_first) {
-				ctrl->get_reloader()->start_reload_all_thread();
+				start_reload();
 			} else {
 				suppressed_first = true;
 				if (!cfg->get_configvalue_as_bool(
 					    "suppress-first-reload")) {
-					ctrl->get_reloader()
-						->start_reload_all_thread();
+					start_reload();
 				}
 			}
 		} else {
@@ -58,4 +57,23 @@ void ReloadThread::operator()()
 	}
 }
 
+void ReloadThread::start_reload()
+{
+	Reloader* reloader = ctrl->get_reloader();
+	if (!cfg->get_configvalue_as_bool("adaptive-reload")) {
+		reloader->start_reload_all_thread();
+		return;
+	}
+
+	std::vector<int> due = reloader->get_due_feeds();
+	if (due.empty()) {
+		LOG(Level::INFO, "ReloadThread: no feeds are due for a reload");
+		return;
+	}
+	LOG(Level::INFO,
+		"ReloadThread: %u feeds are due for a reload",
+		static_cast<unsigned int>(due.size()));
+	reloader->start_reload_all_thread(&due);
+}
+
 } // namespace newsboat
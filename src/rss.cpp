@@ -46,6 +46,10 @@ RssFeed::RssFeed(Cache* c)
 	, idx(0)
 	, order(0)
 	, status_(DlStatus::SUCCESS)
+	, items_loaded(true)
+	, lazy_ignores(nullptr)
+	, lazy_unread_count(0)
+	, lazy_total_count(0)
 {
 }
 
@@ -124,22 +128,14 @@ void RssItem::set_unread_nowrite_notify(bool u, bool notify)
 void RssItem::set_unread(bool u)
 {
 	if (unread_ != u) {
-		bool old_u = unread_;
 		unread_ = u;
 		std::shared_ptr<RssFeed> feedptr = feedptr_.lock();
 		if (feedptr)
 			feedptr->get_item_by_guid(guid_)->set_unread_nowrite(
 				unread_); // notify parent feed
-		try {
-			if (ch) {
-				ch->update_rssitem_unread_and_enqueued(
-					this, feedurl_);
-			}
-		} catch (const DbException& e) {
-			// if the update failed, restore the old unread flag and
-			// rethrow the exception
-			unread_ = old_u;
-			throw;
+		// the cache writes the change in the background
+		if (ch) {
+			ch->update_rssitem_unread_and_enqueued(this, feedurl_);
 		}
 	}
 }
@@ -156,6 +152,9 @@ std::string RssItem::pubDate() const
 
 unsigned int RssFeed::unread_item_count()
 {
+	if (!items_loaded) {
+		return lazy_unread_count;
+	}
 	std::lock_guard<std::mutex> lock(item_mutex);
 	return std::count_if(items_.begin(),
 		items_.end(),
@@ -260,6 +259,7 @@ std::shared_ptr<RssItem> RssFeed::get_item_by_guid(const std::string& guid)
 std::shared_ptr<RssItem> RssFeed::get_item_by_guid_unlocked(
 	const std::string& guid)
 {
+	load_items();
 	auto it = items_guid_map.find(guid);
 	if (it != items_guid_map.end()) {
 		return it->second;
@@ -382,7 +382,7 @@ std::string RssFeed::get_attribute(const std::string& attribname)
 	else if (attribname == "unread_count") {
 		return std::to_string(unread_item_count());
 	} else if (attribname == "total_count") {
-		return std::to_string(items_.size());
+		return std::to_string(total_item_count());
 	} else if (attribname == "tags") {
 		return get_tags();
 	} else if (attribname == "feedindex") {
@@ -470,6 +470,15 @@ bool RssIgnores::matches(RssItem* item)
 	return false;
 }
 
+bool RssIgnores::has_rules_for(const std::string& url)
+{
+	return std::find_if(ignores.begin(),
+		       ignores.end(),
+		       [&](const FeedUrlExprPair& ign) {
+			       return ign.first == "*" || ign.first == url;
+		       }) != ignores.end();
+}
+
 bool RssIgnores::matches_lastmodified(const std::string& url)
 {
 	return std::find_if(ignores_lastmodified.begin(),
@@ -589,6 +598,7 @@ void RssFeed::sort(const ArticleSortStrategy& sort_strategy)
 
 void RssFeed::sort_unlocked(const ArticleSortStrategy& sort_strategy)
 {
+	load_items();
 	switch (sort_strategy.sm) {
 	case ArtSortMethod::TITLE:
 		std::stable_sort(items_.begin(),
@@ -675,7 +685,7 @@ void RssFeed::remove_old_deleted_items()
 {
 	std::lock_guard<std::mutex> lock(item_mutex);
 	std::vector<std::string> guids;
-	for (const auto& item : items_) {
+	for (const auto& item : items()) {
 		guids.push_back(item->guid());
 	}
 	ch->remove_old_deleted_items(rssurl_, guids);
@@ -748,10 +758,47 @@ void RssFeed::load()
 
 void RssFeed::mark_all_items_read()
 {
+	if (!items_loaded) {
+		// the cache was already updated, and will provide read items
+		// when they're loaded
+		lazy_unread_count = 0;
+		return;
+	}
 	std::lock_guard<std::mutex> lock(item_mutex);
 	for (const auto& item : items_) {
 		item->set_unread_nowrite(false);
 	}
 }
 
+void RssFeed::set_lazy_items(RssIgnores* ign,
+	unsigned int unread_count,
+	unsigned int total_count)
+{
+	lazy_ignores = ign;
+	lazy_unread_count = unread_count;
+	lazy_total_count = total_count;
+	items_loaded = false;
+}
+
+void RssFeed::load_items()
+{
+	if (items_loaded) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(items_load_mutex);
+	if (items_loaded) {
+		return;
+	}
+
+	LOG(Level::DEBUG, "RssFeed::load_items: loading items of %s", rssurl_);
+	const auto items = ch->internalize_rssitems(rssurl_, lazy_ignores);
+	const auto self = shared_from_this();
+	for (const auto& item : items) {
+		item->set_feedptr(self);
+	}
+	add_items(items);
+	items_loaded = true;
+}
+
 } // namespace newsboat
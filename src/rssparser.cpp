@@ -4,6 +4,7 @@
 #include <cerrno>
 #include <cstring>
 #include <curl/curl.h>
+#include <map>
 #include <sstream>
 
 #include "cache.h"
@@ -35,6 +36,10 @@ RssParser::RssParser(const std::string& uri,
 	, ign(ii)
 	, api(a)
 	, easyhandle(0)
+	, http_lm(0)
+	, max_age(-1)
+	, unchanged(false)
+	, body_hash(0)
 {
 	is_ttrss = cfgcont->get_configvalue("urls-source") == "ttrss";
 	is_newsblur = cfgcont->get_configvalue("urls-source") == "newsblur";
@@ -44,13 +49,195 @@ RssParser::RssParser(const std::string& uri,
 RssParser::~RssParser() {}
 
 std::shared_ptr<RssFeed> RssParser::parse()
+{
+	retrieve_uri(my_uri);
+
+	return build_feed();
+}
+
+bool RssParser::is_http_download() const
+{
+	return !is_ttrss && !is_newsblur && !is_ocnews &&
+		utils::is_http_url(my_uri);
+}
+
+void RssParser::start_download(CurlHandle& handle)
+{
+	http_parser.reset();
+	http_buffer.clear();
+	http_error.clear();
+	http_lm = 0;
+	http_etag.clear();
+	unchanged = false;
+	body_hash = 0;
+	fetch_lastmodified(my_uri, http_lm, http_etag);
+	http_parser = create_http_parser();
+	http_parser->prepare_transfer(handle.ptr(),
+		my_uri,
+		http_lm,
+		http_etag,
+		api,
+		cfgcont->get_configvalue("cookie-cache"),
+		http_buffer);
+}
+
+void RssParser::finish_download(CurlHandle& handle, CURLcode result)
+{
+	if (!http_parser) {
+		http_error = curl_easy_strerror(result);
+		return;
+	}
+	try {
+		http_parser->finish_transfer(handle.ptr(),
+			result,
+			cfgcont->get_configvalue("cookie-cache"));
+	} catch (const rsspp::Exception& e) {
+		http_error = e.what();
+	}
+}
+
+std::shared_ptr<RssFeed> RssParser::parse_download()
+{
+	is_valid = false;
+	if (!http_error.empty()) {
+		throw rsspp::Exception(http_error);
+	}
+
+	LOG(Level::INFO,
+		"RssParser::parse_download: retrieved data for %s: %s",
+		my_uri,
+		http_buffer);
+	if (http_buffer.empty()) {
+		unchanged = true;
+	} else if (!is_same_body(http_buffer)) {
+		f = http_parser->parse_buffer(http_buffer, my_uri);
+	}
+	store_lastmodified(*http_parser, my_uri, http_lm, http_etag);
+	max_age = http_parser->get_max_age();
+	is_valid = true;
+	http_parser.reset();
+	http_buffer.clear();
+
+	return build_feed();
+}
+
+void RssParser::store_parse_results()
+{
+	if (unchanged || !is_valid) {
+		return;
+	}
+	if (body_hash != 0) {
+		ch->set_body_hash(my_uri, body_hash);
+	}
+	ch->set_refresh_hints(my_uri, declared_refresh_hints());
+}
+
+/* Settings that change what parsing and storing a feed produces. They're
+ * part of the body hash, so that changing them makes documents that were
+ * already parsed get parsed again. exec: commands and filter: scripts
+ * needn't be included, since they're part of the URL. */
+std::string RssParser::parse_settings() const
+{
+	std::vector<std::string> settings;
+	for (const std::string name : {"ignore-mode",
+		     "max-items",
+		     "keep-articles-days",
+		     "download-full-page"}) {
+		settings.push_back(
+			name + " " + cfgcont->get_configvalue(name));
+	}
+	if (ign) {
+		ign->dump_config(settings);
+	}
+	return utils::join(settings, "\n");
+}
+
+/* Many servers ignore If-Modified-Since and If-None-Match, and exec: and
+ * filter: feeds don't have anything like them, so the same document is
+ * often fetched over and over again. Compare it to the one the feed was
+ * last parsed from, so that it doesn't have to be parsed and stored again.
+ */
+bool RssParser::is_same_body(const std::string& body)
+{
+	body_hash = Cache::hash_body(body, parse_settings());
+	if (ign && ign->matches_lastmodified(my_uri)) {
+		// always-download
+		return false;
+	}
+	if (ch->get_body_hash(my_uri) != body_hash) {
+		return false;
+	}
+	LOG(Level::INFO,
+		"RssParser::is_same_body: %s is the same as on the last "
+		"reload, not parsing it",
+		my_uri);
+	unchanged = true;
+	return true;
+}
+
+RefreshHints RssParser::get_refresh_hints() const
+{
+	// Nothing is parsed if the feed didn't change, so use what it declared
+	// the last time it was.
+	RefreshHints hints = unchanged ? ch->get_refresh_hints(my_uri)
+				       : declared_refresh_hints();
+	hints.min_interval = std::max<time_t>(hints.min_interval, max_age);
+	return hints;
+}
+
+RefreshHints RssParser::declared_refresh_hints() const
+{
+	static const std::map<std::string, time_t> update_periods = {
+		{"hourly", 60 * 60},
+		{"daily", 24 * 60 * 60},
+		{"weekly", 7 * 24 * 60 * 60},
+		{"monthly", 30 * 24 * 60 * 60},
+		{"yearly", 365 * 24 * 60 * 60}};
+	static const std::map<std::string, unsigned int> days = {
+		{"Sunday", 0},
+		{"Monday", 1},
+		{"Tuesday", 2},
+		{"Wednesday", 3},
+		{"Thursday", 4},
+		{"Friday", 5},
+		{"Saturday", 6}};
+
+	RefreshHints hints;
+	hints.min_interval = f.ttl * 60;
+
+	// sy:updatePeriod defaults to "daily" when only the frequency is given
+	if (!f.update_period.empty() || f.update_frequency > 0) {
+		const auto period = update_periods.find(
+			f.update_period.empty() ? "daily" : f.update_period);
+		if (period != update_periods.end()) {
+			const unsigned int frequency =
+				std::max(f.update_frequency, 1u);
+			hints.min_interval = std::max(
+				hints.min_interval, period->second / frequency);
+		}
+	}
+
+	for (const auto hour : f.skip_hours) {
+		if (hour < 24) {
+			hints.skip_hours.insert(hour);
+		}
+	}
+	for (const auto& day : f.skip_days) {
+		const auto it = days.find(day);
+		if (it != days.end()) {
+			hints.skip_days.insert(it->second);
+		}
+	}
+
+	return hints;
+}
+
+std::shared_ptr<RssFeed> RssParser::build_feed()
 {
 	std::shared_ptr<RssFeed> feed(new RssFeed(ch));
 
 	feed->set_rssurl(my_uri);
 
-	retrieve_uri(my_uri);
-
 	if (!skip_parsing && is_valid) {
 		/*
 		 * After parsing is done, we fill our feed object with title,
@@ -174,14 +361,11 @@ void RssParser::retrieve_uri(const std::string& uri)
 		throw strprintf::fmt(_("Error: unsupported URL: %s"), my_uri);
 }
 
-void RssParser::download_http(const std::string& uri)
+std::unique_ptr<rsspp::Parser> RssParser::create_http_parser()
 {
-	unsigned int retrycount =
-		cfgcont->get_configvalue_as_int("download-retries");
 	std::string proxy;
 	std::string proxy_auth;
 	std::string proxy_type;
-	is_valid = false;
 
 	if (cfgcont->get_configvalue_as_bool("use-proxy") == true) {
 		proxy = cfgcont->get_configvalue("proxy");
@@ -189,56 +373,80 @@ void RssParser::download_http(const std::string& uri)
 		proxy_type = cfgcont->get_configvalue("proxy-type");
 	}
 
+	std::string useragent = utils::get_useragent(cfgcont);
+	LOG(Level::DEBUG,
+		"RssParser::create_http_parser: user-agent = %s",
+		useragent);
+	return std::unique_ptr<rsspp::Parser>(new rsspp::Parser(
+		cfgcont->get_configvalue_as_int("download-timeout"),
+		useragent.c_str(),
+		proxy.c_str(),
+		proxy_auth.c_str(),
+		utils::get_proxy_type(proxy_type),
+		cfgcont->get_configvalue_as_bool("ssl-verifypeer")));
+}
+
+void RssParser::fetch_lastmodified(const std::string& uri,
+	time_t& lm,
+	std::string& etag)
+{
+	if (!ign || !ign->matches_lastmodified(uri)) {
+		ch->fetch_lastmodified(uri, lm, etag);
+	}
+}
+
+void RssParser::store_lastmodified(rsspp::Parser& p,
+	const std::string& uri,
+	time_t lm,
+	const std::string& etag)
+{
+	LOG(Level::DEBUG,
+		"RssParser::store_lastmodified: lm = %d etag = %s",
+		p.get_last_modified(),
+		p.get_etag());
+	if (p.get_last_modified() != 0 || p.get_etag().length() > 0) {
+		LOG(Level::DEBUG,
+			"RssParser::store_lastmodified: lastmodified old: %d "
+			"new: %d",
+			lm,
+			p.get_last_modified());
+		LOG(Level::DEBUG,
+			"RssParser::store_lastmodified: etag old: %s new %s",
+			etag,
+			p.get_etag());
+		ch->update_lastmodified(uri,
+			(p.get_last_modified() != lm) ? p.get_last_modified()
+						      : 0,
+			(etag != p.get_etag()) ? p.get_etag() : "");
+	}
+}
+
+void RssParser::download_http(const std::string& uri)
+{
+	unsigned int retrycount =
+		cfgcont->get_configvalue_as_int("download-retries");
+	is_valid = false;
+
 	for (unsigned int i = 0; i < retrycount && !is_valid; i++) {
 		try {
-			std::string useragent = utils::get_useragent(cfgcont);
-			LOG(Level::DEBUG,
-				"RssParser::download_http: user-agent = %s",
-				useragent);
-			rsspp::Parser p(cfgcont->get_configvalue_as_int(
-						"download-timeout"),
-				useragent.c_str(),
-				proxy.c_str(),
-				proxy_auth.c_str(),
-				utils::get_proxy_type(proxy_type),
-				cfgcont->get_configvalue_as_bool(
-					"ssl-verifypeer"));
+			std::unique_ptr<rsspp::Parser> p =
+				create_http_parser();
 			time_t lm = 0;
 			std::string etag;
-			if (!ign || !ign->matches_lastmodified(uri)) {
-				ch->fetch_lastmodified(uri, lm, etag);
-			}
-			f = p.parse_url(uri,
+			fetch_lastmodified(uri, lm, etag);
+			const std::string buf = p->download_url(uri,
 				lm,
 				etag,
 				api,
 				cfgcont->get_configvalue("cookie-cache"),
 				easyhandle ? easyhandle->ptr() : 0);
-			LOG(Level::DEBUG,
-				"RssParser::download_http: lm = %d etag = %s",
-				p.get_last_modified(),
-				p.get_etag());
-			if (p.get_last_modified() != 0 ||
-				p.get_etag().length() > 0) {
-				LOG(Level::DEBUG,
-					"RssParser::download_http: "
-					"lastmodified "
-					"old: %d new: %d",
-					lm,
-					p.get_last_modified());
-				LOG(Level::DEBUG,
-					"RssParser::download_http: etag old: "
-					"%s "
-					"new %s",
-					etag,
-					p.get_etag());
-				ch->update_lastmodified(uri,
-					(p.get_last_modified() != lm)
-						? p.get_last_modified()
-						: 0,
-					(etag != p.get_etag()) ? p.get_etag()
-							       : "");
+			if (buf.empty()) {
+				unchanged = true;
+			} else if (!is_same_body(buf)) {
+				f = p->parse_buffer(buf, uri);
 			}
+			store_lastmodified(*p, uri, lm, etag);
+			max_age = p->get_max_age();
 			is_valid = true;
 		} catch (rsspp::Exception& e) {
 			is_valid = false;
@@ -256,8 +464,10 @@ void RssParser::get_execplugin(const std::string& plugin)
 	std::string buf = utils::get_command_output(plugin);
 	is_valid = false;
 	try {
-		rsspp::Parser p;
-		f = p.parse_buffer(buf);
+		if (!is_same_body(buf)) {
+			rsspp::Parser p;
+			f = p.parse_buffer(buf);
+		}
 		is_valid = true;
 	} catch (rsspp::Exception& e) {
 		is_valid = false;
@@ -302,8 +512,10 @@ void RssParser::download_filterplugin(const std::string& filter,
 		result);
 	is_valid = false;
 	try {
-		rsspp::Parser p;
-		f = p.parse_buffer(result);
+		if (!is_same_body(result)) {
+			rsspp::Parser p;
+			f = p.parse_buffer(result);
+		}
 		is_valid = true;
 	} catch (rsspp::Exception& e) {
 		is_valid = false;
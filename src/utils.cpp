@@ -1,6 +1,7 @@
 #include "utils.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <cstdarg>
 #include <cstdio>
@@ -15,6 +16,7 @@
 #include <libgen.h>
 #include <libxml/uri.h>
 #include <locale>
+#include <mutex>
 #include <pwd.h>
 #include <regex>
 #include <sstream>
@@ -697,6 +699,76 @@ unsigned int utils::to_u(const std::string& str,
 	return rs_to_u(str.c_str(), default_value);
 }
 
+CurlHandle::CurlHandle()
+	: h(0)
+{
+	h = curl_easy_init();
+	if (!h)
+		throw std::runtime_error("Can't obtain curl handle");
+	utils::apply_curl_share(h);
+}
+
+struct CurlShare::Locks {
+	std::mutex mutexes[CURL_LOCK_DATA_LAST];
+};
+
+static void
+lock_curl_share(CURL*, curl_lock_data data, curl_lock_access, void* userptr)
+{
+	static_cast<CurlShare::Locks*>(userptr)->mutexes[data].lock();
+}
+
+static void unlock_curl_share(CURL*, curl_lock_data data, void* userptr)
+{
+	static_cast<CurlShare::Locks*>(userptr)->mutexes[data].unlock();
+}
+
+CurlShare::CurlShare()
+	: sh(curl_share_init())
+	, locks(new Locks())
+{
+	if (!sh) {
+		delete locks;
+		throw std::runtime_error("Can't obtain curl share handle");
+	}
+	curl_share_setopt(sh, CURLSHOPT_LOCKFUNC, lock_curl_share);
+	curl_share_setopt(sh, CURLSHOPT_UNLOCKFUNC, unlock_curl_share);
+	curl_share_setopt(sh, CURLSHOPT_USERDATA, locks);
+	curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(sh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
+CurlShare::~CurlShare()
+{
+	const CURLSHcode rc = curl_share_cleanup(sh);
+	if (rc != CURLSHE_OK) {
+		// Some handle still uses the share, e.g. one owned by a
+		// detached reload thread at exit. Leak the share rather than
+		// pull it out from under that handle.
+		LOG(Level::DEBUG,
+			"CurlShare::~CurlShare: curl_share_cleanup failed: %s",
+			curl_share_strerror(rc));
+		return;
+	}
+	delete locks;
+}
+
+static std::atomic<CurlShare*> curl_share(nullptr);
+
+void utils::set_curl_share(CurlShare* share)
+{
+	curl_share = share;
+}
+
+void utils::apply_curl_share(CURL* handle)
+{
+	CurlShare* share = curl_share;
+	if (share) {
+		curl_easy_setopt(handle, CURLOPT_SHARE, share->ptr());
+	}
+}
+
 ScopeMeasure::ScopeMeasure(const std::string& func, Level ll)
 	: funcname(func)
 	, lvl(ll)
@@ -971,6 +1043,26 @@ bool utils::is_exec_url(const std::string& url)
 	return url.substr(0, 5) == "exec:";
 }
 
+std::string utils::extract_host(const std::string& url)
+{
+	size_t start = url.find("//");
+	start = (start == std::string::npos) ? 0 : start + 2;
+	const size_t end = url.find_first_of("/?#", start);
+	std::string host = url.substr(start, end - start);
+
+	const size_t at = host.rfind('@');
+	if (at != std::string::npos) {
+		host.erase(0, at + 1);
+	}
+	// Colons inside brackets belong to an IPv6 address
+	const size_t port = host.rfind(':');
+	if (port != std::string::npos &&
+		host.find(']', port) == std::string::npos) {
+		host.erase(port);
+	}
+	return host;
+}
+
 std::string utils::censor_url(const std::string& url)
 {
 	std::string rv(url);
@@ -1043,6 +1135,8 @@ std::string utils::quote_if_necessary(const std::string& str)
 
 void utils::set_common_curl_options(CURL* handle, ConfigContainer* cfg)
 {
+	apply_curl_share(handle);
+
 	if (cfg) {
 		if (cfg->get_configvalue_as_bool("use-proxy")) {
 			const std::string proxy = cfg->get_configvalue("proxy");
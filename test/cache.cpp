@@ -1,14 +1,102 @@
 #include "cache.h"
 
+#include <algorithm>
+#include <chrono>
 #include <sstream>
+#include <thread>
 
 #include "3rd-party/catch.hpp"
 #include "configcontainer.h"
+#include "exceptions.h"
 #include "rssparser.h"
 #include "test-helpers.h"
 
 using namespace newsboat;
 
+// Triggers that maintain the full-text index call content_text(), which only
+// Cache's own connections provide. Articles that tests insert directly are
+// never compressed, so their content is the text itself.
+static void add_content_text_function(sqlite3* db)
+{
+	const int rc = sqlite3_create_function(db,
+			"content_text",
+			2,
+			SQLITE_UTF8,
+			nullptr,
+			[](sqlite3_context* context, int, sqlite3_value** argv) {
+				sqlite3_result_value(context, argv[0]);
+			},
+			nullptr,
+			nullptr);
+	REQUIRE(rc == SQLITE_OK);
+}
+
+/* Turns a cache back into one with schema 2.11, keeping its feeds and
+ * articles, so that opening it applies every later patch. */
+static void downgrade_to_2_11(sqlite3* db)
+{
+	add_content_text_function(db);
+	const int rc = sqlite3_exec(db,
+			"DROP TRIGGER IF EXISTS rss_item_fts_insert;"
+			"DROP TRIGGER IF EXISTS rss_item_fts_delete;"
+			"DROP TRIGGER IF EXISTS rss_item_fts_update;"
+			"DROP TABLE IF EXISTS rss_item_fts;"
+			"DROP TRIGGER rss_feed_counts_insert;"
+			"DROP TRIGGER rss_feed_counts_delete;"
+			"DROP TRIGGER rss_feed_counts_update;"
+			"DROP TABLE rss_feed_counts;"
+
+			"CREATE TABLE old_feed ( "
+			" rssurl VARCHAR(1024) PRIMARY KEY NOT NULL, "
+			" url VARCHAR(1024) NOT NULL, "
+			" title VARCHAR(1024) NOT NULL, "
+			" lastmodified INTEGER(11) NOT NULL DEFAULT 0, "
+			" is_rtl INTEGER(1) NOT NULL DEFAULT 0, "
+			" etag VARCHAR(128) NOT NULL DEFAULT \"\" );"
+			"INSERT INTO old_feed "
+			"SELECT rssurl, url, title, lastmodified, is_rtl, etag "
+			"FROM rss_feed;"
+			"DROP TABLE rss_feed;"
+			"ALTER TABLE old_feed RENAME TO rss_feed;"
+
+			"CREATE TABLE old_item ( "
+			" id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL, "
+			" guid VARCHAR(64) NOT NULL, "
+			" title VARCHAR(1024) NOT NULL, "
+			" author VARCHAR(1024) NOT NULL, "
+			" url VARCHAR(1024) NOT NULL, "
+			" feedurl VARCHAR(1024) NOT NULL, "
+			" pubDate INTEGER NOT NULL, "
+			" content VARCHAR(65535) NOT NULL,"
+			" unread INTEGER(1) NOT NULL, "
+			" enclosure_url VARCHAR(1024), "
+			" enclosure_type VARCHAR(1024), "
+			" enqueued INTEGER(1) NOT NULL DEFAULT 0, "
+			" flags VARCHAR(52), "
+			" deleted INTEGER(1) NOT NULL DEFAULT 0, "
+			" base VARCHAR(128) NOT NULL DEFAULT \"\" );"
+			"INSERT INTO old_item "
+			"SELECT id, guid, title, author, url, feedurl, "
+			"pubDate, content_text(content, content_format), "
+			"unread, enclosure_url, enclosure_type, enqueued, "
+			"flags, deleted, base "
+			"FROM rss_item;"
+			"DROP TABLE rss_item;"
+			"ALTER TABLE old_item RENAME TO rss_item;"
+
+			"CREATE INDEX idx_rssurl ON rss_feed(rssurl);"
+			"CREATE INDEX idx_guid ON rss_item(guid);"
+			"CREATE INDEX idx_feedurl ON rss_item(feedurl);"
+			"CREATE INDEX idx_lastmodified "
+			"ON rss_feed(lastmodified);"
+			"CREATE INDEX idx_deleted ON rss_item(deleted);"
+			"UPDATE metadata SET db_schema_version_minor = 11;",
+			nullptr,
+			nullptr,
+			nullptr);
+	REQUIRE(rc == SQLITE_OK);
+}
+
 TEST_CASE("items in search result can be marked read", "[Cache]")
 {
 	ConfigContainer cfg;
@@ -58,8 +146,9 @@ TEST_CASE("Cleaning old articles works", "[Cache]")
 
 	/* Simulating a restart of Newsboat. */
 
-	/* Setting "keep-articles-days" to non-zero value to trigger
-	 * Cache::clean_old_articles().
+	/* Setting "keep-articles-days" to non-zero value. Old articles of all
+	 * feeds are deleted when the cache is opened, and those of a feed
+	 * whenever it's written to the cache again.
 	 *
 	 * The value of 42 days is sufficient because the items in the test feed
 	 * are dating back to 2006. */
@@ -67,6 +156,13 @@ TEST_CASE("Cleaning old articles works", "[Cache]")
 	cfg->set_configvalue("keep-articles-days", "42");
 	rsscache.reset(new Cache(dbfile.getPath(), cfg.get()));
 	feed = rsscache->internalize_rssfeed("file://data/rss.xml", nullptr);
+	REQUIRE(feed->items().size() == 1);
+
+	/* Simulating a reload of the feed. */
+	RssParser reloader(
+		"file://data/rss.xml", rsscache.get(), cfg.get(), nullptr);
+	rsscache->externalize_rssfeed(reloader.parse(), false);
+	feed = rsscache->internalize_rssfeed("file://data/rss.xml", nullptr);
 
 	/* The important part: old articles should be gone, new one remains. */
 	REQUIRE(feed->items().size() == 1);
@@ -125,6 +221,102 @@ TEST_CASE("Last-Modified and ETag values are persisted to DB", "[Cache]")
 	}
 }
 
+TEST_CASE("Fetch times of feeds are persisted to DB", "[Cache]")
+{
+	ConfigContainer cfg;
+	TestHelpers::TempFile dbfile;
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+	for (const auto& feedurl :
+		{"file://data/rss.xml", "file://data/atom10_1.xml"}) {
+		RssParser parser(feedurl, rsscache.get(), &cfg, nullptr);
+		rsscache->externalize_rssfeed(parser.parse(), false);
+	}
+
+	REQUIRE(rsscache->get_fetch_times().empty());
+
+	rsscache->update_fetch_times({{"file://data/rss.xml", 1500},
+		{"file://data/atom10_1.xml", 20},
+		{"file://data/not-in-cache.xml", 300}});
+	rsscache.reset(new Cache(dbfile.getPath(), &cfg));
+
+	const auto fetch_times = rsscache->get_fetch_times();
+	REQUIRE(fetch_times.size() == 2);
+	REQUIRE(fetch_times.at("file://data/rss.xml") == 1500);
+	REQUIRE(fetch_times.at("file://data/atom10_1.xml") == 20);
+}
+
+TEST_CASE("Next reload times of feeds are persisted to DB", "[Cache]")
+{
+	ConfigContainer cfg;
+	TestHelpers::TempFile dbfile;
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+	for (const auto& feedurl :
+		{"file://data/rss.xml", "file://data/atom10_1.xml"}) {
+		RssParser parser(feedurl, rsscache.get(), &cfg, nullptr);
+		rsscache->externalize_rssfeed(parser.parse(), false);
+	}
+
+	REQUIRE(rsscache->get_next_reload_times().empty());
+
+	rsscache->set_next_reload_time("file://data/rss.xml", 1700000000);
+	rsscache->set_next_reload_time("file://data/not-in-cache.xml", 42);
+	rsscache.reset(new Cache(dbfile.getPath(), &cfg));
+
+	const auto next_reloads = rsscache->get_next_reload_times();
+	REQUIRE(next_reloads.size() == 1);
+	REQUIRE(next_reloads.at("file://data/rss.xml") == 1700000000);
+}
+
+TEST_CASE("Refresh hints of feeds are persisted to DB", "[Cache]")
+{
+	ConfigContainer cfg;
+	TestHelpers::TempFile dbfile;
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+	RssParser parser("file://data/rss.xml", rsscache.get(), &cfg, nullptr);
+	rsscache->externalize_rssfeed(parser.parse(), false);
+
+	REQUIRE(rsscache->get_refresh_hints("file://data/rss.xml")
+			.min_interval == 0);
+
+	RefreshHints hints;
+	hints.min_interval = 3600;
+	hints.skip_hours = {0, 1, 23};
+	hints.skip_days = {0, 6};
+	rsscache->set_refresh_hints("file://data/rss.xml", hints);
+	rsscache.reset(new Cache(dbfile.getPath(), &cfg));
+
+	const RefreshHints stored =
+		rsscache->get_refresh_hints("file://data/rss.xml");
+	REQUIRE(stored.min_interval == 3600);
+	REQUIRE(stored.skip_hours == hints.skip_hours);
+	REQUIRE(stored.skip_days == hints.skip_days);
+}
+
+TEST_CASE("get_recent_pubdates() returns publication times of the newest "
+	  "articles",
+	"[Cache]")
+{
+	ConfigContainer cfg;
+	Cache rsscache(":memory:", &cfg);
+	RssParser parser("file://data/rss.xml", &rsscache, &cfg, nullptr);
+	std::shared_ptr<RssFeed> feed = parser.parse();
+	rsscache.externalize_rssfeed(feed, false);
+
+	std::vector<time_t> expected;
+	for (const auto& item : feed->items()) {
+		expected.push_back(item->pubDate_timestamp());
+	}
+	std::sort(expected.rbegin(), expected.rend());
+	expected.resize(3);
+
+	REQUIRE(rsscache.get_recent_pubdates("file://data/rss.xml", 3) ==
+		expected);
+	REQUIRE(rsscache.get_recent_pubdates("file://data/rss.xml", 100)
+			.size() == 8);
+	REQUIRE(rsscache.get_recent_pubdates("file://data/not-in-cache.xml", 3)
+			.empty());
+}
+
 TEST_CASE("mark_all_read marks all items in the feed read", "[Cache]")
 {
 	std::shared_ptr<RssFeed> feed, test_feed;
@@ -444,6 +636,33 @@ TEST_CASE("mark_item_deleted changes \"deleted\" flag of item with given GUID ",
 	REQUIRE(feed->total_item_count() == 7);
 }
 
+TEST_CASE("mark_feed_items_deleted handles quotes in feed URLs", "[Cache]")
+{
+	ConfigContainer cfg;
+	Cache rsscache(":memory:", &cfg);
+
+	const std::string feedurl = "http://example.com/it's-a-feed?q=\"x\"";
+	auto feed = std::make_shared<RssFeed>(&rsscache);
+	feed->set_rssurl(feedurl);
+	feed->set_title("Joe's \"favourite\" feed; DROP TABLE rss_item;");
+	auto item = std::make_shared<RssItem>(&rsscache);
+	item->set_guid("guid-with-'quote'");
+	item->set_title("It's an item");
+	feed->add_item(item);
+	rsscache.externalize_rssfeed(feed, false);
+
+	feed = rsscache.internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->title_raw() ==
+		"Joe's \"favourite\" feed; DROP TABLE rss_item;");
+	REQUIRE(feed->total_item_count() == 1);
+	REQUIRE(feed->items()[0]->title_raw() == "It's an item");
+
+	rsscache.mark_feed_items_deleted(feedurl);
+
+	feed = rsscache.internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 0);
+}
+
 TEST_CASE("mark_items_read_by_guid marks items with given GUIDs as unread ",
 	"[Cache]")
 {
@@ -479,6 +698,45 @@ TEST_CASE("mark_items_read_by_guid marks items with given GUIDs as unread ",
 		feed = rsscache->internalize_rssfeed(feedurl, nullptr);
 		REQUIRE(feed->unread_item_count() == 6);
 	}
+
+	SECTION("Returns the number of items that were unread before")
+	{
+		const std::vector<std::string> guids = {
+			feed->items()[0]->guid(), "no-such-guid"};
+		rsscache->externalize_rssfeed(feed, false);
+
+		REQUIRE(rsscache->mark_items_read_by_guid(guids) == 1);
+		REQUIRE(rsscache->mark_items_read_by_guid(guids) == 0);
+	}
+}
+
+TEST_CASE("for_each_read_item_guid calls back with GUIDs of read items",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	Cache rsscache(dbfile.getPath(), &cfg);
+	RssParser parser("file://data/rss.xml", &rsscache, &cfg, nullptr);
+	std::shared_ptr<RssFeed> feed = parser.parse();
+	rsscache.externalize_rssfeed(feed, false);
+
+	std::vector<std::string> guids;
+	const auto collect = [&guids](const std::string& guid) {
+		guids.push_back(guid);
+	};
+
+	rsscache.for_each_read_item_guid(collect);
+	REQUIRE(guids.empty());
+
+	// Changes that are still queued up are exported, too
+	feed->items()[1]->set_unread(false);
+	feed->items()[3]->set_unread(false);
+	rsscache.for_each_read_item_guid(collect);
+	std::sort(guids.begin(), guids.end());
+	std::vector<std::string> expected = {
+		feed->items()[1]->guid(), feed->items()[3]->guid()};
+	std::sort(expected.begin(), expected.end());
+	REQUIRE(guids == expected);
 }
 
 TEST_CASE(
@@ -524,6 +782,61 @@ TEST_CASE(
 	REQUIRE(feed->total_item_count() == 6);
 }
 
+TEST_CASE("Bulk GUID operations accept sets larger than SQLite's limits",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	Cache rsscache(dbfile.getPath(), &cfg);
+	auto feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, &rsscache, &cfg, nullptr);
+	std::shared_ptr<RssFeed> feed = parser.parse();
+	rsscache.externalize_rssfeed(feed, false);
+
+	// Way more than SQLITE_MAX_VARIABLE_NUMBER or the expression depth
+	// limit, with only a couple of real GUIDs among them.
+	std::vector<std::string> guids;
+	for (int i = 0; i < 50000; ++i) {
+		guids.push_back("not-a-guid-" + std::to_string(i));
+	}
+	guids.push_back(feed->items()[1]->guid());
+	guids.push_back(feed->items()[4]->guid());
+
+	SECTION("mark_items_read_by_guid")
+	{
+		REQUIRE_NOTHROW(rsscache.mark_items_read_by_guid(guids));
+
+		feed = rsscache.internalize_rssfeed(feedurl, nullptr);
+		REQUIRE(feed->unread_item_count() == 6);
+		REQUIRE_FALSE(feed->items()[1]->unread());
+		REQUIRE_FALSE(feed->items()[4]->unread());
+	}
+
+	SECTION("remove_old_deleted_items")
+	{
+		for (const auto& item : feed->items()) {
+			rsscache.mark_item_deleted(item->guid(), true);
+		}
+
+		REQUIRE_NOTHROW(
+			rsscache.remove_old_deleted_items(feedurl, guids));
+
+		for (const auto& item : feed->items()) {
+			rsscache.mark_item_deleted(item->guid(), false);
+		}
+		feed = rsscache.internalize_rssfeed(feedurl, nullptr);
+		REQUIRE(feed->total_item_count() == 2);
+	}
+
+	SECTION("search_in_items")
+	{
+		std::unordered_set<std::string> guid_set(
+			guids.begin(), guids.end());
+		const auto found = rsscache.search_in_items("", guid_set);
+		REQUIRE(found.size() == 2);
+	}
+}
+
 TEST_CASE("search_for_items finds all items with matching title or content",
 	"[Cache]")
 {
@@ -802,6 +1115,54 @@ TEST_CASE(
 	}
 }
 
+TEST_CASE(
+	"externalize_rssfeed deletes stored items over `max-items`, "
+	"but not the flagged ones",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	std::unique_ptr<ConfigContainer> cfg(new ConfigContainer());
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), cfg.get()));
+
+	const auto feedurl = "file://data/rss.xml";
+	const auto parse = [&]() {
+		RssParser parser(feedurl, rsscache.get(), cfg.get(), nullptr);
+		return parser.parse();
+	};
+	auto feed = parse();
+	REQUIRE(feed->total_item_count() == 8);
+	feed->items()[6]->set_flags("a");
+	rsscache->externalize_rssfeed(feed, false);
+	rsscache->update_rssitem_flags(feed->items()[6].get());
+
+	// Lowering the limit doesn't delete anything until the feed is reloaded
+	cfg->set_configvalue("max-items", "2");
+	rsscache.reset(new Cache(dbfile.getPath(), cfg.get()));
+	feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 3);
+
+	cfg.reset(new ConfigContainer());
+	rsscache.reset(new Cache(dbfile.getPath(), cfg.get()));
+	feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 8);
+
+	cfg->set_configvalue("max-items", "2");
+	rsscache->externalize_rssfeed(parse(), false);
+
+	cfg.reset(new ConfigContainer());
+	rsscache.reset(new Cache(dbfile.getPath(), cfg.get()));
+	feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 3);
+	REQUIRE(rsscache->get_feed_counts()[feedurl].total == 3);
+	unsigned int flagged_count = 0;
+	for (const auto& item : feed->items()) {
+		if (item->flags() != "") {
+			flagged_count++;
+		}
+	}
+	REQUIRE(flagged_count == 1);
+}
+
 TEST_CASE(
 	"internalize_rssfeed returns feed without items but specified RSS URL",
 	"[Cache]")
@@ -836,6 +1197,147 @@ TEST_CASE("internalize_rssfeed doesn't return items that are ignored",
 	REQUIRE(feed->total_item_count() == 2);
 }
 
+TEST_CASE("internalize_rssfeeds returns the same feeds as internalize_rssfeed",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	Cache rsscache(dbfile.getPath(), &cfg);
+
+	const std::vector<std::string> stored_urls = {
+		"file://data/rss092_1.xml", "file://data/atom10_1.xml"};
+	for (const auto& url : stored_urls) {
+		RssParser parser(url, &rsscache, &cfg, nullptr);
+		rsscache.externalize_rssfeed(parser.parse(), false);
+	}
+
+	const std::vector<std::string> urls = {"file://data/atom10_1.xml",
+		"query:Unread:unread = \"yes\"",
+		"http://example.com/not-in-cache.xml",
+		"file://data/rss092_1.xml"};
+
+	RssIgnores ign;
+	ign.handle_action("ignore-article", {"*", "title =~ \"third\""});
+	cfg.set_configvalue("max-items", "2");
+
+	const auto feeds = rsscache.internalize_rssfeeds(urls, &ign);
+	REQUIRE(feeds.size() == urls.size());
+	for (unsigned int i = 0; i < urls.size(); ++i) {
+		INFO("URL: " << urls[i]);
+		const auto expected = rsscache.internalize_rssfeed(urls[i], &ign);
+		const auto& actual = feeds[i];
+		REQUIRE(actual->rssurl() == expected->rssurl());
+		REQUIRE(actual->title_raw() == expected->title_raw());
+		REQUIRE(actual->link() == expected->link());
+		REQUIRE(actual->total_item_count() ==
+			expected->total_item_count());
+		for (unsigned int j = 0; j < expected->total_item_count(); ++j) {
+			REQUIRE(actual->items()[j]->guid() ==
+				expected->items()[j]->guid());
+			REQUIRE(actual->items()[j]->feedurl() == urls[i]);
+			REQUIRE(actual->items()[j]->get_feedptr() == actual);
+		}
+	}
+
+	REQUIRE(feeds[0]->total_item_count() == 2);
+	REQUIRE(feeds[1]->is_query_feed());
+	REQUIRE(feeds[2]->total_item_count() == 0);
+	REQUIRE(feeds[3]->total_item_count() == 2);
+}
+
+TEST_CASE("internalize_rssfeed_counts doesn't read items until they're used",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	Cache rsscache(dbfile.getPath(), &cfg);
+
+	const std::string feedurl("file://data/rss092_1.xml");
+	{
+		RssParser parser(feedurl, &rsscache, &cfg, nullptr);
+		auto feed = parser.parse();
+		feed->items()[0]->set_unread_nowrite(false);
+		rsscache.externalize_rssfeed(feed, false);
+	}
+
+	RssIgnores ign;
+	ign.handle_action("ignore-article",
+		{"http://example.com/other.xml", "title =~ \"third\""});
+
+	const std::vector<std::string> urls = {feedurl,
+		"query:Unread:unread = \"yes\"",
+		"http://example.com/not-in-cache.xml"};
+	const auto feeds = rsscache.internalize_rssfeed_counts(urls, &ign);
+	REQUIRE(feeds.size() == 3);
+
+	const auto feed = feeds[0];
+	REQUIRE(feed->title_raw() == "Example Channel");
+	REQUIRE(feed->unread_item_count() == 2);
+	REQUIRE(feed->total_item_count() == 3);
+	REQUIRE(feed->get_attribute("total_count") == "3");
+
+	REQUIRE(feeds[1]->is_query_feed());
+	REQUIRE(feeds[2]->total_item_count() == 0);
+
+	SECTION("Items are loaded on first access")
+	{
+		REQUIRE(feed->items().size() == 3);
+		REQUIRE(feed->total_item_count() == 3);
+		for (const auto& item : feed->items()) {
+			REQUIRE(item->get_feedptr() == feed);
+			REQUIRE(item->feedurl() == feedurl);
+		}
+		REQUIRE(feeds[2]->items().empty());
+	}
+
+	SECTION("Marking all items read doesn't need to load them")
+	{
+		rsscache.mark_all_read(feedurl);
+		feed->mark_all_items_read();
+		REQUIRE(feed->unread_item_count() == 0);
+		REQUIRE(feed->total_item_count() == 3);
+
+		REQUIRE(feed->items().size() == 3);
+		REQUIRE(feed->unread_item_count() == 0);
+	}
+}
+
+TEST_CASE("internalize_rssfeed_counts counts feeds with ignores or max-items "
+	  "like internalize_rssfeeds",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	Cache rsscache(dbfile.getPath(), &cfg);
+
+	const std::vector<std::string> urls = {
+		"file://data/rss092_1.xml", "file://data/rss.xml"};
+	for (const auto& url : urls) {
+		RssParser parser(url, &rsscache, &cfg, nullptr);
+		auto feed = parser.parse();
+		feed->items()[0]->set_unread_nowrite(false);
+		rsscache.externalize_rssfeed(feed, false);
+	}
+
+	RssIgnores ign;
+	ign.handle_action("ignore-article", {urls[0], "title =~ \"third\""});
+	// Read from the cache without trimming it, like after lowering
+	// `max-items`
+	cfg.set_configvalue("max-items", "5");
+
+	const auto lazy = rsscache.internalize_rssfeed_counts(urls, &ign);
+	const auto eager = rsscache.internalize_rssfeeds(urls, &ign);
+	REQUIRE(lazy.size() == eager.size());
+	for (unsigned int i = 0; i < lazy.size(); ++i) {
+		REQUIRE(lazy[i]->total_item_count() ==
+			eager[i]->total_item_count());
+		REQUIRE(lazy[i]->unread_item_count() ==
+			eager[i]->unread_item_count());
+	}
+	REQUIRE(lazy[0]->total_item_count() == 2);
+	REQUIRE(lazy[1]->total_item_count() == 5);
+}
+
 TEST_CASE(
 	"externalize_rssfeed resets \"unread\" field if item's content "
 	"changed and reset_unread = \"yes\"",
@@ -1047,3 +1549,1309 @@ TEST_CASE("search_in_items returns empty set if input set is empty", "[Cache]")
 	const guids result = rsscache.search_in_items("Botox", empty);
 	REQUIRE(result.empty());
 }
+
+TEST_CASE("Upgrading from schema 2.11 keeps articles with duplicate GUIDs",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+	const auto feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, rsscache.get(), &cfg, nullptr);
+	std::shared_ptr<RssFeed> feed = parser.parse();
+	rsscache->externalize_rssfeed(feed, false);
+	const auto guid = feed->items()[0]->guid();
+	rsscache.reset();
+
+	// Turn the database back into a 2.11 one, which allowed duplicate GUIDs
+	sqlite3* db = nullptr;
+	REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) == SQLITE_OK);
+	downgrade_to_2_11(db);
+	const std::string duplicate =
+		"INSERT INTO rss_item (guid, title, author, url, feedurl, "
+		"pubDate, content, unread, flags) "
+		"SELECT guid, 'Duplicate', author, url, feedurl, pubDate, "
+		"content, 0, 'a' FROM rss_item;";
+	const int rc =
+		sqlite3_exec(db, duplicate.c_str(), nullptr, nullptr, nullptr);
+	sqlite3_close(db);
+	REQUIRE(rc == SQLITE_OK);
+
+	// Neither copy is deleted, nor is its state lost
+	rsscache.reset(new Cache(dbfile.getPath(), &cfg));
+	feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 16);
+	REQUIRE(feed->unread_item_count() == 8);
+	unsigned int flagged = 0;
+	for (const auto& item : feed->items()) {
+		if (item->guid() == guid && item->flags() == "a") {
+			REQUIRE(item->title_raw() == "Duplicate");
+			flagged++;
+		}
+	}
+	REQUIRE(flagged == 1);
+
+	RssParser reloader(feedurl, rsscache.get(), &cfg, nullptr);
+	REQUIRE_NOTHROW(
+		rsscache->externalize_rssfeed(reloader.parse(), false));
+	feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 16);
+}
+
+TEST_CASE("search_for_items matches words in title, author and content",
+	"[Cache]")
+{
+	ConfigContainer cfg;
+	Cache rsscache(":memory:", &cfg);
+
+	auto feed = std::make_shared<RssFeed>(&rsscache);
+	feed->set_rssurl("http://example.com/feed.xml");
+	const auto add_item = [&](const std::string& guid,
+				      const std::string& title,
+				      const std::string& author,
+				      const std::string& content,
+				      time_t pubDate) {
+		auto item = std::make_shared<RssItem>(&rsscache);
+		item->set_guid(guid);
+		item->set_title(title);
+		item->set_author(author);
+		item->set_description(content);
+		item->set_pubDate(pubDate);
+		feed->add_item(item);
+	};
+	add_item("1", "Walrus spotted", "Jane", "<p>Nothing else</p>", 100);
+	add_item("2", "Weather", "Wally", "<p>Sunny</p>", 200);
+	add_item("3", "News", "John", "<p>A walrus, again</p>", 300);
+	add_item("4", "C++ news", "John", "<p>Templates</p>", 400);
+	add_item("5", "Cat pictures", "Jane", "<p>Meow</p>", 500);
+	rsscache.externalize_rssfeed(feed, false);
+
+	const auto guids_of = [](
+		const std::vector<std::shared_ptr<RssItem>>& items) {
+		std::vector<std::string> result;
+		for (const auto& item : items) {
+			result.push_back(item->guid());
+		}
+		return result;
+	};
+
+	SECTION("Words are matched case-insensitively and by prefix")
+	{
+		const auto items = rsscache.search_for_items("wal", "");
+		REQUIRE(guids_of(items) ==
+			std::vector<std::string>({"3", "2", "1"}));
+	}
+
+	SECTION("Results can be ordered by relevance")
+	{
+		cfg.set_configvalue("search-result-order", "relevance");
+		const auto items = rsscache.search_for_items("walrus", "");
+		REQUIRE(guids_of(items) ==
+			std::vector<std::string>({"1", "3"}));
+	}
+
+	SECTION("Phrases without any words are still found")
+	{
+		const auto items = rsscache.search_for_items("++", "");
+		REQUIRE(guids_of(items) == std::vector<std::string>({"4"}));
+	}
+
+	SECTION("Punctuation isn't dropped from phrases with words")
+	{
+		const auto items = rsscache.search_for_items("c++", "");
+		REQUIRE(guids_of(items) == std::vector<std::string>({"4"}));
+		REQUIRE(rsscache.search_in_items("c++", {"4", "5"}) ==
+			std::unordered_set<std::string>({"4"}));
+	}
+
+	SECTION("Index is updated along with the articles")
+	{
+		feed->items()[0]->set_title("Seal spotted");
+		rsscache.externalize_rssfeed(feed, false);
+		REQUIRE(guids_of(rsscache.search_for_items("walrus", "")) ==
+			std::vector<std::string>({"3"}));
+		REQUIRE(guids_of(rsscache.search_for_items("seal", "")) ==
+			std::vector<std::string>({"1"}));
+	}
+}
+
+TEST_CASE("Reads aren't blocked by a write that is in progress", "[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	Cache rsscache(dbfile.getPath(), &cfg);
+	RssParser parser("file://data/rss.xml", &rsscache, &cfg, nullptr);
+	std::shared_ptr<RssFeed> feed = parser.parse();
+	rsscache.externalize_rssfeed(feed, false);
+	REQUIRE(rsscache.get_unread_count() == 8);
+
+	sqlite3* db = nullptr;
+	REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) == SQLITE_OK);
+
+	std::string journal_mode;
+	REQUIRE(sqlite3_exec(db,
+			"PRAGMA journal_mode;",
+			[](void* mode, int, char** argv, char**) {
+				*static_cast<std::string*>(mode) = argv[0];
+				return 0;
+			},
+			&journal_mode,
+			nullptr) == SQLITE_OK);
+	REQUIRE(journal_mode == "wal");
+
+	// Hold a write transaction open, like a reload thread would
+	REQUIRE(sqlite3_exec(db,
+			"BEGIN IMMEDIATE;"
+			"UPDATE rss_item SET unread = 0;",
+			nullptr,
+			nullptr,
+			nullptr) == SQLITE_OK);
+
+	// Readers see the last committed state instead of waiting
+	REQUIRE(rsscache.get_unread_count() == 8);
+	REQUIRE(rsscache.get_read_item_guids().empty());
+	REQUIRE(rsscache.search_for_items("Botox", "").size() == 1);
+
+	REQUIRE(sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) ==
+		SQLITE_OK);
+	sqlite3_close(db);
+
+	REQUIRE(rsscache.get_unread_count() == 0);
+	REQUIRE(rsscache.get_read_item_guids().size() == 8);
+}
+
+TEST_CASE("Per-feed article counts are kept up to date", "[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	Cache rsscache(dbfile.getPath(), &cfg);
+
+	const std::string feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, &rsscache, &cfg, nullptr);
+	std::shared_ptr<RssFeed> feed = parser.parse();
+	feed->items()[0]->set_unread_nowrite(false);
+	rsscache.externalize_rssfeed(feed, false);
+
+	const auto counts_of = [&](const std::string& url) {
+		const auto counts = rsscache.get_feed_counts();
+		const auto it = counts.find(url);
+		REQUIRE(it != counts.end());
+		return std::make_pair(it->second.unread, it->second.total);
+	};
+
+	REQUIRE(counts_of(feedurl) == std::make_pair(7u, 8u));
+	REQUIRE(rsscache.get_unread_count() == 7);
+
+	SECTION("Reading an article")
+	{
+		feed->items()[1]->set_unread(false);
+		REQUIRE(counts_of(feedurl) == std::make_pair(6u, 8u));
+	}
+
+	SECTION("Deleting an article")
+	{
+		rsscache.mark_item_deleted(feed->items()[1]->guid(), true);
+		REQUIRE(counts_of(feedurl) == std::make_pair(6u, 7u));
+		rsscache.mark_item_deleted(feed->items()[1]->guid(), false);
+		REQUIRE(counts_of(feedurl) == std::make_pair(7u, 8u));
+	}
+
+	SECTION("Marking the feed read, then deleting all its articles")
+	{
+		rsscache.mark_all_read(feedurl);
+		REQUIRE(counts_of(feedurl) == std::make_pair(0u, 8u));
+		rsscache.mark_feed_items_deleted(feedurl);
+		REQUIRE(counts_of(feedurl) == std::make_pair(0u, 0u));
+	}
+
+	SECTION("Reloading a feed with changed articles")
+	{
+		feed->items()[0]->set_description("changed");
+		rsscache.externalize_rssfeed(feed, true);
+		REQUIRE(counts_of(feedurl) == std::make_pair(8u, 8u));
+	}
+
+	REQUIRE(rsscache.check_feed_counts());
+}
+
+TEST_CASE("rebuild_feed_counts fixes counts that check_feed_counts rejects",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+	const std::string feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, rsscache.get(), &cfg, nullptr);
+	rsscache->externalize_rssfeed(parser.parse(), false);
+	REQUIRE(rsscache->check_feed_counts());
+
+	sqlite3* db = nullptr;
+	REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) == SQLITE_OK);
+
+	SECTION("Counts went wrong")
+	{
+		REQUIRE(sqlite3_exec(db,
+				"UPDATE rss_feed_counts SET unread_count = 100;",
+				nullptr,
+				nullptr,
+				nullptr) == SQLITE_OK);
+		sqlite3_close(db);
+
+		REQUIRE_FALSE(rsscache->check_feed_counts());
+		REQUIRE(rsscache->get_unread_count() == 100);
+		rsscache->rebuild_feed_counts();
+		REQUIRE(rsscache->check_feed_counts());
+		REQUIRE(rsscache->get_unread_count() == 8);
+	}
+
+	SECTION("Upgrading from schema 2.11 counts existing articles")
+	{
+		rsscache.reset();
+		downgrade_to_2_11(db);
+		sqlite3_close(db);
+
+		rsscache.reset(new Cache(dbfile.getPath(), &cfg));
+		REQUIRE(rsscache->check_feed_counts());
+		REQUIRE(rsscache->get_unread_count() == 8);
+	}
+}
+
+TEST_CASE("Articles are told apart even if their GUID hashes collide",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+	const std::string feedurl = "http://example.com/feed.xml";
+
+	const auto make_feed = [&](const std::string& title) {
+		auto feed = std::make_shared<RssFeed>(rsscache.get());
+		feed->set_rssurl(feedurl);
+		auto item = std::make_shared<RssItem>(rsscache.get());
+		item->set_guid("first");
+		item->set_title(title);
+		item->set_description("Some content");
+		feed->add_item(item);
+		return feed;
+	};
+	rsscache->externalize_rssfeed(make_feed("First"), false);
+	rsscache.reset();
+
+	// Add an article whose GUID is different but has the same hash
+	sqlite3* db = nullptr;
+	REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) == SQLITE_OK);
+	add_content_text_function(db);
+	const int rc = sqlite3_exec(db,
+			"INSERT INTO rss_item (guid, guid_hash, title, author, "
+			"url, feedurl, feed_id, pubDate, content, unread) "
+			"SELECT 'second', guid_hash, 'Second', '', '', feedurl, "
+			"feed_id, pubDate, content, 1 FROM rss_item;",
+			nullptr,
+			nullptr,
+			nullptr);
+	sqlite3_close(db);
+	REQUIRE(rc == SQLITE_OK);
+
+	rsscache.reset(new Cache(dbfile.getPath(), &cfg));
+	auto feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 2);
+
+	rsscache->externalize_rssfeed(make_feed("Updated"), false);
+	rsscache->mark_items_read_by_guid({"first"});
+	rsscache->mark_item_deleted("first", true);
+
+	const std::unordered_set<std::string> guids = {"first"};
+	REQUIRE(rsscache->search_in_items("content", guids) == guids);
+
+	feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 1);
+	REQUIRE(feed->items()[0]->guid() == "second");
+	REQUIRE(feed->items()[0]->title_raw() == "Second");
+	REQUIRE(feed->items()[0]->unread());
+
+	rsscache->mark_item_deleted("first", false);
+	feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 2);
+	REQUIRE(feed->get_item_by_guid("first")->title_raw() == "Updated");
+	REQUIRE_FALSE(feed->get_item_by_guid("first")->unread());
+}
+
+TEST_CASE("Upgrading from schema 2.11 assigns feed ids and GUID hashes",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+	const std::string feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, rsscache.get(), &cfg, nullptr);
+	std::shared_ptr<RssFeed> feed = parser.parse();
+	rsscache->externalize_rssfeed(feed, false);
+	const auto guid = feed->items()[0]->guid();
+	rsscache.reset();
+
+	sqlite3* db = nullptr;
+	REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) == SQLITE_OK);
+	downgrade_to_2_11(db);
+	// An article whose feed is gone, which is dropped by the upgrade
+	const int rc = sqlite3_exec(db,
+			"INSERT INTO rss_item (guid, title, author, url, "
+			"feedurl, pubDate, content, unread) "
+			"VALUES ('orphan', 'Orphan', '', '', "
+			"'http://example.com/gone.xml', 0, '', 1);",
+			nullptr,
+			nullptr,
+			nullptr);
+	sqlite3_close(db);
+	REQUIRE(rc == SQLITE_OK);
+
+	rsscache.reset(new Cache(dbfile.getPath(), &cfg));
+	feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 8);
+	REQUIRE(rsscache->get_unread_count() == 8);
+	REQUIRE(rsscache->check_feed_counts());
+	REQUIRE(rsscache->get_read_item_guids().empty());
+	REQUIRE(rsscache->search_for_items("Orphan", "").empty());
+
+	rsscache->mark_item_deleted(guid, true);
+	feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 7);
+
+	// Vacuuming must not renumber feeds, or articles would lose them
+	rsscache->do_vacuum();
+	rsscache->mark_item_deleted(guid, false);
+	feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 8);
+}
+
+TEST_CASE("Schema patch that fails is rolled back", "[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+	const std::string feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, rsscache.get(), &cfg, nullptr);
+	rsscache->externalize_rssfeed(parser.parse(), false);
+	rsscache.reset();
+
+	// A feed without a title, which can't be copied into the rss_feed
+	// table that 2.13 rebuilds
+	sqlite3* db = nullptr;
+	REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) == SQLITE_OK);
+	downgrade_to_2_11(db);
+	REQUIRE(sqlite3_exec(db,
+			"CREATE TABLE loose_feed AS SELECT * FROM rss_feed;"
+			"DROP TABLE rss_feed;"
+			"ALTER TABLE loose_feed RENAME TO rss_feed;"
+			"INSERT INTO rss_feed (rssurl, url, title) "
+			"VALUES ('http://example.com/feed.xml', '', NULL);",
+			nullptr,
+			nullptr,
+			nullptr) == SQLITE_OK);
+	sqlite3_close(db);
+
+	REQUIRE_THROWS_AS(
+		rsscache.reset(new Cache(dbfile.getPath(), &cfg)), DbException);
+
+	REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) == SQLITE_OK);
+	std::vector<std::string> rows;
+	const int rc = sqlite3_exec(db,
+			"SELECT db_schema_version_minor FROM metadata;"
+			"SELECT count(*) FROM rss_feed;"
+			"SELECT count(*) FROM sqlite_master "
+			"WHERE name = 'rss_feed_new';",
+			[](void* rows, int, char** argv, char**) {
+				static_cast<std::vector<std::string>*>(rows)
+				->push_back(argv[0]);
+				return 0;
+			},
+			&rows,
+			nullptr);
+	sqlite3_close(db);
+	REQUIRE(rc == SQLITE_OK);
+	// None of the patch was applied, and the feeds are all there
+	REQUIRE(rows == std::vector<std::string>({"11", "2", "0"}));
+}
+
+TEST_CASE("Compressed article contents are read back unchanged", "[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	cfg.set_configvalue("compress-cache", "yes");
+	Cache rsscache(dbfile.getPath(), &cfg);
+
+	const std::string feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, &rsscache, &cfg, nullptr);
+	std::shared_ptr<RssFeed> feed = parser.parse();
+	std::map<std::string, std::string> contents;
+	for (const auto& item : feed->items()) {
+		contents[item->guid()] = item->description_raw();
+	}
+	rsscache.externalize_rssfeed(feed, false);
+
+	sqlite3* db = nullptr;
+	REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) == SQLITE_OK);
+	int compressed = 0;
+	const int rc = sqlite3_exec(db,
+			"SELECT count(*) FROM rss_item WHERE content_format != 0;",
+			[](void* count, int, char** argv, char**) {
+				*static_cast<int*>(count) = std::stoi(argv[0]);
+				return 0;
+			},
+			&compressed,
+			nullptr);
+	sqlite3_close(db);
+	REQUIRE(rc == SQLITE_OK);
+	REQUIRE(compressed > 0);
+
+	feed = rsscache.internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 8);
+	feed->unload();
+	feed->load();
+	for (const auto& item : feed->items()) {
+		REQUIRE(item->description_raw() == contents[item->guid()]);
+	}
+
+	REQUIRE(rsscache.search_for_items("Botox", "").size() == 1);
+	std::unordered_set<std::string> guids;
+	for (const auto& item : feed->items()) {
+		guids.insert(item->guid());
+	}
+	REQUIRE(rsscache.search_in_items("Botox", guids).size() == 1);
+	REQUIRE(rsscache.search_in_items("<", guids).size() > 0);
+
+	// Reloading unchanged articles doesn't make them unread again
+	rsscache.mark_all_read(feedurl);
+	rsscache.externalize_rssfeed(parser.parse(), true);
+	feed = rsscache.internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->unread_item_count() == 0);
+}
+
+TEST_CASE("recompress_content converts articles that are already cached",
+	"[Cache]")
+{
+	ConfigContainer cfg;
+	Cache rsscache(":memory:", &cfg);
+
+	const std::string feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, &rsscache, &cfg, nullptr);
+	std::shared_ptr<RssFeed> feed = parser.parse();
+	std::map<std::string, std::string> contents;
+	for (const auto& item : feed->items()) {
+		contents[item->guid()] = item->description_raw();
+	}
+	rsscache.externalize_rssfeed(feed, false);
+	feed = rsscache.internalize_rssfeed(feedurl, nullptr);
+	std::map<std::string, unsigned int> sizes;
+	for (const auto& item : feed->items()) {
+		sizes[item->guid()] = item->size();
+	}
+
+	cfg.set_configvalue("compress-cache", "yes");
+	const RecompressStats compressed = rsscache.recompress_content();
+	REQUIRE(compressed.articles == 8);
+	REQUIRE(compressed.bytes_after < compressed.bytes_before);
+
+	feed = rsscache.internalize_rssfeed(feedurl, nullptr);
+	feed->unload();
+	feed->load();
+	for (const auto& item : feed->items()) {
+		REQUIRE(item->description_raw() == contents[item->guid()]);
+		REQUIRE(item->size() == sizes[item->guid()]);
+	}
+
+	cfg.set_configvalue("compress-cache", "no");
+	const RecompressStats decompressed = rsscache.recompress_content();
+	REQUIRE(decompressed.articles == 8);
+	REQUIRE(decompressed.bytes_before == compressed.bytes_after);
+	REQUIRE(decompressed.bytes_after == compressed.bytes_before);
+	REQUIRE(decompressed.decode_time == 0.0);
+}
+
+TEST_CASE("Reloading unchanged articles doesn't write them again", "[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	Cache rsscache(dbfile.getPath(), &cfg);
+
+	const std::string feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, &rsscache, &cfg, nullptr);
+	rsscache.externalize_rssfeed(parser.parse(), false);
+
+	// Change the stored titles behind the cache's back, so that we can
+	// tell which articles were written again
+	sqlite3* db = nullptr;
+	REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) == SQLITE_OK);
+	add_content_text_function(db);
+	const int rc = sqlite3_exec(db,
+			"UPDATE rss_item SET title = 'Stale';",
+			nullptr,
+			nullptr,
+			nullptr);
+	sqlite3_close(db);
+	REQUIRE(rc == SQLITE_OK);
+
+	std::shared_ptr<RssFeed> feed = parser.parse();
+	const auto changed = feed->items()[0];
+	changed->set_title("Changed");
+	rsscache.externalize_rssfeed(feed, false);
+
+	feed = rsscache.internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->total_item_count() == 8);
+	for (const auto& item : feed->items()) {
+		if (item->guid() == changed->guid()) {
+			REQUIRE(item->title_raw() == "Changed");
+		} else {
+			REQUIRE(item->title_raw() == "Stale");
+		}
+	}
+}
+
+TEST_CASE("reset_unread only affects articles whose content changed",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+
+	const std::string feedurl = "file://data/rss.xml";
+	const auto parse = [&]() {
+		RssParser parser(feedurl, rsscache.get(), &cfg, nullptr);
+		return parser.parse();
+	};
+	rsscache->externalize_rssfeed(parse(), false);
+	rsscache->mark_all_read(feedurl);
+
+	SECTION("Articles that are in the cache already")
+	{
+	}
+
+	SECTION("Articles that were cached before schema 2.13")
+	{
+		rsscache.reset();
+		sqlite3* db = nullptr;
+		REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) ==
+			SQLITE_OK);
+		downgrade_to_2_11(db);
+		sqlite3_close(db);
+		rsscache.reset(new Cache(dbfile.getPath(), &cfg));
+	}
+
+	std::shared_ptr<RssFeed> feed = parse();
+	const std::string retitled = feed->items()[0]->guid();
+	const std::string rewritten = feed->items()[1]->guid();
+	feed->items()[0]->set_title("New title");
+	feed->items()[1]->set_description("New content");
+	rsscache->externalize_rssfeed(feed, true);
+
+	feed = rsscache->internalize_rssfeed(feedurl, nullptr);
+	REQUIRE(feed->unread_item_count() == 1);
+	REQUIRE(feed->get_item_by_guid(rewritten)->unread());
+	REQUIRE_FALSE(feed->get_item_by_guid(retitled)->unread());
+	REQUIRE(feed->get_item_by_guid(retitled)->title_raw() == "New title");
+}
+
+TEST_CASE("Changes to read state and flags are queued and written later",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+
+	const std::string feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, rsscache.get(), &cfg, nullptr);
+	rsscache->externalize_rssfeed(parser.parse(), false);
+
+	std::shared_ptr<RssFeed> feed =
+		rsscache->internalize_rssfeed(feedurl, nullptr);
+	const auto item = feed->items()[0];
+	const auto flagged = feed->items()[1];
+	for (int i = 0; i < 11; ++i) {
+		item->set_unread(!item->unread());
+	}
+	flagged->set_flags("ab");
+	flagged->update_flags();
+
+	// Queued changes are visible before they're written
+	const auto check = [&](Cache& cache) {
+		const auto feed = cache.internalize_rssfeed(feedurl, nullptr);
+		REQUIRE_FALSE(feed->get_item_by_guid(item->guid())->unread());
+		REQUIRE(feed->get_item_by_guid(flagged->guid())->flags() == "ab");
+		REQUIRE(cache.get_unread_count() == 7);
+	};
+	check(*rsscache);
+
+	SECTION("Changes are written when the cache is closed")
+	{
+		rsscache.reset();
+		Cache reopened(dbfile.getPath(), &cfg);
+		check(reopened);
+	}
+
+	SECTION("Changes are written by cleanup_cache")
+	{
+		std::vector<std::shared_ptr<RssFeed>> feeds = {feed};
+		rsscache->cleanup_cache(feeds);
+		rsscache.reset();
+		Cache reopened(dbfile.getPath(), &cfg);
+		check(reopened);
+	}
+
+	SECTION("Changes are written by flush_pending_changes")
+	{
+		rsscache->flush_pending_changes();
+
+		sqlite3* db = nullptr;
+		REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) ==
+			SQLITE_OK);
+		std::vector<std::string> rows;
+		const int rc = sqlite3_exec(db,
+				"SELECT unread || coalesce(flags, '') "
+				"FROM rss_item "
+				"WHERE unread = 0 OR flags != '';",
+				[](void* rows, int, char** argv, char**) {
+					static_cast<std::vector<std::string>*>(
+						rows)
+					->push_back(argv[0]);
+					return 0;
+				},
+				&rows,
+				nullptr);
+		sqlite3_close(db);
+		REQUIRE(rc == SQLITE_OK);
+		std::sort(rows.begin(), rows.end());
+		REQUIRE(rows == std::vector<std::string>({"0", "1ab"}));
+	}
+
+	SECTION("Changes that couldn't be written are queued again")
+	{
+		sqlite3* db = nullptr;
+		REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) ==
+			SQLITE_OK);
+		const auto exec = [&](const char* sql) {
+			REQUIRE(sqlite3_exec(
+					db, sql, nullptr, nullptr, nullptr) ==
+				SQLITE_OK);
+		};
+		exec("CREATE TRIGGER fail_updates BEFORE UPDATE ON rss_item "
+			"BEGIN SELECT RAISE(ABORT, 'disk on fire'); END;");
+		// The background writer may have written the changes by now
+		item->set_unread(true);
+		item->set_unread(false);
+
+		REQUIRE_THROWS_AS(
+			rsscache->flush_pending_changes(), DbException);
+		const auto queued =
+			rsscache->internalize_rssfeed(feedurl, nullptr);
+		REQUIRE_FALSE(queued->get_item_by_guid(item->guid())->unread());
+		REQUIRE(queued->get_item_by_guid(flagged->guid())->flags() ==
+			"ab");
+
+		exec("DROP TRIGGER fail_updates;");
+		sqlite3_close(db);
+
+		rsscache->flush_pending_changes();
+		rsscache.reset();
+		Cache reopened(dbfile.getPath(), &cfg);
+		check(reopened);
+	}
+}
+
+TEST_CASE("Changes committed while a read waits for the database aren't "
+	"applied over it again",
+	"[Cache]")
+{
+	ConfigContainer cfg;
+	// A single connection, so reads wait for writes to finish
+	Cache rsscache(":memory:", &cfg);
+	const std::string feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, &rsscache, &cfg, nullptr);
+	rsscache.externalize_rssfeed(parser.parse(), false);
+	const auto items = rsscache.internalize_rssitems(feedurl, nullptr);
+	const auto item = items[0];
+	const auto marker = items[1];
+
+	// Writing a feed holds the database until its item_mutex is free
+	RssParser other_parser(
+		"file://data/rss20_1.xml", &rsscache, &cfg, nullptr);
+	const auto blocker = other_parser.parse();
+
+	const auto pause = []() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	};
+	for (int i = 0; i < 20; ++i) {
+		item->set_unread_nowrite(true);
+		item->set_unread(false);
+		marker->set_unread_nowrite(false);
+		marker->set_unread(true);
+		rsscache.flush_pending_changes();
+
+		std::unique_lock<std::mutex> blocked(blocker->item_mutex);
+		std::thread writer(
+			[&]() { rsscache.externalize_rssfeed(blocker, false); });
+		pause();
+
+		// The read starts before the change is committed, but usually
+		// gets to the database only after the change was written and
+		// overwritten
+		item->set_unread(true);
+		std::thread overwriter([&]() {
+			rsscache.flush_pending_changes();
+			rsscache.mark_items_read_by_guid(
+				{item->guid(), marker->guid()});
+		});
+		pause();
+		std::vector<std::shared_ptr<RssItem>> read;
+		std::thread reader([&]() {
+			read = rsscache.internalize_rssitems(feedurl, nullptr);
+		});
+		pause();
+
+		blocked.unlock();
+		overwriter.join();
+		reader.join();
+		writer.join();
+
+		const auto find = [&](const std::string& guid) {
+			return *std::find_if(read.begin(),
+					read.end(),
+					[&](const std::shared_ptr<RssItem>& it) {
+						return it->guid() == guid;
+					});
+		};
+		// If the read saw the marker as read, it saw the article being
+		// marked read, too
+		if (!find(marker->guid())->unread()) {
+			REQUIRE_FALSE(find(item->guid())->unread());
+		}
+	}
+}
+
+TEST_CASE("Read-only cache reads while another Cache is writing", "[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	Cache writer(dbfile.getPath(), &cfg);
+	const std::string feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, &writer, &cfg, nullptr);
+	std::shared_ptr<RssFeed> feed = parser.parse();
+	writer.externalize_rssfeed(feed, false);
+
+	Cache reader(dbfile.getPath(), &cfg, CacheMode::READ_ONLY);
+	REQUIRE(reader.get_unread_count() == 8);
+	REQUIRE(reader.get_read_item_guids().empty());
+
+	SECTION("Sees changes once they're committed")
+	{
+		writer.mark_items_read_by_guid({feed->items()[0]->guid()});
+		REQUIRE(reader.get_unread_count() == 7);
+		REQUIRE(reader.get_read_item_guids() ==
+			std::vector<std::string>({feed->items()[0]->guid()}));
+		REQUIRE(reader.check_feed_counts());
+	}
+
+	SECTION("Doesn't change the database")
+	{
+		REQUIRE_THROWS_AS(reader.mark_all_read(), DbException);
+
+		feed->items()[0]->set_unread_nowrite(false);
+		reader.update_rssitem_unread_and_enqueued(
+			feed->items()[0], feedurl);
+		reader.flush_pending_changes();
+		REQUIRE(writer.get_unread_count() == 8);
+	}
+}
+
+TEST_CASE("Read-only cache can't be opened if it would have to be changed",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+
+	SECTION("Cache file doesn't exist")
+	{
+		REQUIRE_THROWS_AS(
+			Cache(dbfile.getPath(), &cfg, CacheMode::READ_ONLY),
+			DbException);
+	}
+
+	SECTION("Cache has an older schema")
+	{
+		Cache(dbfile.getPath(), &cfg);
+
+		sqlite3* db = nullptr;
+		REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) ==
+			SQLITE_OK);
+		const int rc = sqlite3_exec(db,
+				"UPDATE metadata "
+				"SET db_schema_version_minor = 11;",
+				nullptr,
+				nullptr,
+				nullptr);
+		sqlite3_close(db);
+		REQUIRE(rc == SQLITE_OK);
+
+		REQUIRE_THROWS_AS(
+			Cache(dbfile.getPath(), &cfg, CacheMode::READ_ONLY),
+			std::runtime_error);
+	}
+}
+
+TEST_CASE("archive_old_items moves old read articles to the archive",
+	"[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	cfg.set_configvalue("archive-articles-days", "1");
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+
+	const std::string feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, rsscache.get(), &cfg, nullptr);
+	const std::shared_ptr<RssFeed> parsed = parser.parse();
+	rsscache->externalize_rssfeed(parsed, false);
+	const auto items = parsed->items();
+
+	rsscache->mark_items_read_by_guid(
+		{items[0]->guid(), items[1]->guid(), items[2]->guid()});
+	// Flagged articles aren't archived
+	items[2]->set_flags("a");
+	rsscache->update_rssitem_flags(items[2].get());
+
+	REQUIRE(rsscache->archive_old_items(1) == 1);
+	REQUIRE(rsscache->archive_old_items(100) == 1);
+	REQUIRE(rsscache->archive_old_items(100) == 0);
+
+	const auto check_archived = [&]() {
+		const auto feed =
+			rsscache->internalize_rssfeed(feedurl, nullptr);
+		REQUIRE(feed->total_item_count() == 6);
+		REQUIRE(feed->unread_item_count() == 5);
+		// Unknown GUIDs get an empty dummy article
+		const auto archived = feed->get_item_by_guid(items[0]->guid());
+		REQUIRE(archived->guid().empty());
+		REQUIRE(rsscache->check_feed_counts());
+	};
+	check_archived();
+
+	SECTION("Searches and exports include archived articles")
+	{
+		auto results = rsscache->search_for_items("saxxi", "");
+		REQUIRE(results.size() == 1);
+		REQUIRE(results[0]->guid() == items[0]->guid());
+		REQUIRE(rsscache->search_in_items("saxxi", {items[0]->guid()})
+			.size() == 1);
+
+		auto search_feed = std::make_shared<RssFeed>(rsscache.get());
+		search_feed->add_item(results[0]);
+		rsscache->fetch_descriptions(search_feed.get());
+		REQUIRE(results[0]->description_raw() ==
+			items[0]->description_raw());
+
+		REQUIRE(rsscache->get_read_item_guids().size() == 3);
+	}
+
+	SECTION("Reloads leave archived articles in the archive")
+	{
+		rsscache->externalize_rssfeed(parsed, false);
+		check_archived();
+	}
+
+	SECTION("Changing an archived article brings it back")
+	{
+		auto results = rsscache->search_for_items("saxxi", "");
+		REQUIRE(results.size() == 1);
+		results[0]->set_unread(true);
+		rsscache->flush_pending_changes();
+
+		const auto feed =
+			rsscache->internalize_rssfeed(feedurl, nullptr);
+		REQUIRE(feed->total_item_count() == 7);
+		REQUIRE(feed->get_item_by_guid(items[0]->guid())->unread());
+		REQUIRE(rsscache->search_for_items("saxxi", "").size() == 1);
+		REQUIRE(rsscache->check_feed_counts());
+	}
+
+	SECTION("Archived search results are ranked like the others")
+	{
+		sqlite3* db = nullptr;
+		const std::string archive = dbfile.getPath() + ".archive";
+		REQUIRE(sqlite3_open(archive.c_str(), &db) == SQLITE_OK);
+		std::string rank;
+		const int rc = sqlite3_exec(db,
+				"SELECT v FROM rss_item_fts_config "
+				"WHERE k = 'rank';",
+				[](void* rank, int, char** argv, char**) {
+					*static_cast<std::string*>(rank) =
+						argv[0];
+					return 0;
+				},
+				&rank,
+				nullptr);
+		sqlite3_close(db);
+		REQUIRE(rc == SQLITE_OK);
+		REQUIRE(rank == "bm25(10.0, 5.0, 1.0)");
+	}
+
+	SECTION("Articles left in both files are archived again")
+	{
+		// What a crash between writing the archive and the cache leaves
+		// behind, with a title that differs from the archived one
+		rsscache.reset();
+		sqlite3* db = nullptr;
+		REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) ==
+			SQLITE_OK);
+		add_content_text_function(db);
+		const std::string attach = "ATTACH DATABASE '" +
+			dbfile.getPath() + ".archive' AS archive;";
+		REQUIRE(sqlite3_exec(db,
+				(attach +
+					"INSERT INTO main.rss_item "
+					"SELECT * FROM archive.rss_item "
+					"WHERE title = 'Teh Saxxi';"
+					"UPDATE main.rss_item "
+					"SET title = 'Teh Zither' "
+					"WHERE title = 'Teh Saxxi';")
+				.c_str(),
+				nullptr,
+				nullptr,
+				nullptr) == SQLITE_OK);
+		sqlite3_close(db);
+		rsscache.reset(new Cache(dbfile.getPath(), &cfg));
+
+		REQUIRE(rsscache->archive_old_items(100) == 1);
+		check_archived();
+		REQUIRE(rsscache->search_for_items("saxxi", "").empty());
+		REQUIRE(rsscache->search_for_items("zither", "").size() == 1);
+
+		const std::string archive = dbfile.getPath() + ".archive";
+		REQUIRE(sqlite3_open(archive.c_str(), &db) == SQLITE_OK);
+		const int rc = sqlite3_exec(db,
+				"INSERT INTO rss_item_fts(rss_item_fts) "
+				"VALUES('integrity-check');",
+				nullptr,
+				nullptr,
+				nullptr);
+		sqlite3_close(db);
+		REQUIRE(rc == SQLITE_OK);
+	}
+
+	SECTION("recompress_content converts archived articles, too")
+	{
+		cfg.set_configvalue("compress-cache", "yes");
+		const RecompressStats compressed =
+			rsscache->recompress_content();
+		REQUIRE(compressed.articles == 8);
+
+		auto results = rsscache->search_for_items("saxxi", "");
+		REQUIRE(results.size() == 1);
+		auto search_feed = std::make_shared<RssFeed>(rsscache.get());
+		search_feed->add_item(results[0]);
+		rsscache->fetch_descriptions(search_feed.get());
+		REQUIRE(results[0]->description_raw() ==
+			items[0]->description_raw());
+	}
+
+	SECTION("The archive is still used once the setting is unset")
+	{
+		cfg.set_configvalue("archive-articles-days", "0");
+		rsscache.reset(new Cache(dbfile.getPath(), &cfg));
+		check_archived();
+		REQUIRE(rsscache->search_for_items("saxxi", "").size() == 1);
+	}
+}
+
+TEST_CASE("compact() gives free pages back a few at a time", "[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	const std::string feedurl = "http://example.com/feed.xml";
+
+	bool created_without_auto_vacuum = false;
+	SECTION("Cache created by this version")
+	{
+	}
+	SECTION("Caches created with an older version need a vacuum first")
+	{
+		created_without_auto_vacuum = true;
+		sqlite3* db = nullptr;
+		REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) ==
+			SQLITE_OK);
+		REQUIRE(sqlite3_exec(db,
+				"CREATE TABLE old_table (a INTEGER);",
+				nullptr,
+				nullptr,
+				nullptr) == SQLITE_OK);
+		sqlite3_close(db);
+	}
+
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+
+	auto feed = std::make_shared<RssFeed>(rsscache.get());
+	feed->set_rssurl(feedurl);
+	for (int i = 0; i < 200; ++i) {
+		auto item = std::make_shared<RssItem>(rsscache.get());
+		item->set_guid("item" + std::to_string(i));
+		item->set_title("Item " + std::to_string(i));
+		item->set_description(std::string(8000, 'a' + i % 26));
+		feed->add_item(item);
+	}
+	rsscache->externalize_rssfeed(feed, false);
+	rsscache->mark_feed_items_deleted(feedurl);
+	rsscache->remove_old_deleted_items(feedurl, {"none of them"});
+
+	if (created_without_auto_vacuum) {
+		REQUIRE(rsscache->compact(10) == 0);
+		rsscache->do_vacuum();
+		REQUIRE(rsscache->get_storage_stats().free_pages == 0);
+
+		rsscache->externalize_rssfeed(feed, false);
+		rsscache->mark_feed_items_deleted(feedurl);
+		rsscache->remove_old_deleted_items(feedurl, {"none of them"});
+	}
+
+	const StorageStats before = rsscache->get_storage_stats();
+	REQUIRE(before.free_pages > 10);
+
+	REQUIRE(rsscache->compact(10) == 10);
+	StorageStats after = rsscache->get_storage_stats();
+	REQUIRE(after.pages == before.pages - 10);
+	REQUIRE(after.free_pages == before.free_pages - 10);
+
+	rsscache->compact(before.free_pages);
+	after = rsscache->get_storage_stats();
+	REQUIRE(after.free_pages == 0);
+	REQUIRE(rsscache->compact(10) == 0);
+}
+
+TEST_CASE("get_query_stats() counts calls and rows of each query", "[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	cfg.set_configvalue("cache-query-stats", "yes");
+	Cache rsscache(dbfile.getPath(), &cfg);
+	const auto feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, &rsscache, &cfg, nullptr);
+	rsscache.externalize_rssfeed(parser.parse(), false);
+	rsscache.internalize_rssfeed(feedurl, nullptr);
+	rsscache.internalize_rssfeed(feedurl, nullptr);
+
+	const auto stats = rsscache.get_query_stats();
+	using Entry = std::pair<std::string, QueryStats>;
+	const auto find = [&](const std::string& prefix) {
+		const auto it = std::find_if(
+			stats.begin(), stats.end(), [&](const Entry& entry) {
+				return entry.first.compare(
+					0, prefix.size(), prefix) == 0;
+			});
+		REQUIRE(it != stats.end());
+		return it->second;
+	};
+
+	const QueryStats inserts = find("INSERT INTO rss_item (");
+	REQUIRE(inserts.calls == 8);
+	REQUIRE(inserts.rows_changed == 8);
+	REQUIRE(inserts.rows_returned == 0);
+
+	const QueryStats reads =
+		find("SELECT title, url, is_rtl FROM rss_feed");
+	REQUIRE(reads.calls == 2);
+	REQUIRE(reads.rows_returned == 2);
+	REQUIRE(reads.rows_changed == 0);
+	REQUIRE(reads.total_time >= reads.max_time);
+
+	for (size_t i = 1; i < stats.size(); ++i) {
+		REQUIRE(stats[i - 1].second.total_time >=
+			stats[i].second.total_time);
+	}
+	// Literals are replaced, so the version that the schema patch sets
+	// doesn't show up in its shape
+	const QueryStats versions = find(
+			"UPDATE metadata SET db_schema_version_major = ?, "
+			"db_schema_version_minor = ?;");
+	REQUIRE(versions.calls == 1);
+	for (const auto& entry : stats) {
+		REQUIRE(entry.first.find("  ") == std::string::npos);
+	}
+}
+
+TEST_CASE("Queries aren't profiled unless cache-query-stats is set",
+	"[Cache]")
+{
+	ConfigContainer cfg;
+	Cache rsscache(":memory:", &cfg);
+	const auto feedurl = "file://data/rss.xml";
+	RssParser parser(feedurl, &rsscache, &cfg, nullptr);
+	rsscache.externalize_rssfeed(parser.parse(), false);
+	rsscache.internalize_rssfeed(feedurl, nullptr);
+
+	REQUIRE(rsscache.get_query_stats().empty());
+}
+
+/* Runs EXPLAIN QUERY PLAN for `query` and returns the lines of the plan that
+ * read all articles or sort rows in a temporary B-tree. Other tables have at
+ * most a row per feed, so scanning them is fine. */
+static std::vector<std::string> slow_plan_steps(sqlite3* db,
+	const std::string& query)
+{
+	sqlite3_stmt* stmt = nullptr;
+	const std::string explain = "EXPLAIN QUERY PLAN " + query;
+	const int rc = sqlite3_prepare_v2(
+			db, explain.c_str(), explain.size(), &stmt, nullptr);
+	INFO(sqlite3_errmsg(db));
+	REQUIRE(rc == SQLITE_OK);
+
+	std::vector<std::string> result;
+	while (sqlite3_step(stmt) == SQLITE_ROW) {
+		const std::string detail = reinterpret_cast<const char*>(
+				sqlite3_column_text(stmt, 3));
+		// SQLite before 3.36 says "SCAN TABLE rss_item", and tables
+		// named with their schema are shown that way
+		const bool full_scan = (detail == "SCAN rss_item" ||
+				detail == "SCAN TABLE rss_item" ||
+				detail == "SCAN main.rss_item" ||
+				detail == "SCAN TABLE main.rss_item");
+		const bool sort =
+			detail.find("TEMP B-TREE") != std::string::npos;
+		if (full_scan || sort) {
+			result.push_back(detail);
+		}
+	}
+	sqlite3_finalize(stmt);
+	return result;
+}
+
+TEST_CASE("Cache queries don't scan whole tables or sort rows", "[Cache]")
+{
+	TestHelpers::TempFile dbfile;
+	ConfigContainer cfg;
+	cfg.set_configvalue("max-items", "5");
+	cfg.set_configvalue("keep-articles-days", "3650000");
+	cfg.set_configvalue("delete-read-articles-on-quit", "yes");
+	cfg.set_configvalue("archive-articles-days", "1");
+	cfg.set_configvalue("cache-query-stats", "yes");
+
+	// Schema patches are only run by the first Cache, so the queries
+	// recorded by the second one are the ones Newsboat runs day to day.
+	{
+		Cache creator(dbfile.getPath(), &cfg);
+	}
+	std::unique_ptr<Cache> rsscache(new Cache(dbfile.getPath(), &cfg));
+
+	const std::vector<std::string> feedurls = {
+		"file://data/rss.xml", "file://data/atom10_1.xml"};
+	std::vector<std::shared_ptr<RssFeed>> feeds;
+	for (const auto& url : feedurls) {
+		RssParser parser(url, rsscache.get(), &cfg, nullptr);
+		feeds.push_back(parser.parse());
+		rsscache->externalize_rssfeed(feeds.back(), false);
+		rsscache->externalize_rssfeed(feeds.back(), true);
+	}
+
+	rsscache->internalize_rssfeeds(feedurls, nullptr);
+	auto lazy = rsscache->internalize_rssfeed_counts(feedurls, nullptr);
+	rsscache->internalize_rssitems(feedurls[0], nullptr);
+	auto feed = rsscache->internalize_rssfeed(feedurls[0], nullptr);
+	rsscache->fetch_descriptions(feed.get());
+
+	rsscache->search_for_items("content", "");
+	rsscache->search_for_items("content", feedurls[0]);
+	rsscache->search_for_items("++", "");
+	rsscache->search_for_items("++", feedurls[0]);
+	rsscache->search_in_items("content", {feed->items()[0]->guid()});
+	rsscache->search_in_items("++", {feed->items()[0]->guid()});
+
+	feed->items()[0]->set_unread(false);
+	feed->items()[1]->set_flags("ab");
+	rsscache->update_rssitem_flags(feed->items()[1].get());
+	rsscache->flush_pending_changes();
+
+	time_t lastmodified;
+	std::string etag;
+	rsscache->update_lastmodified(feedurls[0], 1, "etag");
+	rsscache->fetch_lastmodified(feedurls[0], lastmodified, etag);
+
+	rsscache->mark_all_read(feed);
+	rsscache->mark_all_read(feedurls[1]);
+	rsscache->mark_all_read();
+	rsscache->mark_items_read_by_guid({feed->items()[2]->guid()});
+	rsscache->get_read_item_guids();
+	rsscache->get_unread_count();
+	rsscache->get_feed_counts();
+	rsscache->check_feed_counts();
+
+	rsscache->archive_old_items(1);
+	rsscache->search_for_items("content", "");
+	rsscache->search_in_items("++", {feed->items()[0]->guid()});
+	rsscache->externalize_rssfeed(feeds[0], false);
+	feed->items()[0]->set_unread(true);
+	rsscache->flush_pending_changes();
+
+	rsscache->mark_item_deleted(feed->items()[3]->guid(), true);
+	rsscache->remove_old_deleted_items(
+		feedurls[0], {feed->items()[4]->guid()});
+	rsscache->mark_feed_items_deleted(feedurls[1]);
+
+	rsscache->cleanup_cache(feeds);
+	const auto stats = rsscache->get_query_stats();
+	rsscache.reset();
+
+	// Operations that go over (nearly) all articles anyway: recounting
+	// them, exporting read ones, deleting read ones on quit, picking old
+	// ones to archive, and deleting expired ones when the cache is opened
+	const std::unordered_set<std::string> full_passes = {
+		"SELECT feedurl, sum(unread = ?), count(*) FROM rss_item "
+		"WHERE deleted = ? GROUP BY feedurl;",
+		"SELECT guid FROM rss_item WHERE unread = ?;",
+		"SELECT guid FROM rss_item WHERE unread = ? UNION ALL "
+		"SELECT guid FROM archive.rss_item WHERE unread = ?;",
+		"UPDATE rss_item SET deleted = ? WHERE unread = ?",
+		"DELETE FROM main.rss_item WHERE id IN "
+		"(SELECT id FROM main.rss_item "
+		"WHERE unread = ? AND deleted = ? "
+		"AND (flags IS NULL OR flags = ?) AND pubDate < ?1 "
+		"ORDER BY id LIMIT ?2);",
+		"DELETE FROM rss_item WHERE pubDate < ?;",
+		"DELETE FROM archive.rss_item WHERE pubDate < ?;",
+		"DELETE FROM archive.rss_item WHERE id IN "
+		"(SELECT id FROM main.rss_item "
+		"WHERE unread = ? AND deleted = ? "
+		"AND (flags IS NULL OR flags = ?) AND pubDate < ?1 "
+		"ORDER BY id LIMIT ?2);",
+	};
+	// Lists all the columns, so it's matched by its beginning
+	const std::string archiving = "INSERT INTO archive.rss_item ";
+
+	sqlite3* db = nullptr;
+	REQUIRE(sqlite3_open(dbfile.getPath().c_str(), &db) == SQLITE_OK);
+	add_content_text_function(db);
+	REQUIRE(sqlite3_exec(db,
+			"CREATE TEMP TABLE key_set (key_hash INTEGER NOT NULL, "
+			"key TEXT NOT NULL);",
+			nullptr,
+			nullptr,
+			nullptr) == SQLITE_OK);
+	const std::string attach = "ATTACH DATABASE '" + dbfile.getPath() +
+		".archive' AS archive;";
+	REQUIRE(sqlite3_exec(db, attach.c_str(), nullptr, nullptr, nullptr) ==
+		SQLITE_OK);
+	for (const auto& entry : stats) {
+		const std::string& query = entry.second.sample;
+		if (full_passes.count(entry.first) > 0 ||
+			entry.first.compare(0, archiving.size(), archiving) ==
+			0 ||
+			query.compare(0, 7, "PRAGMA ") == 0 ||
+			query.compare(0, 7, "CREATE ") == 0) {
+			continue;
+		}
+		INFO("Query: " << query);
+		for (const auto& step : slow_plan_steps(db, query)) {
+			INFO("Plan: " << step);
+			// Search results are sorted once they're found, and
+			// there are only as many of them as there are matches
+			const bool search_results =
+				query.find(" AS matches ") != std::string::npos;
+			CHECK((search_results &&
+				step.find("TEMP B-TREE") != std::string::npos));
+		}
+	}
+	sqlite3_close(db);
+}
@@ -0,0 +1,174 @@
+#include "multidownloader.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "3rd-party/catch.hpp"
+#include "utils.h"
+
+using namespace newsboat;
+
+namespace {
+
+std::string file_url(const std::string& path)
+{
+	char cwd[4096];
+	REQUIRE(::getcwd(cwd, sizeof(cwd)) != nullptr);
+	return std::string("file://") + cwd + "/" + path;
+}
+
+size_t discard_data(char*, size_t size, size_t nmemb, void*)
+{
+	return size * nmemb;
+}
+
+void setup_download(CurlHandle& handle, const std::string& url)
+{
+	curl_easy_setopt(handle.ptr(), CURLOPT_URL, url.c_str());
+	curl_easy_setopt(handle.ptr(), CURLOPT_WRITEFUNCTION, discard_data);
+}
+
+} // namespace
+
+TEST_CASE("MultiDownloader runs all transfers and reports their outcomes",
+	"[MultiDownloader]")
+{
+	MultiDownloader downloader(100, 6);
+	const std::vector<std::string> urls = {file_url("data/rss.xml"),
+		file_url("data/atom10_1.xml"),
+		file_url("data/non-existent.xml")};
+	std::vector<CURLcode> results(urls.size(), CURLE_OK);
+	std::vector<bool> done(urls.size(), false);
+
+	for (size_t i = 0; i < urls.size(); ++i) {
+		const std::string url = urls[i];
+		downloader.add(url,
+			[url](CurlHandle& handle) {
+				setup_download(handle, url);
+			},
+			[&, i](CurlHandle&, CURLcode result) {
+				done[i] = true;
+				results[i] = result;
+			});
+	}
+	downloader.run();
+
+	REQUIRE(std::all_of(done.begin(), done.end(), [](bool d) {
+		return d;
+	}));
+	REQUIRE(results[0] == CURLE_OK);
+	REQUIRE(results[1] == CURLE_OK);
+	REQUIRE(results[2] == CURLE_FILE_COULDNT_READ_FILE);
+}
+
+TEST_CASE("MultiDownloader doesn't run more transfers at once than allowed",
+	"[MultiDownloader]")
+{
+	const std::string url = file_url("data/rss.xml");
+	unsigned int running = 0;
+	unsigned int max_running = 0;
+	unsigned int finished = 0;
+	auto add_transfers = [&](MultiDownloader& downloader) {
+		for (int i = 0; i < 10; ++i) {
+			downloader.add(url,
+				[&](CurlHandle& handle) {
+					setup_download(handle, url);
+					++running;
+					if (running > max_running) {
+						max_running = running;
+					}
+				},
+				[&](CurlHandle&, CURLcode result) {
+					REQUIRE(result == CURLE_OK);
+					--running;
+					++finished;
+				});
+		}
+	};
+
+	SECTION("Overall limit")
+	{
+		MultiDownloader downloader(2, 6);
+		add_transfers(downloader);
+		downloader.run();
+
+		REQUIRE(finished == 10);
+		REQUIRE(max_running == 2);
+	}
+
+	SECTION("Per-host limit")
+	{
+		// All file:// URLs share the same (empty) host.
+		MultiDownloader downloader(100, 1);
+		add_transfers(downloader);
+		downloader.run();
+
+		REQUIRE(finished == 10);
+		REQUIRE(max_running == 1);
+	}
+}
+
+TEST_CASE("MultiDownloader skips transfers whose setup throws",
+	"[MultiDownloader]")
+{
+	MultiDownloader downloader(100, 6);
+	const std::string url = file_url("data/rss.xml");
+	std::vector<CURLcode> results;
+
+	downloader.add(url,
+		[](CurlHandle&) {
+			throw std::runtime_error("no way");
+		},
+		[&](CurlHandle&, CURLcode result) {
+			results.push_back(result);
+		});
+	downloader.add(url,
+		[url](CurlHandle& handle) {
+			setup_download(handle, url);
+		},
+		[&](CurlHandle&, CURLcode result) {
+			results.push_back(result);
+		});
+	downloader.run();
+
+	REQUIRE(results.size() == 2);
+	REQUIRE(results[0] == CURLE_FAILED_INIT);
+	REQUIRE(results[1] == CURLE_OK);
+}
+
+TEST_CASE("MultiDownloader retries failed transfers", "[MultiDownloader]")
+{
+	MultiDownloader downloader(100, 6);
+	const std::vector<std::string> urls = {
+		file_url("data/non-existent.xml"), file_url("data/rss.xml")};
+	std::vector<unsigned int> attempts(urls.size(), 0);
+	std::vector<std::vector<CURLcode>> results(urls.size());
+
+	for (size_t i = 0; i < urls.size(); ++i) {
+		const std::string url = urls[i];
+		downloader.add(url,
+			[&, i, url](CurlHandle& handle) {
+				attempts[i]++;
+				setup_download(handle, url);
+			},
+			[&, i](CurlHandle&, CURLcode result) {
+				results[i].push_back(result);
+			},
+			3);
+	}
+	downloader.run();
+
+	SECTION("Failed transfer is tried as many times as allowed")
+	{
+		REQUIRE(attempts[0] == 3);
+		REQUIRE(results[0] ==
+			std::vector<CURLcode>({CURLE_FILE_COULDNT_READ_FILE}));
+	}
+
+	SECTION("Successful transfer is only run once")
+	{
+		REQUIRE(attempts[1] == 1);
+		REQUIRE(results[1] == std::vector<CURLcode>({CURLE_OK}));
+	}
+}
@@ -0,0 +1,109 @@
+#include "reloadschedule.h"
+
+#include "3rd-party/catch.hpp"
+
+using namespace newsboat;
+
+// Monday, 2024-01-01 00:00:00 UTC
+static const time_t MONDAY_MIDNIGHT = 1704067200;
+
+static const time_t HOUR = 60 * 60;
+static const time_t DAY = 24 * HOUR;
+
+TEST_CASE("next_reload_time() spaces reloads by how often a feed publishes",
+	"[reloadschedule]")
+{
+	const time_t now = MONDAY_MIDNIGHT;
+	const RefreshHints no_hints;
+
+	SECTION("Feed without articles is reloaded after the minimum interval")
+	{
+		REQUIRE(next_reload_time(now, {}, no_hints, HOUR, DAY) ==
+			now + HOUR);
+	}
+
+	SECTION("Feed is checked twice per interval between its articles")
+	{
+		// Four articles in the last eight hours: one every two hours
+		const std::vector<time_t> pubdates = {now - 1 * HOUR,
+			now - 3 * HOUR,
+			now - 5 * HOUR,
+			now - 8 * HOUR};
+		REQUIRE(next_reload_time(now, pubdates, no_hints, 60, DAY) ==
+			now + HOUR);
+	}
+
+	SECTION("Busy feeds aren't reloaded more often than the minimum")
+	{
+		const std::vector<time_t> pubdates = {now - 60, now - 120};
+		REQUIRE(next_reload_time(now, pubdates, no_hints, HOUR, DAY) ==
+			now + HOUR);
+	}
+
+	SECTION("Quiet feeds are still reloaded after the maximum interval")
+	{
+		const std::vector<time_t> pubdates = {now - 300 * DAY};
+		REQUIRE(next_reload_time(now, pubdates, no_hints, HOUR, DAY) ==
+			now + DAY);
+	}
+
+	SECTION("Articles from the future don't make the interval negative")
+	{
+		const std::vector<time_t> pubdates = {now + DAY};
+		REQUIRE(next_reload_time(now, pubdates, no_hints, HOUR, DAY) ==
+			now + HOUR);
+	}
+}
+
+TEST_CASE("next_reload_time() follows the feed's refresh hints",
+	"[reloadschedule]")
+{
+	const time_t now = MONDAY_MIDNIGHT;
+	RefreshHints hints;
+
+	SECTION("Minimum interval from the hints raises the interval")
+	{
+		hints.min_interval = 3 * HOUR;
+		REQUIRE(next_reload_time(now, {}, hints, HOUR, DAY) ==
+			now + 3 * HOUR);
+	}
+
+	SECTION("Maximum interval wins over the hints")
+	{
+		hints.min_interval = 7 * DAY;
+		REQUIRE(next_reload_time(now, {}, hints, HOUR, DAY) ==
+			now + DAY);
+	}
+
+	SECTION("Skipped hours are moved past")
+	{
+		hints.skip_hours = {1, 2, 3};
+		REQUIRE(next_reload_time(now, {}, hints, HOUR, DAY) ==
+			now + 4 * HOUR);
+	}
+
+	SECTION("Skipped days are moved past")
+	{
+		// Monday is 1, Tuesday is 2
+		hints.skip_days = {1, 2};
+		REQUIRE(next_reload_time(now, {}, hints, HOUR, DAY) ==
+			now + 2 * DAY);
+	}
+
+	SECTION("Skipped hours and days combine")
+	{
+		hints.skip_days = {1};
+		hints.skip_hours = {0, 1};
+		REQUIRE(next_reload_time(now, {}, hints, HOUR, DAY) ==
+			now + DAY + 2 * HOUR);
+	}
+
+	SECTION("Skipping every hour gives up instead of looping forever")
+	{
+		for (unsigned int hour = 0; hour < 24; hour++) {
+			hints.skip_hours.insert(hour);
+		}
+		REQUIRE(next_reload_time(now, {}, hints, HOUR, DAY) ==
+			now + HOUR + 24 * 7 * HOUR);
+	}
+}
@@ -1,12 +1,22 @@
 #include "rss.h"
 #include "rsspp.h"
 
+#include <unistd.h>
+
 #include "3rd-party/catch.hpp"
 #include "cache.h"
 #include "configcontainer.h"
 #include "rssparser.h"
 #include "rssppinternal.h"
 #include "test-helpers.h"
+#include "utils.h"
+
+static std::string absolute_file_url(const std::string& path)
+{
+	char cwd[4096];
+	REQUIRE(::getcwd(cwd, sizeof(cwd)) != nullptr);
+	return std::string("file://") + cwd + "/" + path;
+}
 
 TEST_CASE("Throws exception if file doesn't exist", "[rsspp::Parser]")
 {
@@ -262,6 +272,78 @@ TEST_CASE(
 	}
 }
 
+TEST_CASE("prepare_transfer() and finish_transfer() wrap a transfer run by "
+	  "the caller",
+	"[rsspp::Parser]")
+{
+	rsspp::Parser p;
+	newsboat::CurlHandle handle;
+	std::string buffer;
+
+	SECTION("Successful transfer")
+	{
+		const auto url = absolute_file_url("data/rss20_1.xml");
+		p.prepare_transfer(
+			handle.ptr(), url, 0, "", nullptr, "", buffer);
+		const CURLcode ret = curl_easy_perform(handle.ptr());
+		REQUIRE_NOTHROW(p.finish_transfer(handle.ptr(), ret, ""));
+
+		rsspp::Feed f = p.parse_buffer(buffer, url);
+		REQUIRE(f.rss_version == rsspp::RSS_2_0);
+		REQUIRE(f.title == "my weblog");
+	}
+
+	SECTION("Failed transfer")
+	{
+		const auto url = absolute_file_url("data/non-existent.xml");
+		p.prepare_transfer(
+			handle.ptr(), url, 0, "", nullptr, "", buffer);
+		const CURLcode ret = curl_easy_perform(handle.ptr());
+		REQUIRE_THROWS_AS(p.finish_transfer(handle.ptr(), ret, ""),
+			rsspp::Exception);
+	}
+}
+
+TEST_CASE("Extracts refresh hints from RSS 2.0 and 1.0", "[rsspp::Parser]")
+{
+	rsspp::Parser p;
+	rsspp::Feed f;
+
+	SECTION("RSS 2.0")
+	{
+		REQUIRE_NOTHROW(
+			f = p.parse_file("data/rss20_refresh_hints.xml"));
+
+		REQUIRE(f.ttl == 90);
+		REQUIRE(f.update_period == "hourly");
+		REQUIRE(f.update_frequency == 2);
+		REQUIRE(f.skip_hours == std::vector<unsigned int>({0, 23, 24}));
+		REQUIRE(f.skip_days ==
+			std::vector<std::string>(
+				{"Saturday", "Sunday", "Caturday"}));
+	}
+
+	SECTION("RSS 1.0")
+	{
+		REQUIRE_NOTHROW(f = p.parse_file("data/rss10_syndication.xml"));
+
+		REQUIRE(f.ttl == 0);
+		REQUIRE(f.update_period == "weekly");
+		REQUIRE(f.update_frequency == 7);
+		REQUIRE(f.skip_hours.empty());
+		REQUIRE(f.skip_days.empty());
+	}
+
+	SECTION("Feed without hints")
+	{
+		REQUIRE_NOTHROW(f = p.parse_file("data/rss20_1.xml"));
+
+		REQUIRE(f.ttl == 0);
+		REQUIRE(f.update_period == "");
+		REQUIRE(f.update_frequency == 0);
+	}
+}
+
 namespace newsboat {
 
 TEST_CASE("set_rssurl checks if query feed has a valid query", "[rss]")
@@ -714,4 +796,187 @@ TEST_CASE(
 	REQUIRE(f.is_query_feed());
 }
 
+TEST_CASE("RssParser::get_refresh_hints() combines the feed's hints",
+	"[RssParser]")
+{
+	ConfigContainer cfg;
+	Cache rsscache(":memory:", &cfg);
+
+	SECTION("Longest of the intervals is used; invalid hours and days are "
+		"dropped")
+	{
+		RssParser parser("file://data/rss20_refresh_hints.xml",
+			&rsscache,
+			&cfg,
+			nullptr);
+		parser.parse();
+
+		const RefreshHints hints = parser.get_refresh_hints();
+		// <ttl> of 90 minutes beats twice an hour
+		REQUIRE(hints.min_interval == 90 * 60);
+		REQUIRE(hints.skip_hours == std::set<unsigned int>({0, 23}));
+		REQUIRE(hints.skip_days == std::set<unsigned int>({0, 6}));
+	}
+
+	SECTION("Update period is divided by the frequency")
+	{
+		RssParser parser("file://data/rss10_syndication.xml",
+			&rsscache,
+			&cfg,
+			nullptr);
+		parser.parse();
+
+		const RefreshHints hints = parser.get_refresh_hints();
+		REQUIRE(hints.min_interval == 24 * 60 * 60);
+	}
+
+	SECTION("Feed without hints")
+	{
+		RssParser parser(
+			"file://data/rss20_1.xml", &rsscache, &cfg, nullptr);
+		parser.parse();
+
+		const RefreshHints hints = parser.get_refresh_hints();
+		REQUIRE(hints.min_interval == 0);
+		REQUIRE(hints.skip_hours.empty());
+		REQUIRE(hints.skip_days.empty());
+	}
+}
+
+TEST_CASE("RssParser doesn't parse the same document twice", "[RssParser]")
+{
+	ConfigContainer cfg;
+	Cache rsscache(":memory:", &cfg);
+	TestHelpers::TempFile feedfile;
+	const std::string url = "exec:cat " + feedfile.getPath();
+	REQUIRE(::system(("cp data/rss.xml " + feedfile.getPath()).c_str()) ==
+		0);
+
+	{
+		RssParser parser(url, &rsscache, &cfg, nullptr);
+		std::shared_ptr<RssFeed> feed = parser.parse();
+		REQUIRE_FALSE(parser.is_unchanged());
+		REQUIRE(feed->total_item_count() == 8);
+		rsscache.externalize_rssfeed(feed, false);
+		parser.store_parse_results();
+	}
+
+	SECTION("Same document is treated as not modified")
+	{
+		RssParser parser(url, &rsscache, &cfg, nullptr);
+		std::shared_ptr<RssFeed> feed = parser.parse();
+		REQUIRE(parser.is_unchanged());
+		REQUIRE(feed->total_item_count() == 0);
+	}
+
+	SECTION("Changed document is parsed")
+	{
+		REQUIRE(::system(("echo >> " + feedfile.getPath()).c_str()) ==
+			0);
+
+		RssParser parser(url, &rsscache, &cfg, nullptr);
+		std::shared_ptr<RssFeed> feed = parser.parse();
+		REQUIRE_FALSE(parser.is_unchanged());
+		REQUIRE(feed->total_item_count() == 8);
+	}
+
+	SECTION("Document is parsed again when settings change")
+	{
+		cfg.set_configvalue("max-items", "5");
+
+		RssParser parser(url, &rsscache, &cfg, nullptr);
+		parser.parse();
+		REQUIRE_FALSE(parser.is_unchanged());
+	}
+
+	SECTION("Document is parsed again when ignore rules change")
+	{
+		RssIgnores ignores;
+		ignores.handle_action(
+			"ignore-article", {"*", "title =~ \"Botox\""});
+
+		RssParser parser(url, &rsscache, &cfg, &ignores);
+		parser.parse();
+		REQUIRE_FALSE(parser.is_unchanged());
+	}
+}
+
+TEST_CASE("RssParser keeps the feed's refresh hints while it's unchanged",
+	"[RssParser]")
+{
+	ConfigContainer cfg;
+	Cache rsscache(":memory:", &cfg);
+	TestHelpers::TempFile feedfile;
+	const std::string url = "exec:cat " + feedfile.getPath();
+	REQUIRE(::system(("cp data/rss20_refresh_hints.xml " +
+				 feedfile.getPath())
+			.c_str()) == 0);
+
+	{
+		RssParser parser(url, &rsscache, &cfg, nullptr);
+		rsscache.externalize_rssfeed(parser.parse(), false);
+		parser.store_parse_results();
+	}
+
+	RssParser parser(url, &rsscache, &cfg, nullptr);
+	parser.parse();
+	REQUIRE(parser.is_unchanged());
+
+	const RefreshHints hints = parser.get_refresh_hints();
+	REQUIRE(hints.min_interval == 90 * 60);
+	REQUIRE(hints.skip_hours == std::set<unsigned int>({0, 23}));
+	REQUIRE(hints.skip_days == std::set<unsigned int>({0, 6}));
+}
+
+TEST_CASE("RssParser can leave the download to the caller", "[RssParser]")
+{
+	ConfigContainer cfg;
+	Cache rsscache(":memory:", &cfg);
+
+	SECTION("Only HTTP feeds are downloaded by the caller")
+	{
+		REQUIRE(RssParser("https://example.com/feed.xml",
+			&rsscache,
+			&cfg,
+			nullptr).is_http_download());
+		REQUIRE_FALSE(RssParser("file://data/rss.xml",
+			&rsscache,
+			&cfg,
+			nullptr).is_http_download());
+		REQUIRE_FALSE(RssParser("exec:~/bin/feed.sh",
+			&rsscache,
+			&cfg,
+			nullptr).is_http_download());
+	}
+
+	SECTION("Downloaded feed is parsed")
+	{
+		RssParser parser(absolute_file_url("data/rss.xml"),
+			&rsscache,
+			&cfg,
+			nullptr);
+		CurlHandle handle;
+		parser.start_download(handle);
+		parser.finish_download(
+			handle, curl_easy_perform(handle.ptr()));
+
+		std::shared_ptr<RssFeed> feed = parser.parse_download();
+		REQUIRE(feed->total_item_count() == 8);
+	}
+
+	SECTION("Download errors are reported by parse_download()")
+	{
+		RssParser parser(absolute_file_url("data/non-existent.xml"),
+			&rsscache,
+			&cfg,
+			nullptr);
+		CurlHandle handle;
+		parser.start_download(handle);
+		REQUIRE_NOTHROW(parser.finish_download(
+			handle, curl_easy_perform(handle.ptr())));
+
+		REQUIRE_THROWS_AS(parser.parse_download(), rsspp::Exception);
+	}
+}
+
 } // namespace newsboat